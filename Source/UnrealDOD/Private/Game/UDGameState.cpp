@@ -3,6 +3,10 @@
 
 #include "Game/UDGameState.h"
 #include "Engine/Level.h"
+#include "Engine/World.h"
+#include "Engine/StaticMeshActor.h"
+#include "Components/StaticMeshComponent.h"
+#include "GameFramework/PlayerController.h"
 
 
 AUDGameState::AUDGameState(const FObjectInitializer& ObjectInitializer)
@@ -17,20 +21,61 @@ void AUDGameState::BeginPlay()
 	UWorld* World = GetWorld();
 	check(World);
 
-	Simulation = new FUDSimulation(GetWorld());
+	Simulation = new FUDSimulation(GetWorld(), SimulationConfig);
 	if (Simulation)
 	{
+		Simulation->InitializePresentation(this);
+
+		// One pass over the level, the entities are registered in bulk on a worker and the simulation starts once they are in
+		TArray<FUDEntityDesc> Entities = {};
+		TArray<TWeakObjectPtr<AActor>> ConvertedActors = {};
 		for (ULevel* Level : World->GetLevels())
 		{
 			check(Level);
+			Entities.Reserve(Entities.Num() + Level->Actors.Num());
 			for (AActor* CurrentActor : Level->Actors)
 			{
-				if (IsValid(CurrentActor) && CurrentActor->ActorHasTag(UD_DOD_TAG))
+				if (!IsValid(CurrentActor))
 				{
-					const int32 SimActorIndex = Simulation->RegisterActor(CurrentActor);
+					continue;
+				}
+
+				if (CurrentActor->ActorHasTag(UD_DOD_INSTANCE_TAG))
+				{
+					// Actors without gameplay logic only need their mesh, they become static instances and the actor goes away
+					const AStaticMeshActor* MeshActor = Cast<AStaticMeshActor>(CurrentActor);
+					UStaticMesh* Mesh = MeshActor ? MeshActor->GetStaticMeshComponent()->GetStaticMesh() : nullptr;
+					if (Mesh)
+					{
+						FUDEntityDesc& Entity = Entities.AddDefaulted_GetRef();
+						Entity.Mesh = Mesh;
+						Entity.Transform = CurrentActor->GetActorTransform();
+						Entity.Archetype = EUDArchetype::Static;
+						ConvertedActors.Add(CurrentActor);
+						continue;
+					}
+				}
+
+				if (CurrentActor->ActorHasTag(UD_DOD_TAG))
+				{
+					FUDEntityDesc& Entity = Entities.AddDefaulted_GetRef();
+					Entity.Actor = CurrentActor;
+					Entity.Transform = CurrentActor->GetActorTransform();
 				}
 			}
 		}
+
+		Simulation->RegisterEntitiesAsync(MoveTemp(Entities), [ConvertedActors = MoveTemp(ConvertedActors)](const TArray<FUDEntityHandle>& Handles)
+		{
+			// The instances exist by now, the actors they replace can go
+			for (const TWeakObjectPtr<AActor>& ConvertedActor : ConvertedActors)
+			{
+				if (ConvertedActor.IsValid())
+				{
+					ConvertedActor->Destroy();
+				}
+			}
+		});
 	}
 }
 
@@ -39,6 +84,20 @@ void AUDGameState::Tick(float DeltaSeconds)
 	Super::Tick(DeltaSeconds);
 	if (Simulation)
 	{
+		// Every player view drives the simulation LOD, remote players included on a server
+		TArray<FVector> Viewers = {};
+		for (FConstPlayerControllerIterator Iterator = GetWorld()->GetPlayerControllerIterator(); Iterator; ++Iterator)
+		{
+			const APlayerController* PlayerController = Iterator->Get();
+			if (PlayerController)
+			{
+				FVector ViewLocation = FVector::ZeroVector;
+				FRotator ViewRotation = FRotator::ZeroRotator;
+				PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+				Viewers.Add(ViewLocation);
+			}
+		}
+		Simulation->SetViewers(Viewers);
 		Simulation->Tick_GameThread(DeltaSeconds);
 	}
 }
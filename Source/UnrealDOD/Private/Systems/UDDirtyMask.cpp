@@ -0,0 +1,37 @@
+// Copyright - Jed
+
+
+#include "Systems/UDDirtyMask.h"
+
+void FUDDirtyMask::Init(const int32& InNumBits)
+{
+	NumBits = InNumBits;
+	Words.SetNumUninitialized(FMath::DivideAndRoundUp(InNumBits, 64), false);
+	FMemory::Memzero(Words.GetData(), Words.Num() * sizeof(uint64));
+}
+
+void FUDDirtyMask::CopyFrom(const FUDDirtyMask& Other)
+{
+	NumBits = Other.NumBits;
+	Words.Reset();
+	Words.Append(Other.Words);
+}
+
+void FUDDirtyMask::Or(const FUDDirtyMask& Other)
+{
+	check(Other.NumBits == NumBits);
+	for (int32 WordIndex = 0; WordIndex < Words.Num(); WordIndex++)
+	{
+		Words[WordIndex] |= Other.Words[WordIndex];
+	}
+}
+
+int32 FUDDirtyMask::CountSetBits() const
+{
+	int32 Count = 0;
+	for (const uint64& Word : Words)
+	{
+		Count += (int32)FMath::CountBits(Word);
+	}
+	return Count;
+}
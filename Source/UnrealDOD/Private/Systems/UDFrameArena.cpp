@@ -0,0 +1,144 @@
+// Copyright - Jed
+
+
+#include "Systems/UDFrameArena.h"
+#include "Misc/ScopeLock.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+#define UD_FRAME_ARENA_BLOCK_SIZE (64 * 1024)
+#define UD_FRAME_ARENA_MIN_ALIGNMENT 16u // Same as the default heap alignment
+
+static thread_local FUDFrameArena* CurrentFrameArena = nullptr;
+
+FUDFrameArena::~FUDFrameArena()
+{
+	for (const FBlock& Block : Blocks)
+	{
+		FMemory::Free(Block.Data);
+	}
+}
+
+void* FUDFrameArena::Allocate(const SIZE_T& Size, const uint32& Alignment)
+{
+	FScopeLock ScopeLock(&Mutex);
+	return AllocateLocked(Size, Alignment);
+}
+
+void* FUDFrameArena::Reallocate(void* Data, const SIZE_T& PreviousSize, const SIZE_T& Size, const uint32& Alignment)
+{
+	FScopeLock ScopeLock(&Mutex);
+	if (Data && Data == LastAllocation)
+	{
+		// Containers grown in a loop keep extending the same allocation
+		const FBlock& Block = Blocks[BlockIndex];
+		const SIZE_T Begin = (uint8*)Data - Block.Data;
+		if (Begin + Size <= Block.Size)
+		{
+			UsedBytes = UsedBytes - (Offset - Begin) + Size;
+			PeakBytes = FMath::Max(PeakBytes, UsedBytes);
+			Offset = Begin + Size;
+			return Data;
+		}
+	}
+
+	void* NewData = AllocateLocked(Size, Alignment);
+	if (Data && PreviousSize > 0)
+	{
+		FMemory::Memcpy(NewData, Data, FMath::Min(PreviousSize, Size));
+	}
+	return NewData;
+}
+
+void FUDFrameArena::Reset()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("FrameArena_Reset");
+	FScopeLock ScopeLock(&Mutex);
+
+	// A step that spilled into more blocks gets one block holding all of them, the next steps fit in it
+	if (BlockIndex > 0)
+	{
+		SIZE_T TotalSize = 0;
+		for (const FBlock& Block : Blocks)
+		{
+			TotalSize += Block.Size;
+			FMemory::Free(Block.Data);
+		}
+		Blocks.Reset();
+		AddBlock(TotalSize);
+	}
+
+	BlockIndex = 0;
+	Offset = 0;
+	LastAllocation = nullptr;
+	UsedBytes = 0;
+}
+
+SIZE_T FUDFrameArena::GetAllocatedSize() const
+{
+	FScopeLock ScopeLock(&Mutex);
+	SIZE_T Size = 0;
+	for (const FBlock& Block : Blocks)
+	{
+		Size += Block.Size;
+	}
+	return Size;
+}
+
+FUDFrameArena* FUDFrameArena::GetCurrent()
+{
+	return CurrentFrameArena;
+}
+
+FUDFrameArena::FScope::FScope(FUDFrameArena& Arena)
+	: Previous(CurrentFrameArena)
+{
+	CurrentFrameArena = &Arena;
+}
+
+FUDFrameArena::FScope::FScope(FUDFrameArena* Arena)
+	: Previous(CurrentFrameArena)
+{
+	CurrentFrameArena = Arena;
+}
+
+FUDFrameArena::FScope::~FScope()
+{
+	CurrentFrameArena = Previous;
+}
+
+void* FUDFrameArena::AllocateLocked(const SIZE_T& Size, const uint32& Alignment)
+{
+	const SIZE_T BlockAlignment = FMath::Max(Alignment, UD_FRAME_ARENA_MIN_ALIGNMENT);
+	for (;;)
+	{
+		if (!Blocks.IsValidIndex(BlockIndex))
+		{
+			AddBlock(Size + BlockAlignment);
+			Offset = 0;
+		}
+
+		const FBlock& Block = Blocks[BlockIndex];
+		const SIZE_T Begin = Align(Block.Data + Offset, BlockAlignment) - Block.Data;
+		if (Begin + Size <= Block.Size)
+		{
+			UsedBytes += Begin + Size - Offset;
+			PeakBytes = FMath::Max(PeakBytes, UsedBytes);
+			Offset = Begin + Size;
+			LastAllocation = Block.Data + Begin;
+			return LastAllocation;
+		}
+
+		// The rest of the current block is lost until the reset
+		BlockIndex++;
+		Offset = 0;
+	}
+}
+
+void FUDFrameArena::AddBlock(const SIZE_T& MinSize)
+{
+	const SIZE_T Size = FMath::Max<SIZE_T>(MinSize, Blocks.Num() > 0 ? Blocks.Last().Size * 2 : UD_FRAME_ARENA_BLOCK_SIZE);
+	FBlock& Block = Blocks.AddDefaulted_GetRef();
+	Block.Data = (uint8*)FMemory::Malloc(Size, UD_FRAME_ARENA_MIN_ALIGNMENT);
+	Block.Size = Size;
+	NumHeapAllocations++;
+}
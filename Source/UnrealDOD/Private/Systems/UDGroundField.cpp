@@ -0,0 +1,161 @@
+// Copyright - Jed
+
+
+#include "Systems/UDGroundField.h"
+#include "Engine/World.h"
+#include "Engine/LevelBounds.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/PackageName.h"
+#include "UObject/Package.h"
+#include "UObject/SavePackage.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+#define MAX_GROUND_FIELD_VERTICES 16777216 // 4k x 4k, 80MB of heights and normals
+
+void UUDGroundField::Bake(UWorld* World, const FBox& Bounds, const float& InCellSize)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("GroundField_Bake");
+	check(IsInGameThread() && World);
+
+	CellSize = FMath::Max(InCellSize, 1.f);
+	Origin = FVector2f((float)Bounds.Min.X, (float)Bounds.Min.Y);
+	NumX = FMath::CeilToInt32((Bounds.Max.X - Bounds.Min.X) / CellSize) + 1;
+	NumY = FMath::CeilToInt32((Bounds.Max.Y - Bounds.Min.Y) / CellSize) + 1;
+	if ((int64)NumX * NumY > MAX_GROUND_FIELD_VERTICES)
+	{
+		UE_LOG(LogTemp, Error, TEXT("UUDGroundField::Bake - %d x %d vertices is too large, increase the cell size"), NumX, NumY);
+		NumX = NumY = 0;
+		Heights.Reset();
+		return;
+	}
+
+	FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(UDGroundFieldBake), true);
+	const float TopZ = (float)Bounds.Max.Z + 100.f;
+	const float BottomZ = (float)Bounds.Min.Z - 100.f;
+	auto TraceDown = [&](const float& X, const float& Y, FHitResult& OutHit)
+	{
+		return World->LineTraceSingleByChannel(OutHit, FVector(X, Y, TopZ), FVector(X, Y, BottomZ), ECC_WorldStatic, QueryParams);
+	};
+
+	Heights.SetNumUninitialized(NumX * NumY);
+	NormalsX.SetNumUninitialized(NumX * NumY);
+	NormalsY.SetNumUninitialized(NumX * NumY);
+	TBitArray<> MissingVertices(false, NumX * NumY);
+	for (int32 y = 0; y < NumY; y++)
+	{
+		for (int32 x = 0; x < NumX; x++)
+		{
+			const int32 Vertex = y * NumX + x;
+			FHitResult Hit = {};
+			if (!TraceDown(Origin.X + x * CellSize, Origin.Y + y * CellSize, Hit) || Hit.ImpactNormal.Z <= 0.)
+			{
+				MissingVertices[Vertex] = true;
+				Heights[Vertex] = BottomZ;
+				NormalsX[Vertex] = NormalsY[Vertex] = 0;
+				continue;
+			}
+
+			Heights[Vertex] = (float)Hit.ImpactPoint.Z;
+			NormalsX[Vertex] = (int8)FMath::RoundToInt32(FMath::Clamp(Hit.ImpactNormal.X, -1., 1.) * 127.);
+			NormalsY[Vertex] = (int8)FMath::RoundToInt32(FMath::Clamp(Hit.ImpactNormal.Y, -1., 1.) * 127.);
+		}
+	}
+
+	// A cell is complex when a corner has no ground, when the center does not match the bilinear surface or when something hangs above it
+	const int32 NumCellsX = FMath::Max(NumX - 1, 0);
+	const int32 NumCellsY = FMath::Max(NumY - 1, 0);
+	ComplexCells.SetNumZeroed(NumCellsX * NumCellsY);
+	int32 NumComplex = 0;
+	for (int32 y = 0; y < NumCellsY; y++)
+	{
+		for (int32 x = 0; x < NumCellsX; x++)
+		{
+			const int32 Vertex = y * NumX + x;
+			bool bComplex = MissingVertices[Vertex] || MissingVertices[Vertex + 1] || MissingVertices[Vertex + NumX] || MissingVertices[Vertex + NumX + 1];
+			if (!bComplex)
+			{
+				const float CenterX = Origin.X + (x + 0.5f) * CellSize;
+				const float CenterY = Origin.Y + (y + 0.5f) * CellSize;
+				const float CenterHeight = (Heights[Vertex] + Heights[Vertex + 1] + Heights[Vertex + NumX] + Heights[Vertex + NumX + 1]) * 0.25f;
+				FHitResult Hit = {};
+				bComplex = !TraceDown(CenterX, CenterY, Hit) || FMath::Abs(Hit.ImpactPoint.Z - CenterHeight) > ComplexTolerance;
+				if (!bComplex)
+				{
+					FHitResult Overhang = {};
+					bComplex = World->LineTraceSingleByChannel(Overhang, Hit.ImpactPoint + FVector(0., 0., 1.), FVector(CenterX, CenterY, TopZ), ECC_WorldStatic, QueryParams);
+				}
+			}
+			ComplexCells[y * NumCellsX + x] = bComplex ? 1 : 0;
+			NumComplex += bComplex ? 1 : 0;
+		}
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("UUDGroundField::Bake - %d x %d vertices of %.0f, %d complex cells out of %d"), NumX, NumY, CellSize, NumComplex, NumCellsX * NumCellsY);
+}
+
+EUDGroundSample UUDGroundField::Sample(const float& X, const float& Y, float& OutHeight, FVector3f& OutNormal) const
+{
+	const float GridX = (X - Origin.X) / CellSize;
+	const float GridY = (Y - Origin.Y) / CellSize;
+	const int32 CellX = FMath::FloorToInt32(GridX);
+	const int32 CellY = FMath::FloorToInt32(GridY);
+	if (CellX < 0 || CellY < 0 || CellX >= NumX - 1 || CellY >= NumY - 1)
+	{
+		return EUDGroundSample::Outside;
+	}
+
+	if (ComplexCells[CellY * (NumX - 1) + CellX])
+	{
+		return EUDGroundSample::Complex;
+	}
+
+	const float AlphaX = GridX - CellX;
+	const float AlphaY = GridY - CellY;
+	const int32 Vertex = CellY * NumX + CellX;
+	OutHeight = FMath::BiLerp(Heights[Vertex], Heights[Vertex + 1], Heights[Vertex + NumX], Heights[Vertex + NumX + 1], AlphaX, AlphaY);
+	OutNormal = FMath::BiLerp(GetNormal(Vertex), GetNormal(Vertex + 1), GetNormal(Vertex + NumX), GetNormal(Vertex + NumX + 1), AlphaX, AlphaY).GetSafeNormal(UE_SMALL_NUMBER, FVector3f::UpVector);
+	return EUDGroundSample::Valid;
+}
+
+namespace UD::GroundField
+{
+	// Bakes the level bounds of the persistent level into a ground field asset, saved next to the other game content in the editor
+	static void RunBake(const TArray<FString>& Args, UWorld* World)
+	{
+		if (!World || !World->PersistentLevel)
+		{
+			return;
+		}
+
+		const float CellSize = Args.Num() > 0 ? FCString::Atof(*Args[0]) : 100.f;
+		const FString PackageName = Args.Num() > 1 ? Args[1] : FString::Printf(TEXT("/Game/UnrealDOD/GF_%s"), *FPackageName::GetShortName(World->GetOutermost()));
+		const FBox Bounds = ALevelBounds::CalculateLevelBounds(World->PersistentLevel);
+		if (!Bounds.IsValid)
+		{
+			UE_LOG(LogTemp, Warning, TEXT("UD.GroundField.Bake - The level has no bounds to bake"));
+			return;
+		}
+
+#if WITH_EDITOR
+		UPackage* Package = CreatePackage(*PackageName);
+		UUDGroundField* GroundField = NewObject<UUDGroundField>(Package, *FPackageName::GetShortName(PackageName), RF_Public | RF_Standalone);
+		GroundField->Bake(World, Bounds, CellSize);
+		Package->MarkPackageDirty();
+
+		FSavePackageArgs SaveArgs = {};
+		SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
+		const FString FileName = FPackageName::LongPackageNameToFilename(PackageName, FPackageName::GetAssetPackageExtension());
+		if (!UPackage::SavePackage(Package, GroundField, *FileName, SaveArgs))
+		{
+			UE_LOG(LogTemp, Error, TEXT("UD.GroundField.Bake - Cannot save %s"), *FileName);
+		}
+#else
+		UE_LOG(LogTemp, Warning, TEXT("UD.GroundField.Bake - Ground fields can only be baked and saved in the editor"));
+#endif
+	}
+
+	static FAutoConsoleCommandWithWorldAndArgs BakeCommand(
+		TEXT("UD.GroundField.Bake"),
+		TEXT("Bakes the ground of the current level into a height and normal grid asset. Usage: UD.GroundField.Bake [CellSize] [PackageName]"),
+		FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&RunBake));
+}
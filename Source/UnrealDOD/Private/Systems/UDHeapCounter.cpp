@@ -0,0 +1,109 @@
+// Copyright - Jed
+
+
+#include "Systems/UDHeapCounter.h"
+#include "HAL/MemoryBase.h"
+
+static thread_local FUDHeapCounter* CurrentHeapCounter = nullptr;
+static std::atomic<bool> bHeapCounterInstalled{ false };
+
+#if UD_HEAP_COUNTER
+
+// Forwards everything to the allocator it wraps, every malloc and every realloc to a non zero size counts, a free never does
+class FUDCountingMalloc final : public FMalloc
+{
+public:
+
+	explicit FUDCountingMalloc(FMalloc* InInner) : Inner(InInner) {};
+
+	virtual void* Malloc(SIZE_T Count, uint32 Alignment) override
+	{
+		CountAllocation();
+		return Inner->Malloc(Count, Alignment);
+	}
+
+	virtual void* TryMalloc(SIZE_T Count, uint32 Alignment) override
+	{
+		CountAllocation();
+		return Inner->TryMalloc(Count, Alignment);
+	}
+
+	virtual void* Realloc(void* Original, SIZE_T Count, uint32 Alignment) override
+	{
+		if (Count > 0)
+		{
+			CountAllocation();
+		}
+		return Inner->Realloc(Original, Count, Alignment);
+	}
+
+	virtual void* TryRealloc(void* Original, SIZE_T Count, uint32 Alignment) override
+	{
+		if (Count > 0)
+		{
+			CountAllocation();
+		}
+		return Inner->TryRealloc(Original, Count, Alignment);
+	}
+
+	virtual void Free(void* Original) override { Inner->Free(Original); }
+	virtual SIZE_T QuantizeSize(SIZE_T Count, uint32 Alignment) override { return Inner->QuantizeSize(Count, Alignment); }
+	virtual bool GetAllocationSize(void* Original, SIZE_T& SizeOut) override { return Inner->GetAllocationSize(Original, SizeOut); }
+	virtual void Trim(bool bTrimThreadCaches) override { Inner->Trim(bTrimThreadCaches); }
+	virtual void SetupTLSCachesOnCurrentThread() override { Inner->SetupTLSCachesOnCurrentThread(); }
+	virtual void ClearAndDisableTLSCachesOnCurrentThread() override { Inner->ClearAndDisableTLSCachesOnCurrentThread(); }
+	virtual void InitializeStatsMetadata() override { Inner->InitializeStatsMetadata(); }
+	virtual void UpdateStats() override { Inner->UpdateStats(); }
+	virtual void GetAllocatorStats(FGenericMemoryStats& OutStats) override { Inner->GetAllocatorStats(OutStats); }
+	virtual void DumpAllocatorStats(FOutputDevice& Ar) override { Inner->DumpAllocatorStats(Ar); }
+	virtual bool IsInternallyThreadSafe() const override { return Inner->IsInternallyThreadSafe(); }
+	virtual bool ValidateHeap() override { return Inner->ValidateHeap(); }
+	virtual const TCHAR* GetDescriptiveName() override { return Inner->GetDescriptiveName(); }
+
+private:
+
+	FORCEINLINE void CountAllocation() const
+	{
+		if (CurrentHeapCounter)
+		{
+			CurrentHeapCounter->Add();
+		}
+	}
+
+	FMalloc* Inner = nullptr;
+};
+
+#endif
+
+void FUDHeapCounter::Install()
+{
+#if UD_HEAP_COUNTER
+	check(IsInGameThread());
+	if (!bHeapCounterInstalled.exchange(true))
+	{
+		// The blocks allocated before the swap are freed through the wrapper, which hands them to the same allocator
+		GMalloc = new FUDCountingMalloc(GMalloc);
+	}
+#endif
+}
+
+bool FUDHeapCounter::IsInstalled()
+{
+	return bHeapCounterInstalled.load();
+}
+
+FUDHeapCounter* FUDHeapCounter::GetCurrent()
+{
+	return CurrentHeapCounter;
+}
+
+FUDHeapCounter::FScope::FScope(FUDHeapCounter* Counter)
+	: Previous(CurrentHeapCounter)
+{
+	CurrentHeapCounter = Counter;
+}
+
+FUDHeapCounter::FScope::~FScope()
+{
+	CurrentHeapCounter = Previous;
+}
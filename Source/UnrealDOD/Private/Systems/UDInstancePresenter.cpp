@@ -0,0 +1,189 @@
+// Copyright - Jed
+
+
+#include "Systems/UDInstancePresenter.h"
+#include "Systems/UDSimulation.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+#define MAX_INSTANCE_RUN_GAP 16 // Clean instances rewritten from the mirror to merge two dirty runs into one update
+
+void FUDInstancePresenter::Initialize(AActor* InOwner)
+{
+	check(IsInGameThread() && InOwner);
+	Owner = InOwner;
+}
+
+void FUDInstancePresenter::AddReferencedObjects(FReferenceCollector& Collector)
+{
+	Collector.AddReferencedObject(Owner);
+	for (FMeshInstances& MeshInstances : Meshes)
+	{
+		Collector.AddReferencedObject(MeshInstances.Mesh);
+		Collector.AddReferencedObject(MeshInstances.Component);
+	}
+}
+
+void FUDInstancePresenter::AddInstance(const FUDEntityHandle& Handle, UStaticMesh* Mesh, const FTransform& Transform)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimPresenter_AddInstance");
+	check(IsInGameThread() && Handle.IsSet());
+	const int32 MeshIndex = FindOrAddMesh(Mesh);
+	if (MeshIndex == INDEX_NONE)
+	{
+		return;
+	}
+
+	FMeshInstances& MeshInstances = Meshes[MeshIndex];
+	int32 InstanceIndex = INDEX_NONE;
+	if (MeshInstances.FreeInstances.Num() > 0)
+	{
+		InstanceIndex = MeshInstances.FreeInstances.Pop(false);
+		MeshInstances.Transforms[InstanceIndex] = Transform;
+		MeshInstances.Component->UpdateInstanceTransform(InstanceIndex, Transform, true, true, true);
+	}
+	else
+	{
+		InstanceIndex = MeshInstances.Component->AddInstance(Transform, true);
+		const int32 MirrorIndex = MeshInstances.Transforms.Add(Transform);
+		MeshInstances.DirtyMask.Add(false);
+		ensureMsgf(MirrorIndex == InstanceIndex, TEXT("FUDInstancePresenter::AddInstance - Cannot add instance properly because the indices seem to unmatch with the component."));
+	}
+
+	if (Instances.Num() <= Handle.Index)
+	{
+		Instances.SetNum(Handle.Index + 1);
+	}
+	FInstance& Instance = Instances[Handle.Index];
+	Instance.Generation = Handle.Generation;
+	Instance.MeshIndex = MeshIndex;
+	Instance.InstanceIndex = InstanceIndex;
+}
+
+void FUDInstancePresenter::RemoveInstance(const FUDEntityHandle& Handle)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimPresenter_RemoveInstance");
+	const FInstance* Instance = FindInstance(Handle);
+	if (!Instance)
+	{
+		return;
+	}
+
+	// Removing from the component would shift every following instance, a zero scaled instance is not rendered
+	FMeshInstances& MeshInstances = Meshes[Instance->MeshIndex];
+	MeshInstances.Transforms[Instance->InstanceIndex].SetScale3D(FVector::ZeroVector);
+	MeshInstances.Component->UpdateInstanceTransform(Instance->InstanceIndex, MeshInstances.Transforms[Instance->InstanceIndex], true, true, true);
+	MeshInstances.FreeInstances.Add(Instance->InstanceIndex);
+	Instances[Handle.Index] = FInstance();
+}
+
+bool FUDInstancePresenter::HasInstance(const FUDEntityHandle& Handle) const
+{
+	return FindInstance(Handle) != nullptr;
+}
+
+FTransform FUDInstancePresenter::GetTransform(const FUDEntityHandle& Handle) const
+{
+	const FInstance* Instance = FindInstance(Handle);
+	return Instance ? Meshes[Instance->MeshIndex].Transforms[Instance->InstanceIndex] : FTransform::Identity;
+}
+
+void FUDInstancePresenter::SetTransform(const FUDEntityHandle& Handle, const FVector& Location, const FRotator& Rotation)
+{
+	const FInstance* Instance = FindInstance(Handle);
+	if (!Instance)
+	{
+		return;
+	}
+
+	FMeshInstances& MeshInstances = Meshes[Instance->MeshIndex];
+	FTransform& Transform = MeshInstances.Transforms[Instance->InstanceIndex];
+	Transform.SetLocation(Location);
+	Transform.SetRotation(Rotation.Quaternion());
+	if (!MeshInstances.DirtyMask[Instance->InstanceIndex])
+	{
+		MeshInstances.DirtyMask[Instance->InstanceIndex] = true;
+		MeshInstances.DirtyInstances.Add(Instance->InstanceIndex);
+	}
+}
+
+void FUDInstancePresenter::Flush()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimPresenter_Flush");
+	for (FMeshInstances& MeshInstances : Meshes)
+	{
+		if (MeshInstances.DirtyInstances.Num() == 0)
+		{
+			continue;
+		}
+
+		TArray<int32>& Dirty = MeshInstances.DirtyInstances;
+		Dirty.Sort();
+
+		auto FlushRun = [&](const int32 RunStart, const int32 RunEnd)
+		{
+			RunTransforms.Reset(RunEnd - RunStart + 1);
+			RunTransforms.Append(&MeshInstances.Transforms[RunStart], RunEnd - RunStart + 1);
+			MeshInstances.Component->BatchUpdateInstancesTransforms(RunStart, RunTransforms, true, false, true);
+		};
+
+		int32 RunStart = Dirty[0];
+		int32 RunEnd = Dirty[0];
+		for (int32 i = 1; i < Dirty.Num(); i++)
+		{
+			if (Dirty[i] - RunEnd > MAX_INSTANCE_RUN_GAP)
+			{
+				FlushRun(RunStart, RunEnd);
+				RunStart = Dirty[i];
+			}
+			RunEnd = Dirty[i];
+		}
+		FlushRun(RunStart, RunEnd);
+		MeshInstances.Component->MarkRenderStateDirty();
+
+		for (const int32& InstanceIndex : Dirty)
+		{
+			MeshInstances.DirtyMask[InstanceIndex] = false;
+		}
+		Dirty.Reset();
+	}
+}
+
+int32 FUDInstancePresenter::FindOrAddMesh(UStaticMesh* Mesh)
+{
+	if (!Mesh || !Owner)
+	{
+		return INDEX_NONE;
+	}
+
+	const int32 ExistingIndex = Meshes.IndexOfByPredicate([Mesh](const FMeshInstances& MeshInstances) { return MeshInstances.Mesh == Mesh; });
+	if (ExistingIndex != INDEX_NONE)
+	{
+		return ExistingIndex;
+	}
+
+	// Plain instanced component, a hierarchical one would rebuild its tree every time the crowd moves
+	UInstancedStaticMeshComponent* Component = NewObject<UInstancedStaticMeshComponent>(Owner);
+	Component->SetStaticMesh(Mesh);
+	Component->SetMobility(EComponentMobility::Movable);
+	Component->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	Component->SetCanEverAffectNavigation(false);
+	Component->RegisterComponent();
+	Owner->AddInstanceComponent(Component);
+
+	FMeshInstances& MeshInstances = Meshes.AddDefaulted_GetRef();
+	MeshInstances.Mesh = Mesh;
+	MeshInstances.Component = Component;
+	return Meshes.Num() - 1;
+}
+
+const FUDInstancePresenter::FInstance* FUDInstancePresenter::FindInstance(const FUDEntityHandle& Handle) const
+{
+	if (!Instances.IsValidIndex(Handle.Index))
+	{
+		return nullptr;
+	}
+	const FInstance& Instance = Instances[Handle.Index];
+	return Instance.MeshIndex != INDEX_NONE && Instance.Generation == Handle.Generation ? &Instance : nullptr;
+}
@@ -0,0 +1,435 @@
+// Copyright - Jed
+
+
+#include "Systems/UDReplication.h"
+#include "Systems/UDSimulation.h"
+#include "Serialization/BitWriter.h"
+#include "Serialization/BitReader.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+#define FORCED_PRIORITY 1000000.f
+#define NEW_ENTITY_ERROR 4.f // Error of an entity the client never acked, in tolerances
+
+namespace UD::Replication
+{
+	static uint32 EncodeSigned(const int32& Value, const int32& Bits)
+	{
+		const int32 Half = 1 << (Bits - 1);
+		return (uint32)(FMath::Clamp(Value, -Half, Half - 1) + Half);
+	}
+
+	static int32 DecodeSigned(const uint32& Value, const int32& Bits)
+	{
+		return (int32)Value - (1 << (Bits - 1));
+	}
+
+	static void WriteBits(FBitWriter& Writer, uint32 Value, const int32& Bits)
+	{
+		Writer.SerializeInt(Value, 1u << Bits);
+	}
+
+	static uint32 ReadBits(FBitReader& Reader, const int32& Bits)
+	{
+		uint32 Value = 0;
+		Reader.SerializeInt(Value, 1u << Bits);
+		return Value;
+	}
+
+	static bool FitsDelta(const FUDQuantizedEntity& State, const FUDQuantizedEntity& Baseline, const int32& Bits)
+	{
+		const int32 Half = 1 << (Bits - 1);
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			const int32 Delta = State.Position[Axis] - Baseline.Position[Axis];
+			if (Delta < -Half || Delta >= Half)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+FUDQuantizedEntity UD::QuantizeEntity(const FUDSimulationConfig& Config, const FVector& Location, const FVector& Velocity, const float& Yaw)
+{
+	FUDQuantizedEntity State = {};
+	const int64 PositionHalf = 1ll << (Config.ReplicationPositionBits - 1);
+	const int64 VelocityHalf = 1ll << (Config.ReplicationVelocityBits - 1);
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		State.Position[Axis] = (int32)FMath::Clamp<int64>(FMath::RoundToInt64(Location[Axis] / Config.ReplicationPositionPrecision), -PositionHalf, PositionHalf - 1);
+		State.Velocity[Axis] = (int32)FMath::Clamp<int64>(FMath::RoundToInt64(Velocity[Axis] / Config.ReplicationVelocityPrecision), -VelocityHalf, VelocityHalf - 1);
+	}
+
+	const uint32 YawSteps = 1u << Config.ReplicationYawBits;
+	State.Yaw = (uint32)FMath::RoundToInt32(FRotator::ClampAxis(Yaw) / 360.f * YawSteps) & (YawSteps - 1);
+	return State;
+}
+
+void UD::DequantizeEntity(const FUDSimulationConfig& Config, const FUDQuantizedEntity& State, FVector& OutLocation, FVector& OutVelocity, float& OutYaw)
+{
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		OutLocation[Axis] = State.Position[Axis] * (double)Config.ReplicationPositionPrecision;
+		OutVelocity[Axis] = State.Velocity[Axis] * (double)Config.ReplicationVelocityPrecision;
+	}
+	OutYaw = State.Yaw * 360.f / (1u << Config.ReplicationYawBits);
+}
+
+void FUDReplicationServer::Initialize(const FUDSimulationConfig& InConfig)
+{
+	Config = InConfig;
+}
+
+int32 FUDReplicationServer::AddConnection()
+{
+	return Connections.Add(FUDReplicationConnection());
+}
+
+void FUDReplicationServer::RemoveConnection(const int32& ConnectionId)
+{
+	if (Connections.IsValidIndex(ConnectionId))
+	{
+		Connections.RemoveAt(ConnectionId);
+	}
+}
+
+uint32 FUDReplicationServer::WritePacket(const int32& ConnectionId, const FUDSimulationSnapshot& Snapshot, const FVector& ViewerLocation, TArray<uint8>& OutPacket)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimReplication_WritePacket");
+	FUDReplicationConnection* Connection = FindConnection(ConnectionId);
+	if (!Connection)
+	{
+		return 0;
+	}
+
+	int32 NumSlots = Connection->Baselines.Num();
+	for (const FUDEntityHandle& Handle : Snapshot.Handles)
+	{
+		NumSlots = FMath::Max(NumSlots, Handle.Index + 1);
+	}
+	Grow(*Connection, NumSlots);
+
+	const uint32 Sequence = Connection->NextSequence++;
+	const float Tolerance = FMath::Max(Config.ReplicationErrorTolerance, UE_KINDA_SMALL_NUMBER);
+	const int32 MaxPositionDelta = FMath::CeilToInt32(Tolerance / Config.ReplicationPositionPrecision);
+	const uint32 YawMask = (1u << Config.ReplicationYawBits) - 1;
+
+	// Candidates are the entities that drifted past the tolerance from their acked state, plus the removals the client did not ack yet
+	Candidates.Reset();
+	PresentSlots.Init(false, NumSlots);
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimReplication_Prioritize");
+		for (int32 i = 0; i < Snapshot.Handles.Num(); i++)
+		{
+			const FUDEntityHandle& Handle = Snapshot.Handles[i];
+			const int32 Slot = Handle.Index;
+			PresentSlots[Slot] = true;
+
+			const FUDReplicationConnection::FBaseline& Baseline = Connection->Baselines[Slot];
+			float Error = NEW_ENTITY_ERROR * Tolerance;
+			if (Baseline.bValid && Baseline.Generation == Handle.Generation)
+			{
+				const FUDQuantizedEntity State = UD::QuantizeEntity(Config, Snapshot.Locations[i], Snapshot.Velocities[i], Snapshot.Rotations[i].Yaw);
+				int32 PositionError = 0;
+				for (int32 Axis = 0; Axis < 3; Axis++)
+				{
+					PositionError = FMath::Max(PositionError, FMath::Abs(State.Position[Axis] - Baseline.State.Position[Axis]));
+				}
+				const uint32 YawDifference = (State.Yaw - Baseline.State.Yaw) & YawMask;
+				const bool bYawChanged = FMath::Min(YawDifference, YawMask + 1 - YawDifference) > 1; // One step of jitter is not worth a send
+				if (PositionError < MaxPositionDelta && !bYawChanged && !Connection->ForcedSlots[Slot])
+				{
+					continue;
+				}
+				Error = FMath::Max(PositionError * Config.ReplicationPositionPrecision, bYawChanged ? Tolerance : 0.f);
+			}
+
+			const float Relevance = 1.f / (1.f + (float)FVector::Dist(ViewerLocation, Snapshot.Locations[i]) / Config.ReplicationRelevanceDistance);
+			float& Priority = Connection->Priorities[Slot];
+			Priority += (1.f + Error / Tolerance) * Relevance + (Connection->ForcedSlots[Slot] ? FORCED_PRIORITY : 0.f);
+			Candidates.Add({ i, Slot, Priority });
+		}
+
+		for (int32 Slot = 0; Slot < NumSlots; Slot++)
+		{
+			if (Connection->Baselines[Slot].bValid && !PresentSlots[Slot])
+			{
+				Candidates.Add({ INDEX_NONE, Slot, FORCED_PRIORITY });
+			}
+		}
+		Candidates.Sort([](const FCandidate& A, const FCandidate& B) { return A.Priority > B.Priority; });
+	}
+
+	FUDReplicationConnection::FPacket& Packet = Connection->InFlight[Sequence % UD_REPLICATION_IN_FLIGHT];
+	Packet.Sequence = Sequence;
+	Packet.Entities.Reset();
+
+	// Upper bound of one entity, packed ints take at most 5 bytes
+	const int32 MaxEntityBits = 40 + 2 + 40 + 3 * Config.ReplicationPositionBits + 3 * Config.ReplicationVelocityBits + Config.ReplicationYawBits;
+	const int64 BudgetBits = (int64)Config.ReplicationBytesPerPacket * 8 - 32 - 40 - 40;
+	FBitWriter EntityWriter(BudgetBits, true);
+	for (const FCandidate& Candidate : Candidates)
+	{
+		if (EntityWriter.GetNumBits() + MaxEntityBits > BudgetBits)
+		{
+			break; // The rest keeps its priority for the next packet
+		}
+
+		uint32 Slot = Candidate.Slot;
+		EntityWriter.SerializeIntPacked(Slot);
+		FUDReplicationConnection::FSentEntity& Sent = Packet.Entities.AddDefaulted_GetRef();
+		Sent.Slot = Candidate.Slot;
+		if (Candidate.Index == INDEX_NONE)
+		{
+			EntityWriter.WriteBit(1);
+			Sent.Generation = Connection->Baselines[Candidate.Slot].Generation;
+			Sent.bRemoved = true;
+			continue;
+		}
+		EntityWriter.WriteBit(0);
+
+		const int32 i = Candidate.Index;
+		const FUDReplicationConnection::FBaseline& Baseline = Connection->Baselines[Candidate.Slot];
+		Sent.Generation = Snapshot.Handles[i].Generation;
+		Sent.State = UD::QuantizeEntity(Config, Snapshot.Locations[i], Snapshot.Velocities[i], Snapshot.Rotations[i].Yaw);
+
+		// The client keeps its last UD_REPLICATION_HISTORY states, a delta is only written against one it still has
+		const uint32 Age = Sequence - Baseline.Sequence;
+		const bool bDelta = Baseline.bValid && Baseline.Generation == Sent.Generation && Age < UD_REPLICATION_HISTORY
+			&& !Connection->ForcedFullSlots[Candidate.Slot] && UD::Replication::FitsDelta(Sent.State, Baseline.State, Config.ReplicationDeltaBits);
+		EntityWriter.WriteBit(bDelta ? 1 : 0);
+		if (bDelta)
+		{
+			UD::Replication::WriteBits(EntityWriter, Age, FMath::CeilLogTwo(UD_REPLICATION_HISTORY));
+			for (int32 Axis = 0; Axis < 3; Axis++)
+			{
+				UD::Replication::WriteBits(EntityWriter, UD::Replication::EncodeSigned(Sent.State.Position[Axis] - Baseline.State.Position[Axis], Config.ReplicationDeltaBits), Config.ReplicationDeltaBits);
+			}
+		}
+		else
+		{
+			uint32 Generation = Sent.Generation;
+			EntityWriter.SerializeIntPacked(Generation);
+			for (int32 Axis = 0; Axis < 3; Axis++)
+			{
+				UD::Replication::WriteBits(EntityWriter, UD::Replication::EncodeSigned(Sent.State.Position[Axis], Config.ReplicationPositionBits), Config.ReplicationPositionBits);
+			}
+		}
+
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			UD::Replication::WriteBits(EntityWriter, UD::Replication::EncodeSigned(Sent.State.Velocity[Axis], Config.ReplicationVelocityBits), Config.ReplicationVelocityBits);
+		}
+		UD::Replication::WriteBits(EntityWriter, Sent.State.Yaw, Config.ReplicationYawBits);
+
+		Connection->Priorities[Candidate.Slot] = 0.f;
+		Connection->ForcedSlots[Candidate.Slot] = false;
+		Connection->ForcedFullSlots[Candidate.Slot] = false;
+	}
+
+	// The slot count bounds the slots the client accepts from this packet
+	FBitWriter Writer(EntityWriter.GetNumBits() + 112, true);
+	uint32 SequenceValue = Sequence;
+	uint32 NumSlotsValue = NumSlots;
+	uint32 NumEntities = Packet.Entities.Num();
+	Writer << SequenceValue;
+	Writer.SerializeIntPacked(NumSlotsValue);
+	Writer.SerializeIntPacked(NumEntities);
+	Writer.SerializeBits(EntityWriter.GetData(), EntityWriter.GetNumBits());
+	OutPacket.SetNumUninitialized(Writer.GetNumBytes());
+	FMemory::Memcpy(OutPacket.GetData(), Writer.GetData(), Writer.GetNumBytes());
+	return Sequence;
+}
+
+void FUDReplicationServer::ReceiveAck(const int32& ConnectionId, const uint32& Sequence)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimReplication_ReceiveAck");
+	FUDReplicationConnection* Connection = FindConnection(ConnectionId);
+	if (!Connection)
+	{
+		return;
+	}
+
+	FUDReplicationConnection::FPacket& Packet = Connection->InFlight[Sequence % UD_REPLICATION_IN_FLIGHT];
+	if (Packet.Sequence != Sequence)
+	{
+		return; // Too old or acked twice
+	}
+
+	for (const FUDReplicationConnection::FSentEntity& Sent : Packet.Entities)
+	{
+		FUDReplicationConnection::FBaseline& Baseline = Connection->Baselines[Sent.Slot];
+		if (Baseline.Sequence > Sequence)
+		{
+			continue; // A later packet was already acked
+		}
+
+		Baseline.bValid = !Sent.bRemoved;
+		Baseline.Generation = Sent.Generation;
+		Baseline.Sequence = Sequence;
+		Baseline.State = Sent.State;
+	}
+	Packet.Sequence = 0;
+	Packet.Entities.Reset();
+}
+
+void FUDReplicationServer::ForceEntity(const int32& Slot, const bool& bSkipSource)
+{
+	for (FUDReplicationConnection& Connection : Connections)
+	{
+		Grow(Connection, Slot + 1);
+		Connection.ForcedSlots[Slot] = true;
+		Connection.ForcedFullSlots[Slot] = Connection.ForcedFullSlots[Slot] || bSkipSource;
+	}
+}
+
+FUDReplicationConnection* FUDReplicationServer::FindConnection(const int32& ConnectionId)
+{
+	return Connections.IsValidIndex(ConnectionId) ? &Connections[ConnectionId] : nullptr;
+}
+
+void FUDReplicationServer::Grow(FUDReplicationConnection& Connection, const int32& NumSlots)
+{
+	if (Connection.Baselines.Num() >= NumSlots)
+	{
+		return;
+	}
+
+	const int32 NumAdded = NumSlots - Connection.Baselines.Num();
+	Connection.Baselines.AddDefaulted(NumAdded);
+	Connection.Priorities.AddZeroed(NumAdded);
+	Connection.ForcedSlots.Add(false, NumAdded);
+	Connection.ForcedFullSlots.Add(false, NumAdded);
+}
+
+void FUDReplicationClient::Initialize(const FUDSimulationConfig& InConfig)
+{
+	Config = InConfig;
+}
+
+bool FUDReplicationClient::ReadPacket(const TArray<uint8>& Packet, uint32& OutSequence)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimReplication_ReadPacket");
+	FBitReader Reader(const_cast<uint8*>(Packet.GetData()), (int64)Packet.Num() * 8);
+	uint32 Sequence = 0;
+	uint32 NumSlots = 0;
+	uint32 NumEntities = 0;
+	Reader << Sequence;
+	Reader.SerializeIntPacked(NumSlots);
+	Reader.SerializeIntPacked(NumEntities);
+
+	// An entity takes at least a packed slot byte and a bit, a larger count cannot be in the packet
+	if (Reader.IsError() || Sequence <= LatestSequence || NumSlots > UD_REPLICATION_MAX_SLOTS || NumEntities > (uint32)(Reader.GetBitsLeft() / 9))
+	{
+		return false;
+	}
+
+	// Everything is decoded before anything is written, a truncated or malformed packet leaves the client as it was
+	Decoded.Reset(NumEntities);
+	for (uint32 n = 0; n < NumEntities; n++)
+	{
+		uint32 Slot = 0;
+		Reader.SerializeIntPacked(Slot);
+		if (Reader.IsError() || Slot >= NumSlots)
+		{
+			return false;
+		}
+
+		FDecoded& Entity = Decoded.AddDefaulted_GetRef();
+		Entity.Slot = (int32)Slot;
+		if (Reader.ReadBit())
+		{
+			Entity.bRemoved = true;
+			continue;
+		}
+
+		FUDQuantizedEntity& State = Entity.State;
+		if (Reader.ReadBit())
+		{
+			const uint32 Age = UD::Replication::ReadBits(Reader, FMath::CeilLogTwo(UD_REPLICATION_HISTORY));
+			const FReceived* Baseline = Age > 0 ? FindBaseline(Entity.Slot, Sequence - Age) : nullptr;
+			if (!Baseline)
+			{
+				return false; // The server deltas against a state this client never received
+			}
+			for (int32 Axis = 0; Axis < 3; Axis++)
+			{
+				State.Position[Axis] = Baseline->State.Position[Axis] + UD::Replication::DecodeSigned(UD::Replication::ReadBits(Reader, Config.ReplicationDeltaBits), Config.ReplicationDeltaBits);
+			}
+		}
+		else
+		{
+			Entity.bFull = true;
+			Reader.SerializeIntPacked(Entity.Generation);
+			for (int32 Axis = 0; Axis < 3; Axis++)
+			{
+				State.Position[Axis] = UD::Replication::DecodeSigned(UD::Replication::ReadBits(Reader, Config.ReplicationPositionBits), Config.ReplicationPositionBits);
+			}
+		}
+
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			State.Velocity[Axis] = UD::Replication::DecodeSigned(UD::Replication::ReadBits(Reader, Config.ReplicationVelocityBits), Config.ReplicationVelocityBits);
+		}
+		State.Yaw = UD::Replication::ReadBits(Reader, Config.ReplicationYawBits);
+	}
+
+	if (Reader.IsError())
+	{
+		return false;
+	}
+
+	UpdatedSlots.Reset(Decoded.Num());
+	for (const FDecoded& Entity : Decoded)
+	{
+		const int32 Slot = Entity.Slot;
+		Grow(Slot);
+		UpdatedSlots.Add(Slot);
+		if (Entity.bRemoved)
+		{
+			bPresent[Slot] = false;
+			continue;
+		}
+
+		if (Entity.bFull)
+		{
+			Generations[Slot] = Entity.Generation;
+		}
+		FReceived& Received = History[Slot * UD_REPLICATION_HISTORY + Sequence % UD_REPLICATION_HISTORY];
+		Received.State = Entity.State;
+		Received.Sequence = Sequence;
+		UD::DequantizeEntity(Config, Entity.State, Locations[Slot], Velocities[Slot], Yaws[Slot]);
+		bPresent[Slot] = true;
+	}
+
+	LatestSequence = Sequence;
+	OutSequence = Sequence;
+	return true;
+}
+
+const FUDReplicationClient::FReceived* FUDReplicationClient::FindBaseline(const int32& Slot, const uint32& Sequence) const
+{
+	if (Sequence == 0 || Locations.Num() <= Slot)
+	{
+		return nullptr; // The server numbers its packets from 1, a zero entry was never received
+	}
+	const FReceived& Received = History[Slot * UD_REPLICATION_HISTORY + Sequence % UD_REPLICATION_HISTORY];
+	return Received.Sequence == Sequence ? &Received : nullptr;
+}
+
+void FUDReplicationClient::Grow(const int32& Slot)
+{
+	if (Locations.Num() > Slot)
+	{
+		return;
+	}
+
+	const int32 NumAdded = Slot + 1 - Locations.Num();
+	Generations.AddZeroed(NumAdded);
+	Locations.AddZeroed(NumAdded);
+	Velocities.AddZeroed(NumAdded);
+	Yaws.AddZeroed(NumAdded);
+	bPresent.Add(false, NumAdded);
+	History.AddDefaulted(NumAdded * UD_REPLICATION_HISTORY);
+}
@@ -0,0 +1,159 @@
+// Copyright - Jed
+
+
+#include "Systems/UDScheduler.h"
+#include "Systems/UDHeapCounter.h"
+#include "Misc/ScopeLock.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "Tasks/Task.h"
+
+bool FUDScheduler::AddSystem(const FUDSystem& System, const FName& Before)
+{
+	FScopeLock ScopeLock(&Mutex);
+	if (System.Name.IsNone() || !System.Execute || FindSystem(System.Name) != INDEX_NONE)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("FUDScheduler::AddSystem - Cannot add the system %s, it needs a unique name and a function."), *System.Name.ToString());
+		return false;
+	}
+
+	const int32 BeforeIndex = Before.IsNone() ? INDEX_NONE : FindSystem(Before);
+	ensureMsgf(Before.IsNone() || BeforeIndex != INDEX_NONE, TEXT("FUDScheduler::AddSystem - %s is not registered, %s is appended instead."), *Before.ToString(), *System.Name.ToString());
+	Systems.Insert(System, BeforeIndex == INDEX_NONE ? Systems.Num() : BeforeIndex);
+	bGraphDirty = true;
+	return true;
+}
+
+bool FUDScheduler::RemoveSystem(const FName& Name)
+{
+	FScopeLock ScopeLock(&Mutex);
+	const int32 Index = FindSystem(Name);
+	if (Index == INDEX_NONE)
+	{
+		return false;
+	}
+	Systems.RemoveAt(Index);
+	bGraphDirty = true;
+	return true;
+}
+
+bool FUDScheduler::SetSystemEnabled(const FName& Name, const bool& bEnabled)
+{
+	FScopeLock ScopeLock(&Mutex);
+	const int32 Index = FindSystem(Name);
+	if (Index == INDEX_NONE)
+	{
+		return false;
+	}
+	bGraphDirty |= Systems[Index].bEnabled != bEnabled;
+	Systems[Index].bEnabled = bEnabled;
+	return true;
+}
+
+int32 FUDScheduler::Num() const
+{
+	FScopeLock ScopeLock(&Mutex);
+	return Systems.Num();
+}
+
+void FUDScheduler::Run(FUDSimulationState& State, const float& Delta, const bool& bParallel)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Scheduler_Run");
+	FScopeLock ScopeLock(&Mutex);
+	if (bGraphDirty)
+	{
+		BuildGraph();
+	}
+
+	if (bParallel)
+	{
+		// Launched in registration order, so the prerequisites of a system always exist when it is launched
+		FUDHeapCounter* HeapCounter = FUDHeapCounter::GetCurrent();
+		FUDHeapCounter::FScope TaskSystemScope(nullptr); // Launching and waiting allocate in the task system, the systems themselves are counted
+		TArray<UE::Tasks::FTask, TInlineAllocator<16>> Tasks = {};
+		TArray<UE::Tasks::FTask, TInlineAllocator<16>> Prerequisites = {};
+		Tasks.SetNum(Systems.Num());
+		for (int32 SystemIndex = 0; SystemIndex < Systems.Num(); SystemIndex++)
+		{
+			if (!Systems[SystemIndex].bEnabled)
+			{
+				continue;
+			}
+
+			Prerequisites.Reset();
+			for (const int32& Dependency : Dependencies[SystemIndex])
+			{
+				Prerequisites.Add(Tasks[Dependency]);
+			}
+			Tasks[SystemIndex] = UE::Tasks::Launch(TEXT("UDSystem"), [this, SystemIndex, &State, Delta, HeapCounter]()
+			{
+				TRACE_CPUPROFILER_EVENT_SCOPE_STR("Scheduler_System");
+				FUDHeapCounter::FScope HeapScope(HeapCounter);
+				Systems[SystemIndex].Execute(State, Delta);
+			}, Prerequisites);
+		}
+		UE::Tasks::Wait(Tasks);
+	}
+	else
+	{
+		for (int32 SystemIndex = 0; SystemIndex < Systems.Num(); SystemIndex++)
+		{
+			if (Systems[SystemIndex].bEnabled)
+			{
+				TRACE_CPUPROFILER_EVENT_SCOPE_STR("Scheduler_System");
+				Systems[SystemIndex].Execute(State, Delta);
+			}
+		}
+	}
+}
+
+FString FUDScheduler::DescribeGraph() const
+{
+	FScopeLock ScopeLock(&Mutex);
+	FString Description = {};
+	for (int32 SystemIndex = 0; SystemIndex < Systems.Num(); SystemIndex++)
+	{
+		Description += Systems[SystemIndex].Name.ToString();
+		Description += Systems[SystemIndex].bEnabled ? TEXT(" <-") : TEXT(" (disabled)");
+		if (!bGraphDirty && Systems[SystemIndex].bEnabled)
+		{
+			for (const int32& Dependency : Dependencies[SystemIndex])
+			{
+				Description += TEXT(" ") + Systems[Dependency].Name.ToString();
+			}
+		}
+		Description += TEXT("\n");
+	}
+	return Description;
+}
+
+int32 FUDScheduler::FindSystem(const FName& Name) const
+{
+	return Systems.IndexOfByPredicate([&Name](const FUDSystem& System) { return System.Name == Name; });
+}
+
+void FUDScheduler::BuildGraph()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Scheduler_BuildGraph");
+	Dependencies.SetNum(Systems.Num());
+	for (int32 SystemIndex = 0; SystemIndex < Systems.Num(); SystemIndex++)
+	{
+		const FUDSystem& System = Systems[SystemIndex];
+		TArray<int32>& SystemDependencies = Dependencies[SystemIndex];
+		SystemDependencies.Reset();
+		if (!System.bEnabled)
+		{
+			continue;
+		}
+
+		// Reads may overlap, anything else against a write has to keep the registration order
+		for (int32 Earlier = 0; Earlier < SystemIndex; Earlier++)
+		{
+			const FUDSystem& Other = Systems[Earlier];
+			if (Other.bEnabled && (EnumHasAnyFlags(Other.Writes, System.Reads | System.Writes) || EnumHasAnyFlags(System.Writes, Other.Reads)))
+			{
+				SystemDependencies.Add(Earlier);
+			}
+		}
+	}
+	bGraphDirty = false;
+}
@@ -2,90 +2,79 @@
 
 
 #include "Systems/UDSimulation.h"
+#include "Systems/UDGroundField.h"
+#include "Systems/UDQuery.h"
+#include "Core/UDCoreHash.h"
 #include "Kismet/GameplayStatics.h"
 #include "HAL/PlatformProcess.h"
 #include "ProfilingDebugging/CpuProfilerTrace.h"
 #include "DrawDebugHelpers.h"
+#include "Async/ParallelFor.h"
+#include "Algo/BinarySearch.h"
+#include "Algo/StableSort.h"
+#include "Components/SceneComponent.h"
+#include "Misc/ScopeLock.h"
+#include "Engine/World.h"
 
 #define MAX_QUEUE_SIZE 5000
-#define MAX_MOVEMENT_QUEUE_SIZE 3
 #define MAX_COMMANDS_PER_FRAME 5
+#define MAX_SWEEP_ITERATIONS 3 // First move plus two slides
+
+FUDSimulationQueue UD::GeneralQueue(MAX_QUEUE_SIZE);
 
 void FUDSimulationQueue::ExecuteCommands()
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimQueue_ExecuteCommands");
-	if (DoneExecuting())
-	{
-		return;
-	}
 
-	uint16 CurrentCommandIndex = 0;
-
-	while (CurrentCommandIndex < Commands.Num() && CurrentCommandIndex < MAX_COMMANDS_PER_FRAME)
+	const int64 FrameCount = UKismetSystemLibrary::GetFrameCount();
+	for (uint16 NumExecuted = 0; NumExecuted < MAX_COMMANDS_PER_FRAME; NumExecuted++)
 	{
-		const bool bIsExecutionFrame = UKismetSystemLibrary::GetFrameCount() - Commands[CurrentCommandIndex].EnqueuedFrame >= Commands[CurrentCommandIndex].FrameDelay;
-		if (Commands[CurrentCommandIndex].Lambda && bIsExecutionFrame)
+		FUDSimulationCommand* Command = Commands.Peek();
+		if (!Command || FrameCount - Command->EnqueuedFrame < Command->FrameDelay)
 		{
-			Commands[CurrentCommandIndex].Lambda();
+			break; // Delayed commands keep their order, the ones behind wait for them
 		}
-		CurrentCommandIndex++;
-	}	
-
-	SleepUntilUnlocked();
-	Commands.RemoveAt(0, CurrentCommandIndex, true);
-
-	FinishExecution();
+		if (Command->Lambda)
+		{
+			Command->Lambda();
+		}
+		Commands.Pop();
+	}
 }
 
-void FUDSimulationQueue::Enqueue(const FUDSimulationCommand& Command)
+bool FUDSimulationQueue::Enqueue(FUDSimulationCommand&& Command)
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimQueue_EnqueueCommand");
-	if (Commands.Num() < MAX_QUEUE_SIZE)
-	{
-		SleepUntilUnlocked();
-		Lock();
-		Commands.Insert(Command, Commands.Num());
-		if (Commands.Num() > MaxSize)
-		{
-			Commands.RemoveAt(MaxSize, Commands.Num() - MaxSize, true);
-		}
-		Unlock();
-	}
-	else
+	FScopeLock ProducersLock(&ProducersMutex);
+	if (!Commands.Push(MoveTemp(Command)))
 	{
-		UE_LOG(LogTemp, Warning, TEXT("FUDSimulationQueue::Enqueue - Reached max queue size"));
+		NumOverflows.fetch_add(1, std::memory_order_relaxed);
+		return false;
 	}
+	NumEnqueued.fetch_add(1, std::memory_order_relaxed);
+	return true;
 }
 
 void FUDSimulationQueue::Clear()
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimQueue_Clear");
-	SleepUntilUnlocked();
-	Lock();
-	Commands.Empty();
-	Unlock();
-}
-
-void FUDSimulationQueue::SleepUntilUnlocked()
-{
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimQueue_SleepUntilUnlocked");
-	FPlatformProcess::ConditionalSleep([&]() {return !bLocked; }, .001f);
+	check(IsInGameThread());
+	while (Commands.Peek())
+	{
+		Commands.Pop();
+	}
 }
 
-int32 FUDSimulationState::RegisterActor(AActor* Actor)
+FUDEntityHandle FUDSimulationState::RegisterActor(AActor* Actor, const EUDArchetype& Archetype)
 {
 	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_RegisterActor");
 	check(Actor);
 	
-	WaitUntilUnlocked();
-	bLocked = true;
+	FScopeLock ScopeLock(&Mutex);
 
-	FUDActor ActorObj = {};
-	ActorObj.Ptr = Actor;
-	const int32 AddedIndex = Actors.AddUnique(ActorObj);
-	if (!Actors.IsValidIndex(AddedIndex))
+	if (const FUDEntityHandle* ExistingHandle = ActorHandles.Find(Actor))
 	{
-		return -1;
+		return *ExistingHandle;
 	}
 
 	if (!Actor->ActorHasTag(UD_DOD_TAG))
@@ -93,389 +82,2248 @@ int32 FUDSimulationState::RegisterActor(AActor* Actor)
 		Actor->Tags.Add(UD_DOD_TAG);
 	}
 
-	FUDLocation Location = {};
-	Location.Value = Actor->GetActorLocation();
-	const int32 PosIndex = Locations.Add(Location);
-	ensureMsgf(PosIndex == AddedIndex, TEXT("FUDSimulationState::RegisterActor - Cannot add position properly because the indices seem to unmatch with the actor pointer."));
-
-	FUDRotation Rotation = {};
-	Rotation.Value = Actor->GetActorRotation();
-	const int32 RotIndex = Rotations.Add(Rotation);
-	ensureMsgf(RotIndex == AddedIndex, TEXT("FUDSimulationState::RegisterActor - Cannot add rotation properly because the indices seem to unmatch with the actor pointer."));
-
-	FUDMovement Movement = {};
-	const int32 MovIndex = Movements.Add(Movement);
-	Movement.Acceleration = FMath::FRandRange(1024., 1612.);
-	ensureMsgf(MovIndex == AddedIndex, TEXT("FUDSimulationState::RegisterActor - Cannot add Movement properly because the indices seem to unmatch with the actor pointer."));
-
-	FUDMovementInput Input = {};
-	Input.Movement = FVector(1.f, 0.f, 0.f);
-	const int32 InpIndex = Inputs.Add(Input);
-	ensureMsgf(InpIndex == AddedIndex, TEXT("FUDSimulationState::RegisterActor - Cannot add Input properly because the indices seem to unmatch with the actor pointer."));
-
-	FUDCollision Collision = {};
-	const int32 CollIndex = Collisions.Add(Collision);
-	ensureMsgf(CollIndex == AddedIndex, TEXT("FUDSimulationState::RegisterActor - Cannot add Collision properly because the indices seem to unmatch with the actor pointer."));
-
-	FUDSimulationQueue MovementQueue = {};
-	MovementQueue.MaxSize = MAX_MOVEMENT_QUEUE_SIZE;
-	const int32	MovQueueIndex = MovementQueues.Add(MovementQueue);
-	ensureMsgf(MovQueueIndex == AddedIndex, TEXT("FUDSimulationState::RegisterActor - Cannot add MovementQueue properly because the indices seem to unmatch with the actor pointer."));
-
-	bLocked = false;
-	return AddedIndex;
+	const FUDEntityHandle Handle = AddEntity(Actor, Actor->GetActorLocation(), Actor->GetActorRotation(), Archetype);
+	ActorHandles.Add(Actor, Handle);
+	return Handle;
 }
 
-void FUDSimulationState::UnregisterActor(const int32& Index)
+FUDEntityHandle FUDSimulationState::RegisterEntity(const FTransform& Transform, const EUDArchetype& Archetype)
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UnregisterActor");
-	WaitUntilUnlocked();
-	bLocked = true;
-	Actors.RemoveAt(Index, 1, true);
-	Locations.RemoveAt(Index, 1, true);
-	Rotations.RemoveAt(Index, 1, true);
-	Movements.RemoveAt(Index, 1, true);
-	Inputs.RemoveAt(Index, 1, true);
-	Collisions.RemoveAt(Index, 1, true);
-	bLocked = false;
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_RegisterEntity");
+	FScopeLock ScopeLock(&Mutex);
+	return AddEntity(nullptr, Transform.GetLocation(), Transform.Rotator(), Archetype);
 }
 
-FUDSimulationQueue& FUDSimulationState::GetActorMovementQueue(const int32& Index)
+FUDEntityHandle FUDSimulationState::RegisterEntity(const FUDEntityDesc& Entity)
 {
-	check(MovementQueues.IsValidIndex(Index));
-	return MovementQueues[Index];
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_RegisterEntity");
+	FScopeLock ScopeLock(&Mutex);
+
+	// A reserved handle was deduplicated by whoever reserved it, the actor may still map to an entity queued for removal
+	if (const FUDEntityHandle* ExistingHandle = Entity.Actor && !Entity.Handle.IsSet() ? ActorHandles.Find(Entity.Actor) : nullptr)
+	{
+		return *ExistingHandle;
+	}
+
+	const FUDEntityHandle Handle = AddEntity(Entity.Actor, Entity.Transform.GetLocation(), Entity.Transform.Rotator(), Entity.Archetype, Entity.Handle);
+	if (Entity.Actor)
+	{
+		ActorHandles.Add(Entity.Actor, Handle);
+	}
+	return Handle;
 }
 
-TArray<int32> FUDSimulationState::UpdateLocations(const float& Delta)
+bool FUDSimulationState::BindActor(const FUDEntityHandle& Handle, AActor* Actor)
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateLocations");
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_BindActor");
+	check(Actor);
+	FScopeLock ScopeLock(&Mutex);
+
+	const int32 Index = GetDenseIndex(Handle);
+	if (Index == INDEX_NONE || Actors[Index] || ActorHandles.Contains(Actor))
+	{
+		return false;
+	}
 
-	TArray<int32> ActorsToUpdate = {}; // This allows us to avoid updating actors that do not change
+	Actors[Index].Ptr = Actor;
+	ActorHandles.Add(Actor, Handle);
+	return true;
+}
 
-	for (int32 i = 0; i < Actors.Num(); i++)
+FUDEntityHandle FUDSimulationState::AddEntity(AActor* Actor, const FVector& InLocation, const FRotator& InRotation, const EUDArchetype& Archetype, const FUDEntityHandle& Reserved)
+{
+	check(Archetype != EUDArchetype::Num);
+	const int32 ArchetypeIndex = (int32)Archetype;
+	const bool bMoving = Archetype != EUDArchetype::Static;
+
+	// Every array grows at its end, then the first entity of every later archetype moves to the end of its range until the hole reaches ours
+	Actors.AddDefaulted();
+	Locations.AddDefaulted();
+	Rotations.AddDefaulted();
+	LODs.Add(EUDSimulationLOD::Full); // Until the next re-bucketing reaches it
+	Awake.Add(false);
+	StillSteps.Add(0);
+	DenseToSparse.Add(INDEX_NONE);
+	if (bMoving)
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateLocation_Single" + i);
-		if (!Locations.IsValidIndex(i) || !Movements.IsValidIndex(i) || !Inputs.IsValidIndex(i))
+		Movements.AddDefaulted();
+		Inputs.AddDefaulted();
+		if (UsesStreams())
 		{
-			break;
+			Streams.Add(FUDLocation(), FUDMovement(), FUDMovementInput());
 		}
-		FUDLocation& Location = Locations[i];
-		FUDMovement& Movement = Movements[i];
-		FUDMovementInput& Input = Inputs[i];
-		const FVector CachedLocation = Location.Value;
-		FVector Acceleration = FVector(0.f, 0.f, -Movement.Gravity);
-
-		Acceleration += Input.Movement * Movement.Acceleration;
+	}
+	if (Archetype == EUDArchetype::Agent)
+	{
+		Collisions.AddDefaulted();
+	}
 
-		if (Movement.Deceleration > 0.0f)
+	int32 Index = Actors.Num() - 1;
+	for (int32 Later = (int32)EUDArchetype::Num - 1; Later > ArchetypeIndex; Later--)
+	{
+		const int32 Begin = GetArchetypeBegin((EUDArchetype)Later);
+		if (Begin < ArchetypeEnds[Later])
 		{
-			const FVector OppositeVelocity = -Location.Velocity;
-			FVector DecelerationForce = OppositeVelocity.GetSafeNormal() * Movement.Deceleration;
-			Acceleration += FMath::Min(Location.Velocity.Size(), DecelerationForce.Size()) * DecelerationForce;
+			MoveEntity(Begin, Index);
 		}
+		Index = Begin;
+		ArchetypeEnds[Later]++;
+	}
+	ArchetypeEnds[ArchetypeIndex]++;
+	bActiveDirty = true;
 
-		Location.Velocity += Acceleration * Delta;
-		Location.Velocity = Location.Velocity.GetClampedToMaxSize(Movement.MaxSpeed);
+	InitializeEntity(Index, Actor, InLocation, InRotation, Archetype);
+	return AssignHandle(Reserved, Index);
+}
 
-		if (Movement.bEnableCollision)
+void FUDSimulationState::RegisterEntities(const TArray<FUDEntityDesc>& Entities, TArray<FUDEntityHandle>& OutHandles)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_RegisterEntities");
+	FScopeLock ScopeLock(&Mutex);
+
+	// Actors already registered, or listed twice, keep a single entity
+	OutHandles.Reset(Entities.Num());
+	OutHandles.AddDefaulted(Entities.Num());
+	TArray<bool> IsNew = {};
+	IsNew.Init(false, Entities.Num());
+	TSet<AActor*> BatchActors = {};
+	BatchActors.Reserve(Entities.Num());
+	int32 NumAdded[(int32)EUDArchetype::Num] = {};
+	for (int32 n = 0; n < Entities.Num(); n++)
+	{
+		const FUDEntityDesc& Entity = Entities[n];
+		check(Entity.Archetype != EUDArchetype::Num);
+		if (Entity.Actor)
 		{
-			FUDActor& Actor = Actors[i];
-			FUDCollision& Collision = Collisions[i];
-			check(Actor.Get());
-
-			UWorld* World = Actor->GetWorld();
-			FVector NewLocation = CachedLocation + (Location.Velocity * Delta);
-			FVector CollidedLocation = FVector::ZeroVector;
-			FVector CollisionPos = FVector::ZeroVector;
-
-			if (CheckCollision(CollidedLocation, Actor.Get(), Collision, CachedLocation, NewLocation))
+			bool bAlreadyInBatch = false;
+			BatchActors.Add(Entity.Actor, &bAlreadyInBatch);
+			if (bAlreadyInBatch || (!Entity.Handle.IsSet() && ActorHandles.Contains(Entity.Actor))) // Same as RegisterEntity
 			{
-				// TODO : move collided point to half the size of the object and move it there
+				continue;
 			}
 		}
-		else
+		IsNew[n] = true;
+		NumAdded[(int32)Entity.Archetype]++;
+	}
+
+	int32 TotalAdded = 0;
+	int32 OldBegins[(int32)EUDArchetype::Num] = {};
+	int32 OldEnds[(int32)EUDArchetype::Num] = {};
+	for (int32 Archetype = 0; Archetype < (int32)EUDArchetype::Num; Archetype++)
+	{
+		OldBegins[Archetype] = GetArchetypeBegin((EUDArchetype)Archetype);
+		OldEnds[Archetype] = ArchetypeEnds[Archetype];
+		TotalAdded += NumAdded[Archetype];
+	}
+	const int32 NumAddedMoving = NumAdded[(int32)EUDArchetype::Agent] + NumAdded[(int32)EUDArchetype::Mover];
+
+	// Every array grows once
+	const int32 NewNum = Num() + TotalAdded;
+	Actors.SetNum(NewNum);
+	Locations.SetNum(NewNum);
+	Rotations.SetNum(NewNum);
+	LODs.SetNum(NewNum);
+	Awake.Add(false, TotalAdded);
+	StillSteps.SetNumZeroed(NewNum);
+	DenseToSparse.SetNum(NewNum);
+	Movements.SetNum(NumMoving() + NumAddedMoving);
+	Inputs.SetNum(NumMoving() + NumAddedMoving);
+	Collisions.SetNum(GetArchetypeEnd(EUDArchetype::Agent) + NumAdded[(int32)EUDArchetype::Agent]);
+	if (UsesStreams())
+	{
+		Streams.AddZeroed(NumAddedMoving);
+	}
+	SparseToDense.Reserve(SparseToDense.Num() + TotalAdded);
+	Generations.Reserve(Generations.Num() + TotalAdded);
+	ActorHandles.Reserve(ActorHandles.Num() + TotalAdded);
+
+	// Every later range shifts by the entities added in front of it, only the entities that end up outside the shifted range move.
+	// The last range moves first into the grown tail, so every destination is free by the time it is written.
+	int32 Shifts[(int32)EUDArchetype::Num] = {};
+	for (int32 Archetype = 1; Archetype < (int32)EUDArchetype::Num; Archetype++)
+	{
+		Shifts[Archetype] = Shifts[Archetype - 1] + NumAdded[Archetype - 1];
+	}
+	for (int32 Archetype = (int32)EUDArchetype::Num - 1; Archetype > 0; Archetype--)
+	{
+		const int32 Shift = Shifts[Archetype];
+		const int32 NumToMove = FMath::Min(Shift, OldEnds[Archetype] - OldBegins[Archetype]);
+		for (int32 k = 0; k < NumToMove; k++)
 		{
-			Location.Value = Location.Velocity * Delta;
-			// Ensure the character doesn't move below a certain height
-			//Location.Value.Z = FMath::Max(Location.Value.Z, Collision.Height);
+			MoveEntity(OldBegins[Archetype] + k, OldEnds[Archetype] + Shift - NumToMove + k);
 		}
+	}
 
-		if (CachedLocation != Location.Value)
+	// New entities fill each range after its existing ones, in the order they were listed so deterministic peers spawn the same way
+	int32 NextIndices[(int32)EUDArchetype::Num] = {};
+	for (int32 Archetype = 0; Archetype < (int32)EUDArchetype::Num; Archetype++)
+	{
+		NextIndices[Archetype] = OldEnds[Archetype] + Shifts[Archetype];
+		ArchetypeEnds[Archetype] = NextIndices[Archetype] + NumAdded[Archetype];
+	}
+	bActiveDirty = true;
+
+	for (int32 n = 0; n < Entities.Num(); n++)
+	{
+		const FUDEntityDesc& Entity = Entities[n];
+		if (!IsNew[n])
 		{
-			ActorsToUpdate.Add(i);
+			OutHandles[n] = ActorHandles.FindChecked(Entity.Actor); // Earlier in the batch or already registered
+			continue;
 		}
-	}
 
-	return ActorsToUpdate;
+		const int32 Index = NextIndices[(int32)Entity.Archetype]++;
+		InitializeEntity(Index, Entity.Actor, Entity.Transform.GetLocation(), Entity.Transform.Rotator(), Entity.Archetype);
+		OutHandles[n] = AssignHandle(Entity.Handle, Index);
+		if (Entity.Actor)
+		{
+			ActorHandles.Add(Entity.Actor, OutHandles[n]);
+		}
+	}
 }
 
-TArray<int32> FUDSimulationState::UpdateRotations(const float& Delta)
+void FUDSimulationState::InitializeEntity(const int32& Index, AActor* Actor, const FVector& InLocation, const FRotator& InRotation, const EUDArchetype& Archetype)
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateRotations");
-	TArray<int32> ActorsToUpdate = {}; // This allows us to avoid updating actors that do not change
-
-	for (int32 i = 0; i < Actors.Num(); i++)
+	const bool bMoving = Archetype != EUDArchetype::Static;
+	Actors[Index].Ptr = Actor;
+	Locations[Index] = FUDLocation();
+	Locations[Index].Value = InLocation;
+	Rotations[Index] = FUDRotation();
+	Rotations[Index].Value = InRotation;
+	LODs[Index] = EUDSimulationLOD::Full;
+	Awake[Index] = bMoving;
+	StillSteps[Index] = 0;
+	DenseToSparse[Index] = INDEX_NONE; // The moves left the slot of the last entity moved here
+
+	if (bMoving)
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateRotation_Single");
-		if (!Rotations.IsValidIndex(i) || !Inputs.IsValidIndex(i))
-		{
-			break;
-		}
-		FUDRotation& Rotation = Rotations[i];
-		FUDMovementInput& Input = Inputs[i];
-		FRotator CachedRotation = Rotation.Value;
+		FUDMovement Movement = {};
+		Movement.Acceleration = Config.bDeterministic ? UD::MakeEntityRandom(Config, NumSpawned).FRandRange(1024., 1612.) : FMath::FRandRange(1024., 1612.);
+		Movements[Index] = Movement;
 
-		Rotation.Value.Yaw += Input.Rotation.Y * Rotation.RotationSpeed;
+		FUDMovementInput Input = {};
+		Input.Movement = FVector(1.f, 0.f, 0.f);
+		Inputs[Index] = Input;
 
-		if (CachedRotation != Rotation.Value)
+		if (UsesStreams())
 		{
-			ActorsToUpdate.Add(i);
+			Streams.Set(Index, Locations[Index], Movement, Input);
+			bStreamsMoved = true;
 		}
 	}
+	NumSpawned++;
+
+	if (Archetype == EUDArchetype::Agent)
+	{
+		Collisions[Index] = FUDCollision();
+	}
+}
+
+void FUDSimulationState::UnregisterActor(const FUDEntityHandle& Handle)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UnregisterActor");
+	FScopeLock ScopeLock(&Mutex);
+
+	const int32 Index = GetDenseIndex(Handle);
+	if (Index == INDEX_NONE)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("FUDSimulationState::UnregisterActor - Stale or invalid handle (%d, generation %u)"), Handle.Index, Handle.Generation);
+		return;
+	}
+
+	const FUDEntityHandle* ActorHandle = Actors[Index] ? ActorHandles.Find(Actors[Index].Ptr) : nullptr;
+	if (ActorHandle && *ActorHandle == Handle) // The actor may already be registered again under a reserved handle
+	{
+		ActorHandles.Remove(Actors[Index].Ptr);
+	}
+	RemoveAtSwap(Index);
 
-	return ActorsToUpdate;
+	SparseToDense[Handle.Index] = INDEX_NONE;
+	Generations[Handle.Index]++;
+	HandleAllocator.Release(Handle);
 }
 
-void FUDSimulationState::UpdateActorLocation(const int32& Index, const float& Delta)
+int32 FUDSimulationState::GetDenseIndex(const FUDEntityHandle& Handle) const
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateLocation");
-	check(Actors.IsValidIndex(Index) && Actors[Index]);
-	Actors[Index]->SetActorLocation(Locations[Index].Value, true);
+	if (!SparseToDense.IsValidIndex(Handle.Index) || Generations[Handle.Index] != Handle.Generation)
+	{
+		return INDEX_NONE;
+	}
+	return SparseToDense[Handle.Index];
 }
 
-void FUDSimulationState::UpdateActorRotation(const int32& Index, const float& Delta)
+FUDEntityHandle FUDSimulationState::GetHandle(const int32& Index) const
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateRotation");
-	check(Actors.IsValidIndex(Index) && Actors[Index]);
-	Actors[Index]->SetActorRotation(Rotations[Index].Value);
+	check(DenseToSparse.IsValidIndex(Index));
+	FUDEntityHandle Handle = {};
+	Handle.Index = DenseToSparse[Index];
+	Handle.Generation = Generations[Handle.Index];
+	return Handle;
 }
 
-void FUDSimulationState::UpdateActorsLocations(const TArray<int32>& Indices, const float& Delta)
+FUDEntityHandle FUDSimulationState::AssignHandle(const FUDEntityHandle& Reserved, const int32& Index)
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateActorsLocations");
-	for (const int32& Index : Indices)
+	const FUDEntityHandle Handle = Reserved.IsSet() ? Reserved : HandleAllocator.Allocate();
+	while (SparseToDense.Num() <= Handle.Index) // Reserved slots can be registered out of order
 	{
-		UpdateActorLocation(Index, Delta);
+		SparseToDense.Add(INDEX_NONE);
+		Generations.Add(0);
 	}
+
+	ensureMsgf(SparseToDense[Handle.Index] == INDEX_NONE, TEXT("FUDSimulationState::AssignHandle - The slot %d is already owned by the dense index %d."), Handle.Index, SparseToDense[Handle.Index]);
+	ensureMsgf(DenseToSparse[Index] == INDEX_NONE, TEXT("FUDSimulationState::AssignHandle - The dense index %d is already owned by the slot %d."), Index, DenseToSparse[Index]);
+	SparseToDense[Handle.Index] = Index;
+	Generations[Handle.Index] = Handle.Generation;
+	DenseToSparse[Index] = Handle.Index;
+	return Handle;
+}
+
+FUDEntityHandle FUDHandleAllocator::Allocate()
+{
+	FScopeLock ScopeLock(&Mutex);
+	FUDEntityHandle Handle = {};
+	Handle.Index = FreeSlots.Num() > 0 ? FreeSlots.Pop(false) : Generations.Add(0);
+	Handle.Generation = Generations[Handle.Index];
+	return Handle;
+}
+
+void FUDHandleAllocator::Release(const FUDEntityHandle& Handle)
+{
+	FScopeLock ScopeLock(&Mutex);
+	check(Generations.IsValidIndex(Handle.Index) && Generations[Handle.Index] == Handle.Generation);
+	Generations[Handle.Index]++;
+	FreeSlots.Add(Handle.Index);
 }
 
-void FUDSimulationState::UpdateActorsRotations(const TArray<int32>& Indices, const float& Delta)
+void FUDSimulationState::RemoveAtSwap(const int32& Index)
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateActorsRotations");
-	for (const int32& Index : Indices)
+	const EUDArchetype Archetype = GetArchetype(Index);
+	int32 Hole = Index;
+	for (int32 Range = (int32)Archetype; Range < (int32)EUDArchetype::Num; Range++)
+	{
+		const int32 Last = ArchetypeEnds[Range] - 1;
+		if (Last != Hole)
+		{
+			MoveEntity(Last, Hole);
+			Hole = Last;
+		}
+		ArchetypeEnds[Range]--;
+	}
+	check(Hole == Num() - 1);
+
+	// The hole ended on the last entity of every array the archetype has
+	Actors.Pop(false);
+	Locations.Pop(false);
+	Rotations.Pop(false);
+	LODs.Pop(false);
+	Awake.RemoveAt(Hole);
+	StillSteps.Pop(false);
+	DenseToSparse.Pop(false);
+	if (Archetype != EUDArchetype::Static)
+	{
+		Movements.Pop(false);
+		Inputs.Pop(false);
+		if (UsesStreams())
+		{
+			Streams.RemoveAtSwap(Streams.Num() - 1);
+		}
+	}
+	if (Archetype == EUDArchetype::Agent)
 	{
-		UpdateActorRotation(Index, Delta);
+		Collisions.Pop(false);
 	}
+	bActiveDirty = true;
 }
 
-bool FUDSimulationState::CheckCollision(FVector& OutPosition, const AActor* Actor, const FUDCollision& Collision, const FVector& CurrentPosition, const FVector& TargetPosition)
+void FUDSimulationState::MoveEntity(const int32& From, const int32& To)
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_CheckCollision");
-	UWorld* World = Actor->GetWorld();
-	if (!World)
+	Actors[To] = Actors[From];
+	Locations[To] = Locations[From];
+	Rotations[To] = Rotations[From];
+	LODs[To] = LODs[From];
+	Awake[To] = (bool)Awake[From];
+	StillSteps[To] = StillSteps[From];
+	DenseToSparse[To] = DenseToSparse[From];
+	SparseToDense[DenseToSparse[To]] = To;
+
+	// Partial arrays only follow entities that own the component on both sides
+	if (From < Movements.Num() && To < Movements.Num())
+	{
+		Movements[To] = Movements[From];
+		Inputs[To] = Inputs[From];
+		if (UsesStreams())
+		{
+			Streams.Move(From, To);
+		}
+	}
+	if (From < Collisions.Num() && To < Collisions.Num())
 	{
-		return false; // No valid world reference
+		Collisions[To] = Collisions[From];
 	}
+}
 
-	FCollisionQueryParams CollisionParams = {};
-	CollisionParams.AddIgnoredActor(Actor);
-	TArray<FHitResult> HitResult = {};
-
-	OutPosition = TargetPosition;
-	int32 Iterations = 0;
-	if (World->SweepMultiByChannel(HitResult, CurrentPosition, OutPosition, FQuat::Identity, ECC_WorldStatic, FCollisionShape::MakeSphere(Collision.Size), CollisionParams))
+EUDArchetype FUDSimulationState::GetArchetype(const int32& Index) const
+{
+	for (int32 Archetype = 0; Archetype < (int32)EUDArchetype::Num; Archetype++)
 	{
-		OutPosition = HitResult[0].ImpactPoint;
-		return true;
+		if (Index < ArchetypeEnds[Archetype])
+		{
+			return (EUDArchetype)Archetype;
+		}
 	}
+	return EUDArchetype::Num;
+}
 
-	return false; // No collisions
+void FUDSimulationState::SetMovementInput(const FUDEntityHandle& Handle, const FUDMovementInput& Input)
+{
+	FScopeLock ScopeLock(&Mutex);
+	const int32 Index = GetDenseIndex(Handle);
+	if (Index == INDEX_NONE || Index >= NumMoving())
+	{
+		return; // Statics have no input
+	}
+	Inputs[Index] = Input;
+	if (UsesStreams())
+	{
+		Streams.SetInput(Index, Input);
+	}
+	WakeEntity(Index);
 }
 
-bool FUDSimulationState::CanMove(const AActor* Actor, const FVector& CurrentPosition, const FVector& TargetPosition, FVector& OutPos)
+void FUDSimulationState::AddImpulse(const FUDEntityHandle& Handle, const FVector& Impulse)
 {
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_CheckGroundCollision");
-	UWorld* World = Actor->GetWorld();
-	if (!World)
+	FScopeLock ScopeLock(&Mutex);
+	const int32 Index = GetDenseIndex(Handle);
+	if (Index == INDEX_NONE || Index >= NumMoving())
+	{
+		return;
+	}
+	Locations[Index].Velocity += Impulse;
+	if (UsesStreams())
 	{
-		return false; // No valid world reference
+		Streams.SetVelocity(Index, Locations[Index].Velocity);
 	}
+	WakeEntity(Index);
+}
 
-	FCollisionQueryParams CollisionParams = {};
-	CollisionParams.AddIgnoredActor(Actor);
-	FHitResult HitResult = {};
-	if (World->LineTraceSingleByChannel(HitResult, CurrentPosition, TargetPosition, ECC_WorldStatic, CollisionParams))
+void FUDSimulationState::ApplyCorrections(const FUDCorrectionList& Corrections)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_ApplyCorrections");
+	FScopeLock ScopeLock(&Mutex);
+	const int32 NumSteps = FMath::Max(Config.CorrectionSmoothingSteps, 1);
+	for (int32 n = 0; n < Corrections.Num(); n++)
 	{
+		const FUDEntityHandle& Handle = Corrections.Handles[n];
+		const int32 Index = GetDenseIndex(Handle);
+		if (Index == INDEX_NONE)
+		{
+			continue;
+		}
+
+		// The velocity drives the next integration so it is never smoothed
+		WakeEntity(Index);
+		Locations[Index].Velocity = Corrections.Velocities[n];
+		if (UsesStreams() && Index < NumMoving())
+		{
+			Streams.SetVelocity(Index, Corrections.Velocities[n]);
+		}
 
-		// Find the normal of the steepest slope among the hits
-		FVector BestSlopeNormal = FVector::UpVector; // Initialize with vertical direction
-		float BestSlopeAngle = 0.0f;
+		if (CorrectionSlots.Num() <= Handle.Index)
+		{
+			CorrectionSlots.Init(INDEX_NONE, SparseToDense.Num()); // Grows rarely, rebuilt from the active corrections
+			for (int32 Active = 0; Active < SmoothedCorrections.Num(); Active++)
+			{
+				CorrectionSlots[SmoothedCorrections[Active].Handle.Index] = Active;
+			}
+		}
 
+		// A new correction replaces the remaining part of the previous one, its offset is measured from where the entity is now
+		int32& Slot = CorrectionSlots[Handle.Index];
+		Slot = Slot == INDEX_NONE ? SmoothedCorrections.AddDefaulted() : Slot;
+		FUDSmoothedCorrection& Correction = SmoothedCorrections[Slot];
+		Correction.Handle = Handle;
+		Correction.LocationOffset = Corrections.Locations[n] - Locations[Index].Value;
+		Correction.RotationOffset = (Corrections.Rotations[n] - Rotations[Index].Value).GetNormalized();
+		Correction.StepsLeft = NumSteps;
+	}
+}
 
+void FUDSimulationState::SmoothCorrections()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_SmoothCorrections");
+	for (int32 n = SmoothedCorrections.Num() - 1; n >= 0; n--)
+	{
+		FUDSmoothedCorrection& Correction = SmoothedCorrections[n];
+		const int32 Index = GetDenseIndex(Correction.Handle);
+		if (Index != INDEX_NONE)
+		{
+			const float Alpha = 1.f / Correction.StepsLeft;
+			const FVector LocationStep = Correction.LocationOffset * Alpha;
+			const FRotator RotationStep = Correction.RotationOffset * Alpha;
+			Locations[Index].Value += LocationStep;
+			Rotations[Index].Value += RotationStep;
+			if (UsesStreams() && Index < NumMoving())
+			{
+				Streams.SetPosition(Index, Locations[Index].Value);
+			}
+			Correction.LocationOffset -= LocationStep;
+			Correction.RotationOffset -= RotationStep;
+			Correction.StepsLeft--;
+			DirtyMasks[(int32)EUDDirty::Location].Set(Index);
+			DirtyMasks[(int32)EUDDirty::Rotation].Set(Index);
+		}
 
-		if (FVector(0., 0., 1.).Dot(HitResult.ImpactNormal) < .4)
+		if (Index == INDEX_NONE || Correction.StepsLeft <= 0)
 		{
-			UD::EnqueueGeneralCommandToGameThread([TempWorld = World, TempHit = HitResult]()
+			CorrectionSlots[Correction.Handle.Index] = INDEX_NONE;
+			SmoothedCorrections.RemoveAtSwap(n, 1, false);
+			if (n < SmoothedCorrections.Num())
 			{
-				DrawDebugLine(TempWorld, TempHit.ImpactPoint, TempHit.ImpactPoint * FVector(TempHit.ImpactNormal).Normalize() * 10.f, FColor::Red, true, 0.01f);
-			});
-			OutPos = HitResult.ImpactPoint;
-			return true;
-		}
-	}
-
-	return false;
-	//// Check the slope of the steepest hit
-	//if (BestSlopeAngle <= Collision.AcceptableSlope)
-	//{
-	//	// The steepest slope is within an acceptable range, allow movement
-	//	return true;
-	//}
-	//else
-	//{
-	//	// The steepest slope is too steep, so handle the collision by sliding along the slope
-	//	SlideDirection = FVector::CrossProduct(BestSlopeNormal, FVector::UpVector).GetSafeNormal();
-	//	float SlideDistance = Collision.Size * FMath::Cos(FMath::DegreesToRadians(Collision.AcceptableSlope));
-	//	FVector NewTargetLocationFound = OutPosition - SlideDirection * SlideDistance;
-	//	
-	//	if (NewTargetLocationFound.Equals(OutPosition, UE_KINDA_SMALL_NUMBER))
-	//	{
-	//		// The sliding operation did not result in a change; exit the loop
-	//		break;
-	//	}
-
-	//	if (FVector::Distance(TargetPosition, NewTargetLocationFound) <= Collision.AcceptableDistance)
-	//	{
-	//		OutPosition = NewTargetLocationFound;
-	//	}
-	//	else
-	//	{
-	//		return true;
-	//	}
-	//}
-
-}
-
-void FUDSimulationState::WaitUntilUnlocked()
-{
-	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_WaitUntilUnlocked");
-	FPlatformProcess::ConditionalSleep([&]() {return !bLocked; }, .0001f);
-}
-
-FUDSimulation::FUDSimulation(UWorld* InWorld)
-	: FUDSimulation()
+				CorrectionSlots[SmoothedCorrections[n].Handle.Index] = n;
+			}
+		}
+	}
+}
+
+void FUDSimulationState::ClearDirty()
 {
-	if (InWorld)
+	for (FUDDirtyMask& Mask : DirtyMasks)
 	{
-		World = InWorld;
-		bIsRunning = true;
-		CurrentThread = FRunnableThread::Create(this, TEXT("Unreal DOD Simulation"));
+		Mask.Init(Num());
 	}
 }
 
-FUDSimulation::~FUDSimulation()
+void FUDSimulationState::BeginStep()
 {
-	if (CurrentThread)
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_BeginStep");
+	EmptyFrameScratch();
+	FrameArena.Reset();
+	StepCounters = {};
+	RefreshActiveIndices();
+	if (bStreamsMoved && UsesStreams())
 	{
-		CurrentThread->Kill();
-		delete CurrentThread;
+		RecenterStreams();
+	}
+	bStreamsMoved = false;
+	if (DirtyMasks[0].Num() != Num())
+	{
+		ClearDirty(); // Entities were added or removed without a ClearDirty
 	}
 }
-bool FUDSimulation::Init()
+
+void FUDSimulationState::EmptyFrameScratch()
 {
-	return true;
+	// Every container still pointing into the arena forgets its memory, the next step allocates it again from the reset arena
+	for (TArray<FUDFrameIndices>* ChunkLists : { &ChunkActorsToUpdate, &ChunkRotationsToUpdate, &ChunkSleepers })
+	{
+		for (FUDFrameIndices& Indices : *ChunkLists)
+		{
+			Indices.Empty();
+		}
+	}
+	for (FUDSweepBatch& Sweeps : ChunkSweeps)
+	{
+		Sweeps.Requests.Empty();
+	}
+	SeparationX.Empty();
+	SeparationY.Empty();
 }
 
-uint32 FUDSimulation::Run()
+void FUDSimulationState::RecenterStreams()
 {
-	if (!World)
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_RecenterStreams");
+	const int32 NumEntities = FMath::Min(NumMoving(), Streams.Num());
+	if (NumEntities == 0)
 	{
-		UE_LOG(LogTemp, Warning, TEXT("Cannot run simulation with an invalid world, please set world"));
+		return;
 	}
 
-	double PreviousFrameTime = FPlatformTime::Seconds();
-	while (bIsRunning)
+	FBox Bounds(ForceInit);
+	for (int32 i = 0; i < NumEntities; i++)
 	{
-		TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_MainLoop");
-		check(World);
+		Bounds += Locations[i].Value;
+	}
+	const FVector Center = Bounds.GetCenter();
+	if (FVector::DistSquared(Center, Streams.Origin) > FMath::Square(UD_STREAM_REBASE_DISTANCE))
+	{
+		Streams.Rebase(Center);
+	}
+}
 
-		const double CurrentTime = FPlatformTime::Seconds();
-		const double DeltaSeconds = CurrentTime - PreviousFrameTime;
-		PreviousFrameTime = CurrentTime;
+void FUDSimulationState::UpdateLODs()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateLODs");
+	LODStep++;
+	const int32 NumEntities = NumMoving(); // Statics are never stepped
+	if (!UsesLOD() || NumEntities == 0)
+	{
+		return;
+	}
 
-		State.WaitUntilUnlocked();
-		State.bLocked = true;
-		const TArray<int32> LocationIndices = State.UpdateLocations(DeltaSeconds);
-		const TArray<int32> RotationIndices = State.UpdateRotations(DeltaSeconds);
-		TArray<int32> IndicesToUpdate = LocationIndices;
-		for (const int32& RotationIndex : RotationIndices)
-		{
-			IndicesToUpdate.AddUnique(RotationIndex);
-		}
-		
-		for (const int32& IndexToUpdate : IndicesToUpdate)
+	// Only a window of the entities is measured every step, an entity is never more than LODRebucketSteps steps late on its tier
+	const int32 Window = FMath::DivideAndRoundUp(NumEntities, FMath::Max(Config.LODRebucketSteps, 1));
+	LODCursor = LODCursor < NumEntities ? LODCursor : 0;
+	UD::ParallelForChunks(Window, Config, [&](int32 ChunkIndex, int32 Begin, int32 End)
+	{
+		for (int32 n = Begin; n < End; n++)
 		{
-			FUDSimulationQueue& CurrentQueue = State.GetActorMovementQueue(IndexToUpdate);
-			if (CurrentQueue.DoneExecuting()) // Refresh if possible
-			{
-				CurrentQueue.Clear();
-				UD::EnqueueCommandToGameThread(CurrentQueue, FMath::RandHelper(2),
-				[&, TempDelta = DeltaSeconds, TempIndexToUpdate = IndexToUpdate]()
-				{
-					State.UpdateActorLocation(TempIndexToUpdate, TempDelta);
-					State.UpdateActorRotation(TempIndexToUpdate, TempDelta);
-				});
-			}
+			const int32 i = (LODCursor + n) % NumEntities;
+			LODs[i] = ComputeLOD(i);
 		}
-		State.bLocked = false;
+	});
+	LODCursor = (LODCursor + Window) % NumEntities;
+}
 
-		// Maintain a consistent frame rate
-		const double FrameTime = 1.0 / FramePerSecond;
-		const double SleepTime = FrameTime - DeltaSeconds;
-		if (SleepTime > 0.0)
-		{
-			FPlatformProcess::Sleep(SleepTime);
-		}
+EUDSimulationLOD FUDSimulationState::ComputeLOD(const int32& Index) const
+{
+	const FVector& Location = Locations[Index].Value;
+	double DistanceSquared = TNumericLimits<double>::Max();
+	for (const FVector& Viewer : Viewers)
+	{
+		DistanceSquared = FMath::Min(DistanceSquared, FVector::DistSquared(Location, Viewer));
 	}
 
-	return 0;
-}
+	// Going up a tier is immediate, going down waits until the entity is past the hysteresis margin
+	const EUDSimulationLOD Current = LODs[Index];
+	auto IsBeyond = [&](const float& Distance, const EUDSimulationLOD& Tier)
+	{
+		const double Threshold = Distance * (Current < Tier ? 1. + Config.LODHysteresis : 1.);
+		return DistanceSquared > Threshold * Threshold;
+	};
 
-void FUDSimulation::Stop()
-{
-	bIsRunning = false;
+	if (IsBeyond(Config.LODDormantDistance, EUDSimulationLOD::Dormant))
+	{
+		return EUDSimulationLOD::Dormant;
+	}
+	return IsBeyond(Config.LODReducedDistance, EUDSimulationLOD::Reduced) ? EUDSimulationLOD::Reduced : EUDSimulationLOD::Full;
 }
 
-void FUDSimulation::Tick_GameThread(const float& Delta)
+EUDSimulationLOD FUDSimulationState::GetBlockLOD(const int32& Block) const
 {
-	check(IsInGameThread());
-	UD::GeneralQueue.ExecuteCommands();
-	for (int32 i = 0 ; i < State.Actors.Num(); i++)
+	if (!UsesLOD())
+	{
+		return EUDSimulationLOD::Full;
+	}
+
+	EUDSimulationLOD LOD = EUDSimulationLOD::Dormant;
+	const int32 End = FMath::Min((Block + 1) * UD_STREAM_WIDTH, NumMoving());
+	for (int32 i = Block * UD_STREAM_WIDTH; i < End; i++)
 	{
-		State.GetActorMovementQueue(i).ExecuteCommands();
+		LOD = FMath::Min(LOD, LODs[i]);
 	}
+	return LOD;
 }
 
-void FUDSimulation::ReplicateIndex(const int32& Index, const bool& bSkipSource)
+int32 FUDSimulationState::GetStepInterval(const EUDSimulationLOD& LOD, const int32& Block) const
 {
+	// Blocks are staggered so a tier costs the same share of every step instead of spiking on one
+	const int32 Interval = LOD == EUDSimulationLOD::Full ? 1 : FMath::Max(LOD == EUDSimulationLOD::Reduced ? Config.LODReducedInterval : Config.LODDormantInterval, 1);
+	return (LODStep + Block) % Interval == 0 ? Interval : 0;
 }
 
-TArray<int32> FUDSimulation::GetDifferences(const FUDSimulationState& ClientState, const float& ErrorTolerence)
+void FUDSimulationState::UpdateLocations(const float& Delta)
 {
-	return TArray<int32>();
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateLocations");
+	FUDFrameArena::FScope ArenaScope(FrameArena);
+
+	// Only the awake entities are stepped, the stream kernels need whole blocks so they walk the active blocks instead
+	const int32 NumActive = UsesStreams() ? ActiveBlocks.Num() : ActiveIndices.Num();
+	const int32 AgentsEnd = Algo::LowerBound(ActiveIndices, GetArchetypeEnd(EUDArchetype::Agent)); // Agents lead the active indices
+	const int32 NumChunks = UD::GetNumChunks(NumActive, Config);
+	ChunkActorsToUpdate.SetNum(NumChunks, false);
+	ChunkSweeps.SetNum(NumChunks, false);
+	ChunkSleepers.SetNum(NumChunks, false);
+	ChunkNumIntegrated.SetNum(NumChunks, false);
+	UD::ParallelForChunks(NumActive, Config, [&](int32 ChunkIndex, int32 Begin, int32 End)
+	{
+		// Sized for every entity of the chunk once so the lists never grow, an entity is either moved, swept or put to sleep
+		const int32 MaxEntities = UsesStreams() ? (End - Begin) * UD_STREAM_WIDTH : End - Begin;
+		ChunkActorsToUpdate[ChunkIndex].Reset(MaxEntities);
+		ChunkSweeps[ChunkIndex].Requests.Reset(CanQueryWorld() ? MaxEntities : 0);
+		ChunkSleepers[ChunkIndex].Reset(Config.bSleep ? MaxEntities : 0);
+		if (UsesStreams())
+		{
+			ChunkNumIntegrated[ChunkIndex] = UpdateLocationsChunk_Streams(Begin, End, Delta, ChunkActorsToUpdate[ChunkIndex], ChunkSweeps[ChunkIndex], ChunkSleepers[ChunkIndex]);
+		}
+		else
+		{
+			// One pass per archetype keeps the component checks out of the loop
+			const int32 Split = FMath::Clamp(AgentsEnd, Begin, End);
+			ChunkNumIntegrated[ChunkIndex] = UpdateLocationsChunk(Begin, Split, Delta, true, ChunkActorsToUpdate[ChunkIndex], ChunkSweeps[ChunkIndex], ChunkSleepers[ChunkIndex])
+				+ UpdateLocationsChunk(Split, End, Delta, false, ChunkActorsToUpdate[ChunkIndex], ChunkSweeps[ChunkIndex], ChunkSleepers[ChunkIndex]);
+		}
+		ResolveSweeps(ChunkSweeps[ChunkIndex], ChunkActorsToUpdate[ChunkIndex]);
+
+		const int32 FirstIndex = UsesStreams() ? ActiveBlocks[Begin] * UD_STREAM_WIDTH : ActiveIndices[Begin];
+		const int32 LastIndex = UsesStreams() ? ActiveBlocks[End - 1] * UD_STREAM_WIDTH + UD_STREAM_WIDTH - 1 : ActiveIndices[End - 1];
+		FUDDirtyMaskChunkWriter LocationMask(DirtyMasks[(int32)EUDDirty::Location], FirstIndex, LastIndex);
+		FUDDirtyMaskChunkWriter VelocityMask(DirtyMasks[(int32)EUDDirty::Velocity], FirstIndex, LastIndex);
+		for (const int32& Index : ChunkActorsToUpdate[ChunkIndex])
+		{
+			LocationMask.Set(Index);
+			VelocityMask.Set(Index);
+		}
+	});
+	SleepEntities();
+	for (int32 ChunkIndex = 0; ChunkIndex < NumChunks; ChunkIndex++)
+	{
+		StepCounters.NumIntegrated += ChunkNumIntegrated[ChunkIndex];
+		StepCounters.NumSweeps += ChunkSweeps[ChunkIndex].NumSweeps;
+	}
+
+	if (Config.bSeparation)
+	{
+		SeparateEntities();
+	}
 }
 
-void UD::EnqueueCommandToGameThread(FUDSimulationQueue& Queue, const int64 FrameDelay, TFunction<void(void)> LambdaToAdd)
+void FUDSimulationState::UpdateRotations(const float& Delta)
 {
-	FUDSimulationCommand Command = {};
-	Command.Lambda = LambdaToAdd;
-	Command.EnqueuedFrame = UKismetSystemLibrary::GetFrameCount();
-	Command.FrameDelay = FrameDelay;
-	Queue.Enqueue(Command);
-	Queue.WaitForExecution();
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateRotations");
+	FUDFrameArena::FScope ArenaScope(FrameArena);
+	const int32 NumChunks = UD::GetNumChunks(ActiveIndices.Num(), Config);
+	ChunkRotationsToUpdate.SetNum(NumChunks, false);
+	UD::ParallelForChunks(ActiveIndices.Num(), Config, [&](int32 ChunkIndex, int32 Begin, int32 End)
+	{
+		ChunkRotationsToUpdate[ChunkIndex].Reset(End - Begin);
+		UpdateRotationsChunk(Begin, End, Delta, ChunkRotationsToUpdate[ChunkIndex]);
+
+		FUDDirtyMaskChunkWriter RotationMask(DirtyMasks[(int32)EUDDirty::Rotation], ActiveIndices[Begin], ActiveIndices[End - 1]);
+		for (const int32& Index : ChunkRotationsToUpdate[ChunkIndex])
+		{
+			RotationMask.Set(Index);
+		}
+	});
+}
+
+int32 FUDSimulationState::UpdateLocationsChunk(const int32& Begin, const int32& End, const float& Delta, const bool& bAgents, FUDFrameIndices& OutActorsToUpdate, FUDSweepBatch& OutSweeps, FUDFrameIndices& OutSleepers)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateLocationsChunk");
+	if (Begin >= End)
+	{
+		return 0;
+	}
+
+	if (UsesLOD())
+	{
+		return bAgents ? UpdateLocationsKernel<true, true>(Begin, End, Delta, OutActorsToUpdate, OutSweeps, OutSleepers) : UpdateLocationsKernel<false, true>(Begin, End, Delta, OutActorsToUpdate, OutSweeps, OutSleepers);
+	}
+	return bAgents ? UpdateLocationsKernel<true, false>(Begin, End, Delta, OutActorsToUpdate, OutSweeps, OutSleepers) : UpdateLocationsKernel<false, false>(Begin, End, Delta, OutActorsToUpdate, OutSweeps, OutSleepers);
 }
 
-void UD::EnqueueGeneralCommandToGameThread(TFunction<void(void)> LambdaToAdd)
+template<bool bAgents, bool bUseLOD>
+int32 FUDSimulationState::UpdateLocationsKernel(const int32& Begin, const int32& End, const float& Delta, FUDFrameIndices& OutActorsToUpdate, FUDSweepBatch& OutSweeps, FUDFrameIndices& OutSleepers)
 {
-	EnqueueCommandToGameThread(UD::GeneralQueue, 0, LambdaToAdd);
+	const bool bCanSweep = bAgents && CanQueryWorld();
+	int32 NumIntegrated = 0;
+
+	UD::ForEachActive<FUDLocation, const FUDMovement, const FUDMovementInput>(*this, Begin, End, [&](const int32 i, FUDLocation& Location, const FUDMovement& Movement, const FUDMovementInput& Input)
+	{
+		UD_ENTITY_SCOPE("SimState_UpdateLocation_Single");
+		const EUDSimulationLOD LOD = bUseLOD ? LODs[i] : EUDSimulationLOD::Full;
+		const int32 Interval = bUseLOD ? GetStepInterval(LOD, i / UD_STREAM_WIDTH) : 1;
+		if (Interval == 0)
+		{
+			return;
+		}
+		const float StepDelta = Delta * Interval;
+		NumIntegrated++;
+
+		const FVector CachedLocation = Location.Value;
+		if (bUseLOD && LOD == EUDSimulationLOD::Dormant)
+		{
+			Location.Value += FVector(Location.Velocity.X, Location.Velocity.Y, 0.) * StepDelta; // On rails, nobody is close enough to see the forces
+			if (CachedLocation != Location.Value)
+			{
+				OutActorsToUpdate.Add(i);
+			}
+			else if (UpdateStillness(i))
+			{
+				OutSleepers.Add(i);
+			}
+			return;
+		}
+
+		FVector Acceleration = FVector(0.f, 0.f, -Movement.Gravity);
+
+		Acceleration += Input.Movement * Movement.Acceleration;
+
+		// Without deceleration the force is zero, so it is always added rather than branched on per entity
+		const FVector DecelerationForce = -Location.Velocity.GetSafeNormal() * FMath::Max(Movement.Deceleration, 0.f);
+		Acceleration += FMath::Min(Location.Velocity.Size(), DecelerationForce.Size()) * DecelerationForce;
+
+		Location.Velocity += Acceleration * StepDelta;
+		Location.Velocity = Location.Velocity.GetClampedToMaxSize(Movement.MaxSpeed);
+
+		FVector TargetLocation = CachedLocation + Location.Velocity * StepDelta;
+		if (bAgents)
+		{
+			ResolveGround(i, TargetLocation, Location.Velocity, LOD == EUDSimulationLOD::Full);
+		}
+		if (UpdateStillness(i))
+		{
+			OutSleepers.Add(i);
+			return; // Settled, the remaining drift is below SleepVelocity
+		}
+
+		if (bCanSweep && LOD == EUDSimulationLOD::Full && TargetLocation != CachedLocation)
+		{
+			FUDSweepRequest& Request = OutSweeps.Requests.AddDefaulted_GetRef();
+			Request.Index = i;
+			Request.TargetLocation = TargetLocation;
+			return; // Moved and marked dirty by ResolveSweeps
+		}
+
+		Location.Value = TargetLocation;
+		if (CachedLocation != Location.Value)
+		{
+			OutActorsToUpdate.Add(i);
+		}
+	});
+	return NumIntegrated;
+}
+
+int32 FUDSimulationState::UpdateLocationsChunk_Streams(const int32& Begin, const int32& End, const float& Delta, FUDFrameIndices& OutActorsToUpdate, FUDSweepBatch& OutSweeps, FUDFrameIndices& OutSleepers)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateLocationsChunk_Streams");
+	const bool bUseSIMD = Config.bUseSIMD && !Config.bDeterministic; // The vector kernel uses estimates that differ between CPUs
+	const int32 NumEntities = NumMoving(); // The streams end with the movers
+	const int32 NumAgents = GetArchetypeEnd(EUDArchetype::Agent);
+	int32 NumIntegrated = 0;
+
+	// Consecutive active blocks due with the same tier are integrated as one run, dormant runs only follow their velocity
+	for (int32 n = Begin; n < End;)
+	{
+		const int32 RunBlock = ActiveBlocks[n];
+		const EUDSimulationLOD LOD = GetBlockLOD(RunBlock);
+		const int32 Interval = GetStepInterval(LOD, RunBlock);
+		int32 NextBlock = RunBlock + 1;
+		for (n++; n < End && ActiveBlocks[n] == NextBlock && GetBlockLOD(NextBlock) == LOD && GetStepInterval(LOD, NextBlock) == Interval; n++, NextBlock++);
+		if (Interval == 0)
+		{
+			continue;
+		}
+
+		const int32 RunBegin = RunBlock * UD_STREAM_WIDTH;
+		const int32 RunEnd = FMath::Min(NextBlock * UD_STREAM_WIDTH, NumEntities);
+		if (LOD != EUDSimulationLOD::Dormant)
+		{
+			UD::IntegrateStreams(Streams, RunBegin, RunEnd, Delta * Interval, bUseSIMD);
+			continue;
+		}
+		for (int32 i = RunBegin; i < RunEnd; i++)
+		{
+			Streams.PositionX[i] += Streams.VelocityX[i] * Delta * Interval;
+			Streams.PositionY[i] += Streams.VelocityY[i] * Delta * Interval;
+		}
+	}
+
+	// The streams own the integration, the components are refreshed for the consumers of the state
+	for (int32 n = Begin; n < End; n++)
+	{
+		const int32 Block = ActiveBlocks[n];
+		const EUDSimulationLOD LOD = GetBlockLOD(Block);
+		if (GetStepInterval(LOD, Block) == 0)
+		{
+			continue;
+		}
+
+		// A block can straddle the agents and the movers
+		const int32 BlockBegin = Block * UD_STREAM_WIDTH;
+		const int32 BlockEnd = FMath::Min(BlockBegin + UD_STREAM_WIDTH, NumEntities);
+		const int32 Split = FMath::Clamp(NumAgents, BlockBegin, BlockEnd);
+		FinishStreamLanes(BlockBegin, Split, LOD, true, OutActorsToUpdate, OutSweeps, OutSleepers);
+		FinishStreamLanes(Split, BlockEnd, LOD, false, OutActorsToUpdate, OutSweeps, OutSleepers);
+		NumIntegrated += BlockEnd - BlockBegin;
+	}
+	return NumIntegrated;
+}
+
+void FUDSimulationState::FinishStreamLanes(const int32& Begin, const int32& End, const EUDSimulationLOD& LOD, const bool& bAgents, FUDFrameIndices& OutActorsToUpdate, FUDSweepBatch& OutSweeps, FUDFrameIndices& OutSleepers)
+{
+	for (int32 i = Begin; i < End; i++)
+	{
+		FUDLocation& Location = Locations[i];
+		if (!Awake[i])
+		{
+			// Integrated with its block, put back where it sleeps
+			Streams.SetPosition(i, Location.Value);
+			Streams.SetVelocity(i, Location.Velocity);
+			continue;
+		}
+
+		const FVector CachedLocation = Location.Value;
+		FVector TargetLocation = Streams.GetPosition(i);
+		Location.Velocity = Streams.GetVelocity(i);
+		if (bAgents && LOD != EUDSimulationLOD::Dormant && ResolveGround(i, TargetLocation, Location.Velocity, LOD == EUDSimulationLOD::Full))
+		{
+			Streams.SetPosition(i, TargetLocation);
+			Streams.SetVelocity(i, Location.Velocity);
+		}
+
+		if (UpdateStillness(i))
+		{
+			Streams.SetPosition(i, CachedLocation);
+			OutSleepers.Add(i);
+			continue; // Settled, the remaining drift is below SleepVelocity
+		}
+
+		if (bAgents && LOD == EUDSimulationLOD::Full && CanQueryWorld() && TargetLocation != CachedLocation)
+		{
+			FUDSweepRequest& Request = OutSweeps.Requests.AddDefaulted_GetRef();
+			Request.Index = i;
+			Request.TargetLocation = TargetLocation;
+			continue; // Moved and marked dirty by ResolveSweeps
+		}
+
+		Location.Value = TargetLocation;
+		if (CachedLocation != Location.Value)
+		{
+			OutActorsToUpdate.Add(i);
+		}
+	}
+}
+
+bool FUDSimulationState::UpdateStillness(const int32& Index)
+{
+	if (!Config.bSleep)
+	{
+		return false;
+	}
+
+	// Only written by the chunk that owns the entity
+	uint8& Steps = StillSteps[Index];
+	const FUDMovementInput& Input = Inputs[Index];
+	if (!Input.Movement.IsZero() || !Input.Rotation.IsZero() || Locations[Index].Velocity.SizeSquared() > FMath::Square(Config.SleepVelocity))
+	{
+		Steps = 0;
+		return false;
+	}
+
+	Steps = (uint8)FMath::Min(Steps + 1, 255);
+	return Steps >= Config.SleepSteps;
+}
+
+void FUDSimulationState::SleepEntities()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_SleepEntities");
+	for (const FUDFrameIndices& Sleepers : ChunkSleepers)
+	{
+		for (const int32& Index : Sleepers)
+		{
+			Awake[Index] = false;
+			Locations[Index].Velocity = FVector::ZeroVector;
+			DirtyMasks[(int32)EUDDirty::Velocity].Set(Index);
+			if (UsesStreams())
+			{
+				Streams.SetVelocity(Index, FVector::ZeroVector);
+			}
+			bActiveDirty = true;
+		}
+	}
+}
+
+void FUDSimulationState::WakeEntity(const int32& Index)
+{
+	if (Index >= NumMoving())
+	{
+		return; // Statics never step, moved ones only need their actor updated
+	}
+	StillSteps[Index] = 0;
+	if (!Awake[Index])
+	{
+		Awake[Index] = true;
+		bActiveDirty = true;
+	}
+}
+
+void FUDSimulationState::RefreshActiveIndices()
+{
+	if (!bActiveDirty && Awake.Num() == Num())
+	{
+		return;
+	}
+
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_RefreshActiveIndices");
+	if (Awake.Num() != Num())
+	{
+		Awake.Init(false, Num()); // Filled from outside the sparse set, every moving entity starts awake
+		Awake.SetRange(0, NumMoving(), true);
+		StillSteps.Init(0, Num());
+	}
+
+	ActiveIndices.Reset();
+	ActiveBlocks.Reset();
+	for (TConstSetBitIterator<> It(Awake); It; ++It)
+	{
+		const int32 Index = It.GetIndex();
+		const int32 Block = Index / UD_STREAM_WIDTH;
+		ActiveIndices.Add(Index);
+		if (ActiveBlocks.Num() == 0 || ActiveBlocks.Last() != Block)
+		{
+			ActiveBlocks.Add(Block);
+		}
+	}
+	bActiveDirty = false;
+}
+
+void FUDSimulationState::ResolveSweeps(FUDSweepBatch& Sweeps, FUDFrameIndices& OutActorsToUpdate)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_ResolveSweeps");
+	Sweeps.NumSweeps = 0;
+	if (Sweeps.Requests.Num() == 0)
+	{
+		return;
+	}
+
+	// One query params per batch, only the ignored actor changes between requests
+	const int32 NumIntegrated = OutActorsToUpdate.Num();
+	FCollisionQueryParams& QueryParams = Sweeps.QueryParams;
+	QueryParams.bTraceComplex = false;
+	for (const FUDSweepRequest& Request : Sweeps.Requests)
+	{
+		const int32 i = Request.Index;
+		FUDLocation& Location = Locations[i];
+		const FVector CachedLocation = Location.Value;
+		const FCollisionShape Shape = FCollisionShape::MakeSphere(Collisions[i].Size);
+
+		QueryParams.ClearIgnoredActors();
+		if (Actors[i])
+		{
+			QueryParams.AddIgnoredActor(Actors[i].Ptr);
+		}
+
+		// Move until the first hit then slide the rest of the move along the hit surface
+		FVector ResolvedLocation = CachedLocation;
+		FVector TargetLocation = Request.TargetLocation;
+		for (int32 Iteration = 0; Iteration < MAX_SWEEP_ITERATIONS; Iteration++)
+		{
+			FHitResult Hit = {};
+			Sweeps.NumSweeps++;
+			if (!World->SweepSingleByChannel(Hit, ResolvedLocation, TargetLocation, FQuat::Identity, ECC_WorldStatic, Shape, QueryParams))
+			{
+				ResolvedLocation = TargetLocation;
+				break;
+			}
+
+			if (Hit.bStartPenetrating)
+			{
+				ResolvedLocation += Hit.Normal * (Hit.PenetrationDepth + UE_KINDA_SMALL_NUMBER);
+				break;
+			}
+
+			ResolvedLocation = Hit.Location;
+			TargetLocation = ResolvedLocation + FVector::VectorPlaneProject(TargetLocation - ResolvedLocation, Hit.ImpactNormal);
+			Location.Velocity = FVector::VectorPlaneProject(Location.Velocity, Hit.ImpactNormal);
+			if (TargetLocation.Equals(ResolvedLocation, UE_KINDA_SMALL_NUMBER))
+			{
+				break;
+			}
+		}
+
+		Location.Value = ResolvedLocation;
+		if (UsesStreams())
+		{
+			Streams.SetPosition(i, ResolvedLocation);
+			Streams.SetVelocity(i, Location.Velocity);
+		}
+
+		if (CachedLocation != Location.Value)
+		{
+			OutActorsToUpdate.Add(i);
+		}
+	}
+
+	// The swept entities were skipped by the integration, both runs are ascending and merge back into one sorted list
+	const int32 NumIndices = OutActorsToUpdate.Num();
+	if (NumIntegrated == 0 || NumIntegrated == NumIndices || OutActorsToUpdate[NumIntegrated - 1] < OutActorsToUpdate[NumIntegrated])
+	{
+		return;
+	}
+
+	FUDFrameIndices Merged = {};
+	Merged.Reserve(NumIndices);
+	int32 Integrated = 0;
+	int32 Swept = NumIntegrated;
+	while (Integrated < NumIntegrated && Swept < NumIndices)
+	{
+		Merged.Add(OutActorsToUpdate[Integrated] < OutActorsToUpdate[Swept] ? OutActorsToUpdate[Integrated++] : OutActorsToUpdate[Swept++]);
+	}
+	Merged.Append(OutActorsToUpdate.GetData() + Integrated, NumIntegrated - Integrated);
+	Merged.Append(OutActorsToUpdate.GetData() + Swept, NumIndices - Swept);
+	FMemory::Memcpy(OutActorsToUpdate.GetData(), Merged.GetData(), NumIndices * sizeof(int32));
+}
+
+void FUDSimulationState::UpdateRotationsChunk(const int32& Begin, const int32& End, const float& Delta, FUDFrameIndices& OutActorsToUpdate)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_UpdateRotationsChunk");
+	if (UsesLOD())
+	{
+		UpdateRotationsKernel<true>(Begin, End, Delta, OutActorsToUpdate);
+	}
+	else
+	{
+		UpdateRotationsKernel<false>(Begin, End, Delta, OutActorsToUpdate);
+	}
+}
+
+template<bool bUseLOD>
+void FUDSimulationState::UpdateRotationsKernel(const int32& Begin, const int32& End, const float& Delta, FUDFrameIndices& OutActorsToUpdate)
+{
+	UD::ForEachActive<FUDRotation, const FUDMovementInput>(*this, Begin, End, [&](const int32 i, FUDRotation& Rotation, const FUDMovementInput& Input)
+	{
+		UD_ENTITY_SCOPE("SimState_UpdateRotation_Single");
+		const int32 Interval = bUseLOD ? GetStepInterval(LODs[i], i / UD_STREAM_WIDTH) : 1;
+		if (Interval == 0)
+		{
+			return;
+		}
+		const FRotator CachedRotation = Rotation.Value;
+
+		Rotation.Value.Yaw += Input.Rotation.Y * Rotation.RotationSpeed * Interval;
+
+		if (CachedRotation != Rotation.Value)
+		{
+			OutActorsToUpdate.Add(i);
+		}
+	});
+}
+
+uint64 FUDSimulationState::ComputeStateHash(TArray<uint64>& OutChunkHashes) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_ComputeStateHash");
+	const int32 NumEntities = Num();
+	const int32 NumChunks = FMath::DivideAndRoundUp(NumEntities, UD_HASH_CHUNK_SIZE);
+	OutChunkHashes.SetNumUninitialized(NumChunks, false);
+
+	// Fields are fed one by one, struct padding is never initialized and would differ between peers
+	FUDHeapCounter* HeapCounter = FUDHeapCounter::GetCurrent();
+	FUDHeapCounter::FScope TaskSystemScope(nullptr); // ParallelFor allocates its own task data
+	ParallelFor(NumChunks, [&](int32 ChunkIndex)
+	{
+		FUDHeapCounter::FScope HeapScope(HeapCounter);
+		UD::Core::FStateHasher Hasher(ChunkIndex);
+		const int32 End = FMath::Min((ChunkIndex + 1) * UD_HASH_CHUNK_SIZE, NumEntities);
+		for (int32 i = ChunkIndex * UD_HASH_CHUNK_SIZE; i < End; i++)
+		{
+			const FUDEntityHandle Handle = GetHandle(i);
+			Hasher.AddWord(((uint64)Handle.Generation << 32) | (uint32)Handle.Index);
+
+			const EUDArchetype Archetype = GetArchetype(i);
+			Hasher.AddWord((uint64)Archetype);
+
+			const FUDLocation& Location = Locations[i];
+			for (const FVector* Vector : { &Location.Value, &Location.Velocity })
+			{
+				Hasher.AddDouble(Vector->X);
+				Hasher.AddDouble(Vector->Y);
+				Hasher.AddDouble(Vector->Z);
+			}
+
+			const FUDRotation& Rotation = Rotations[i];
+			Hasher.AddDouble(Rotation.Value.Pitch);
+			Hasher.AddDouble(Rotation.Value.Yaw);
+			Hasher.AddDouble(Rotation.Value.Roll);
+			Hasher.AddFloat(Rotation.RotationSpeed);
+
+			Hasher.AddWord(Awake.IsValidIndex(i) && Awake[i]); // Sleeping entities skip the integration, so it changes the next steps
+
+			// Optional components, the archetype above tells which ones follow
+			if (Archetype != EUDArchetype::Static)
+			{
+				for (const FVector* Vector : { &Inputs[i].Movement, &Inputs[i].Rotation })
+				{
+					Hasher.AddDouble(Vector->X);
+					Hasher.AddDouble(Vector->Y);
+					Hasher.AddDouble(Vector->Z);
+				}
+
+				const FUDMovement& Movement = Movements[i];
+				Hasher.AddFloat(Movement.Acceleration);
+				Hasher.AddFloat(Movement.Deceleration);
+				Hasher.AddFloat(Movement.MaxSpeed);
+				Hasher.AddFloat(Movement.Gravity);
+			}
+			if (Archetype == EUDArchetype::Agent)
+			{
+				const FUDCollision& Collision = Collisions[i];
+				Hasher.AddFloat(Collision.Size);
+				Hasher.AddFloat(Collision.Height);
+			}
+		}
+		OutChunkHashes[ChunkIndex] = Hasher.Finish();
+	});
+
+	uint64 Hash = NumEntities;
+	for (const uint64& ChunkHash : OutChunkHashes)
+	{
+		Hash = UD::Core::CombineHashes(Hash, ChunkHash);
+	}
+	return Hash;
+}
+
+void FUDSimulationState::SeparateEntities()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_SeparateEntities");
+	const int32 NumEntities = GetArchetypeEnd(EUDArchetype::Agent); // Only agents collide, they lead the dense arrays
+	if (NumEntities < 2)
+	{
+		return;
+	}
+
+	float MaxSize = 0.f;
+	for (const FUDCollision& Collision : Collisions)
+	{
+		MaxSize = FMath::Max(MaxSize, Collision.Size);
+	}
+	if (MaxSize <= 0.f)
+	{
+		return;
+	}
+
+	// The streams already hold the positions as floats, the component positions are gathered first
+	if (UsesStreams())
+	{
+		SpatialHash.Build(TConstArrayView<float>(Streams.PositionX.GetData(), NumEntities), TConstArrayView<float>(Streams.PositionY.GetData(), NumEntities),
+			Config.SeparationCellSize > 0.f ? Config.SeparationCellSize : MaxSize * 2.f, Config);
+	}
+	else
+	{
+		SeparationX.SetNumUninitialized(NumEntities, false);
+		SeparationY.SetNumUninitialized(NumEntities, false);
+		UD::ParallelForChunks(NumEntities, Config, [&](int32 ChunkIndex, int32 Begin, int32 End)
+		{
+			for (int32 i = Begin; i < End; i++)
+			{
+				SeparationX[i] = (float)Locations[i].Value.X;
+				SeparationY[i] = (float)Locations[i].Value.Y;
+			}
+		});
+		SpatialHash.Build(SeparationX, SeparationY, Config.SeparationCellSize > 0.f ? Config.SeparationCellSize : MaxSize * 2.f, Config);
+	}
+
+	const float MaxPush = SpatialHash.GetCellSize() * 0.5f; // Pairs further apart than a cell are never found
+	const int32 NumChunks = UD::GetNumChunks(NumEntities, Config);
+	ChunkActorsToUpdate.SetNum(NumChunks, false);
+	UD::ParallelForChunks(NumEntities, Config, [&](int32 ChunkIndex, int32 Begin, int32 End)
+	{
+		ChunkActorsToUpdate[ChunkIndex].Reset(End - Begin);
+		SeparateEntitiesChunk(Begin, End, MaxPush, ChunkActorsToUpdate[ChunkIndex]);
+	});
+
+	// Sleeping entities pushed by a neighbour wake up, the location mask already holds every pushed entity
+	for (const FUDFrameIndices& Pushed : ChunkActorsToUpdate)
+	{
+		for (const int32& Index : Pushed)
+		{
+			if (!Awake[Index])
+			{
+				WakeEntity(Index);
+			}
+		}
+	}
+}
+
+void FUDSimulationState::SeparateEntitiesChunk(const int32& Begin, const int32& End, const float& MaxPush, FUDFrameIndices& OutPushed)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimState_SeparateEntitiesChunk");
+	const float Stiffness = Config.SeparationStiffness;
+	const bool bUseLOD = UsesLOD();
+
+	// Neighbours are read from the cell ordered copies in the hash, so writing the dense positions here is safe
+	FUDDirtyMaskChunkWriter LocationMask(DirtyMasks[(int32)EUDDirty::Location], Begin, End - 1);
+	for (int32 i = Begin; i < End; i++)
+	{
+		if (bUseLOD && LODs[i] == EUDSimulationLOD::Dormant)
+		{
+			continue; // Still in the hash so closer entities are pushed away from it
+		}
+
+		const float X = UsesStreams() ? Streams.PositionX[i] : SeparationX[i];
+		const float Y = UsesStreams() ? Streams.PositionY[i] : SeparationY[i];
+		float PushX = 0.f;
+		float PushY = 0.f;
+		if (!UD::Core::ComputeSeparation(SpatialHash, i, X, Y, [this](const int32 Index) { return Collisions[Index].Size; }, Stiffness, MaxPush, PushX, PushY))
+		{
+			continue;
+		}
+
+		Locations[i].Value.X += PushX;
+		Locations[i].Value.Y += PushY;
+		if (UsesStreams())
+		{
+			Streams.PositionX[i] += PushX;
+			Streams.PositionY[i] += PushY;
+		}
+
+		LocationMask.Set(i);
+		OutPushed.Add(i);
+	}
+}
+
+bool FUDSimulationState::ResolveGround(const int32& Index, FVector& InOutLocation, FVector& InOutVelocity, const bool& bAllowTrace) const
+{
+	const UUDGroundField* GroundField = Config.GroundField.Get();
+	if (!GroundField)
+	{
+		return false;
+	}
+
+	float GroundHeight = 0.f;
+	FVector3f GroundNormal = FVector3f::UpVector;
+	const EUDGroundSample Sample = GroundField->Sample((float)InOutLocation.X, (float)InOutLocation.Y, GroundHeight, GroundNormal);
+	if (Sample != EUDGroundSample::Valid)
+	{
+		if (!bAllowTrace || !Config.bGroundTraceFallback || !TraceGround(Index, InOutLocation, GroundHeight, GroundNormal))
+		{
+			return false;
+		}
+	}
+
+	const FUDCollision& Collision = Collisions[Index];
+	const float StandingHeight = GroundHeight + Collision.Height;
+	if (InOutLocation.Z > StandingHeight + Collision.AcceptableDistance || InOutVelocity.Z > 0.)
+	{
+		return false; // Airborne, gravity keeps acting
+	}
+
+	// Snap to the ground and keep the velocity along it, steep ground cannot be climbed and makes the entity slide down
+	const FVector Normal = FVector(GroundNormal);
+	InOutLocation.Z = StandingHeight;
+	InOutVelocity = FVector::VectorPlaneProject(InOutVelocity, Normal);
+	if (Normal.Z < FMath::Cos(FMath::DegreesToRadians(Collision.AcceptableSlope)) && InOutVelocity.Z > 0.)
+	{
+		const FVector SlopeUp = FVector::VectorPlaneProject(FVector::UpVector, Normal).GetSafeNormal();
+		InOutVelocity -= SlopeUp * FVector::DotProduct(InOutVelocity, SlopeUp);
+	}
+	return true;
+}
+
+bool FUDSimulationState::TraceGround(const int32& Index, const FVector& Location, float& OutHeight, FVector3f& OutNormal) const
+{
+	UD_ENTITY_SCOPE("SimState_TraceGround");
+	if (!CanQueryWorld())
+	{
+		return false;
+	}
+
+	FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(UDSimulationGround), false);
+	if (Actors[Index])
+	{
+		QueryParams.AddIgnoredActor(Actors[Index].Ptr);
+	}
+
+	// Only looks for ground the entity could snap to, anything further below is air
+	const FUDCollision& Collision = Collisions[Index];
+	const FVector Start = Location + FVector(0., 0., Collision.Height);
+	const FVector End = Location - FVector(0., 0., Collision.Height + Collision.AcceptableDistance);
+	FHitResult Hit = {};
+	if (!World->LineTraceSingleByChannel(Hit, Start, End, ECC_WorldStatic, QueryParams))
+	{
+		return false;
+	}
+
+	OutHeight = (float)Hit.ImpactPoint.Z;
+	OutNormal = FVector3f(Hit.ImpactNormal);
+	return true;
+}
+
+FUDSimulation::FUDSimulation(UWorld* InWorld, const FUDSimulationConfig& InConfig)
+	: FUDSimulation()
+{
+	State.Config = InConfig;
+	State.World = InWorld;
+	Replication.Initialize(InConfig);
+	UD::AddBuiltinSystems(Scheduler);
+	if (InWorld)
+	{
+		World = InWorld;
+		bIsRunning = true;
+		CurrentThread = FRunnableThread::Create(this, TEXT("Unreal DOD Simulation"));
+	}
+}
+
+FUDSimulation::~FUDSimulation()
+{
+	for (const TUniquePtr<FUDPendingRegistration>& Registration : PendingRegistrations)
+	{
+		Registration->Task.Wait(); // The worker writes into the state
+	}
+
+	if (CurrentThread)
+	{
+		CurrentThread->Kill();
+		delete CurrentThread;
+	}
+}
+bool FUDSimulation::Init()
+{
+	return true;
+}
+
+uint32 FUDSimulation::Run()
+{
+	if (!World)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("Cannot run simulation with an invalid world, please set world"));
+	}
+
+	double StepSeconds = State.Config.GetStepSeconds();
+	double Accumulator = 0.;
+	double PreviousTime = FPlatformTime::Seconds();
+	double Deadline = PreviousTime + StepSeconds;
+	double WaitStartTime = PreviousTime;
+	while (bIsRunning)
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_MainLoop");
+		check(World);
+
+		// Read on every wake so a new step rate or sub step limit applies from the next step, the accumulated time carries over
+		{
+			FScopeLock SteppingLock(&SteppingMutex);
+			if (bSteppingChanged)
+			{
+				FScopeLock ScopeLock(&State.Mutex);
+				State.Config.StepRate = PendingStepRate;
+				State.Config.MaxSubSteps = PendingMaxSubSteps;
+				bSteppingChanged = false;
+			}
+		}
+		StepSeconds = State.Config.GetStepSeconds();
+		const double MaxAccumulated = StepSeconds * FMath::Max(State.Config.MaxSubSteps, 1);
+
+		// Bulk registrations are populated on a worker, the clock only starts once they are in
+		if (NumPendingRegistrations.load(std::memory_order_acquire) > 0)
+		{
+			FPlatformProcess::SleepNoStats(0.001f);
+			PreviousTime = FPlatformTime::Seconds();
+			Deadline = PreviousTime + StepSeconds;
+			WaitStartTime = PreviousTime;
+			continue;
+		}
+
+		const double CurrentTime = FPlatformTime::Seconds();
+		SimulationStats.WaitErrorSeconds = FMath::Max(CurrentTime - Deadline, 0.);
+		SimulationStats.SleepSeconds += CurrentTime - WaitStartTime;
+		SimulationStats.NumWakes++;
+		Accumulator += CurrentTime - PreviousTime;
+		PreviousTime = CurrentTime;
+
+		// A hitch never turns into a huge step, at most MaxSubSteps fixed steps are run per wake. The rest of the time is dropped, unless peers
+		// in lockstep need every step: then the next wakes are due at once and catch up.
+		const bool bDeterministic = State.Config.bDeterministic;
+		if (Accumulator > MaxAccumulated && !bDeterministic)
+		{
+			SimulationStats.NumDroppedSteps += (uint64)((Accumulator - MaxAccumulated) / StepSeconds);
+			Accumulator = MaxAccumulated;
+		}
+
+		if (Accumulator >= StepSeconds)
+		{
+			FScopeLock ScopeLock(&State.Mutex);
+			FUDHeapCounter::FScope HeapScope(&State.HeapCounter); // The steps and the publish, flat once the simulation is steady
+			State.ClearDirty();
+			for (int32 SubStep = 0; Accumulator >= StepSeconds && SubStep < State.Config.MaxSubSteps && bIsRunning; SubStep++)
+			{
+				const double StepStartTime = FPlatformTime::Seconds();
+				StepSimulation((float)StepSeconds);
+				Accumulator -= StepSeconds;
+
+				const double StepDuration = FPlatformTime::Seconds() - StepStartTime;
+				SimulationStats.NumSteps++;
+				NextStep.store(SimulationStats.NumSteps, std::memory_order_release);
+				SimulationStats.NumOverruns += StepDuration > StepSeconds ? 1 : 0;
+				SimulationStats.OverrunSeconds += FMath::Max(StepDuration - StepSeconds, 0.);
+				SimulationStats.LastStepSeconds = StepDuration;
+				SimulationStats.MaxStepSeconds = FMath::Max(SimulationStats.MaxStepSeconds, StepDuration);
+				SimulationStats.AverageStepSeconds = SimulationStats.NumSteps == 1 ? StepDuration : FMath::Lerp(SimulationStats.AverageStepSeconds, StepDuration, 0.05);
+				SimulationStats.NumStepHeapAllocations = State.HeapCounter.GetNumAllocations();
+				SimulationStats.ScratchPeakBytes = State.FrameArena.GetPeakBytes();
+				SimulationStats.StepCounters = State.StepCounters;
+				StepTimes.Add(StepDuration);
+			}
+			PublishSnapshot(CurrentTime - Accumulator); // When the last step was due, so snapshots stay one step apart
+		}
+
+		Deadline = PreviousTime + (StepSeconds - Accumulator); // Already past when the steps themselves overran
+		WaitStartTime = FPlatformTime::Seconds();
+		WaitUntil(Deadline);
+	}
+
+	return 0;
+}
+
+void FUDSimulation::StepSimulation(const float& Delta)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_Step");
+	const uint64 Step = SimulationStats.NumSteps;
+	ApplyEntityChanges(); // First, the corrections and inputs of this step may target the new entities
+	{
+		FScopeLock ViewersLock(&ViewersMutex);
+		if (bViewersChanged)
+		{
+			State.Viewers = PendingViewers;
+			bViewersChanged = false;
+		}
+	}
+	{
+		FScopeLock CorrectionsLock(&CorrectionsMutex);
+		Swap(PendingCorrections, StepCorrections);
+	}
+	if (StepCorrections.Num() > 0)
+	{
+		State.ApplyCorrections(StepCorrections); // Wakes the corrected entities before BeginStep builds the active lists
+		StepCorrections.Reset();
+	}
+	ApplyStepInputs(Step); // Before BeginStep too, for the entities they wake
+	State.BeginStep();
+	Scheduler.Run(State, Delta, State.Config.bParallelSystems); // The systems mark the change masks, nothing to merge here
+
+	if (State.Config.bDeterministic)
+	{
+		FUDStepHash& StepHash = PendingStepHashes.AddDefaulted_GetRef();
+		StepHash.Step = Step;
+		StepHash.Hash = State.ComputeStateHash(PendingChunkHashes);
+	}
+}
+
+void FUDSimulation::ApplyEntityChanges()
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_ApplyEntityChanges");
+	{
+		FScopeLock ChangesLock(&ChangesMutex);
+		Swap(PendingChanges, StepChanges);
+	}
+
+	for (const FUDEntityChange& Change : StepChanges)
+	{
+		switch (Change.Type)
+		{
+		case EUDEntityChange::Register:
+			State.RegisterEntity(Change.Entity); // Moving entities start awake
+			break;
+		case EUDEntityChange::Bind:
+			State.BindActor(Change.Entity.Handle, Change.Entity.Actor);
+			break;
+		case EUDEntityChange::Unregister:
+			State.UnregisterActor(Change.Entity.Handle);
+			break;
+		}
+	}
+	StepChanges.Reset();
+}
+
+void FUDSimulation::ApplyStepInputs(const uint64& Step)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_ApplyInputs");
+	{
+		FScopeLock InputsLock(&InputsMutex);
+		if (PendingInputs.Num() > 0)
+		{
+			StepInputs.Append(PendingInputs);
+			PendingInputs.Reset();
+			Algo::StableSortBy(StepInputs, &FUDStepInput::Step); // Inputs of one step keep the order they were queued in
+		}
+	}
+
+	int32 NumApplied = 0;
+	for (; NumApplied < StepInputs.Num() && StepInputs[NumApplied].Step <= Step; NumApplied++)
+	{
+		const FUDStepInput& StepInput = StepInputs[NumApplied];
+		SimulationStats.NumLateInputs += StepInput.Step > 0 && StepInput.Step < Step ? 1 : 0;
+		if (StepInput.bImpulse)
+		{
+			State.AddImpulse(StepInput.Handle, StepInput.Impulse);
+		}
+		else
+		{
+			State.SetMovementInput(StepInput.Handle, StepInput.Input);
+		}
+	}
+	StepInputs.RemoveAt(0, NumApplied, false);
+}
+
+void FUDSimulation::WaitUntil(const double& Deadline) const
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_Wait");
+	const double YieldMargin = State.Config.YieldMargin;
+	const double SpinMargin = State.Config.SpinMargin;
+
+	// Sleeping is only precise to the scheduler quantum, so the end of the wait yields and then spins on the high resolution clock
+	for (double Remaining = Deadline - FPlatformTime::Seconds(); Remaining > 0. && bIsRunning; Remaining = Deadline - FPlatformTime::Seconds())
+	{
+		if (Remaining > YieldMargin)
+		{
+			FPlatformProcess::SleepNoStats((float)(Remaining - YieldMargin));
+		}
+		else if (Remaining > SpinMargin)
+		{
+			FPlatformProcess::YieldThread();
+		}
+		else
+		{
+			FPlatformProcess::Yield(); // Pause instruction, the thread keeps its core
+		}
+	}
+}
+
+void FUDSimulation::Stop()
+{
+	bIsRunning = false;
+}
+
+void FUDSimulation::Tick_GameThread(const float& Delta)
+{
+	check(IsInGameThread());
+	UD::GeneralQueue.ExecuteCommands();
+	FinishRegistrations();
+
+	const bool bInterpolate = State.Config.bInterpolate;
+	if (Snapshots.Consume())
+	{
+		Stats = Snapshots.GetReadBuffer().Stats;
+		StepHashes = Snapshots.GetReadBuffer().StepHashes;
+		ChunkHashes = Snapshots.GetReadBuffer().ChunkHashes;
+		if (bInterpolate)
+		{
+			ReceiveSnapshot(Snapshots.GetReadBuffer());
+		}
+		else
+		{
+			ApplySnapshot(Snapshots.GetReadBuffer());
+		}
+	}
+
+	if (bInterpolate)
+	{
+		ApplyInterpolation(FPlatformTime::Seconds());
+	}
+	InstancePresenter.Flush();
+	UD::ReportStats(Stats);
+}
+
+void FUDSimulation::PublishSnapshot(const double& Time)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_PublishSnapshot");
+	FUDSimulationSnapshot& Snapshot = Snapshots.GetWriteBuffer();
+	const int32 NumEntities = State.Num();
+
+	Snapshot.Handles.SetNumUninitialized(NumEntities, false);
+	Snapshot.Locations.SetNumUninitialized(NumEntities, false);
+	Snapshot.Rotations.SetNumUninitialized(NumEntities, false);
+	Snapshot.Velocities.SetNumUninitialized(NumEntities, false);
+	for (int32 i = 0; i < NumEntities; i++)
+	{
+		Snapshot.Handles[i] = State.GetHandle(i);
+		Snapshot.Locations[i] = State.Locations[i].Value;
+		Snapshot.Rotations[i] = State.Rotations[i].Value;
+		Snapshot.Velocities[i] = State.Locations[i].Velocity;
+	}
+
+	// The masks of the steps are merged a word at a time, whatever the game thread missed in a skipped snapshot is carried into this one
+	PublishMask.Init(NumEntities);
+	for (int32 Component = 0; Component < (int32)EUDDirty::Num; Component++)
+	{
+		Snapshot.DirtyMasks[Component].CopyFrom(State.DirtyMasks[Component]);
+		for (const FUDEntityHandle& Handle : CarriedDirtyHandles)
+		{
+			const int32 Index = State.GetDenseIndex(Handle);
+			if (Index != INDEX_NONE)
+			{
+				Snapshot.DirtyMasks[Component].Set(Index);
+			}
+		}
+		PublishMask.Or(Snapshot.DirtyMasks[Component]);
+	}
+	Snapshot.DirtyIndices.Reset(PublishMask.CountSetBits());
+	PublishMask.ForEachSetBit([&Snapshot](const int32 Index) { Snapshot.DirtyIndices.Add(Index); });
+	Snapshot.NumSlots = State.SparseToDense.Num();
+	Snapshot.Frame = SimulationFrame++;
+	Snapshot.Time = Time;
+	SimulationStats.NumDirty = Snapshot.DirtyIndices.Num();
+	SimulationStats.NumCommandsEnqueued = UD::GeneralQueue.GetNumEnqueued();
+	SimulationStats.NumCommandsDropped = UD::GeneralQueue.GetNumOverflows();
+	StepTimes.GetPercentiles(SimulationStats.StepSecondsP50, SimulationStats.StepSecondsP95, SimulationStats.StepSecondsP99);
+	Snapshot.Stats = SimulationStats;
+	SimulationStats.SleepSeconds = 0.;
+	Snapshot.StepHashes.Reset(); // Appended rather than assigned so every buffer keeps its allocation
+	Snapshot.StepHashes.Append(PendingStepHashes);
+	Snapshot.ChunkHashes.Reset();
+	Snapshot.ChunkHashes.Append(PendingChunkHashes);
+
+	CarriedDirtyHandles.Reset();
+	PendingStepHashes.Reset();
+	if (Snapshots.Publish())
+	{
+		// The write buffer is now the snapshot that was never read, keep its dirty entities and step hashes for the next one
+		const FUDSimulationSnapshot& Skipped = Snapshots.GetWriteBuffer();
+		for (const int32& Index : Skipped.DirtyIndices)
+		{
+			CarriedDirtyHandles.Add(Skipped.Handles[Index]);
+		}
+		PendingStepHashes.Append(Skipped.StepHashes);
+		SimulationStats.NumSkippedSnapshots++;
+	}
+}
+
+void FUDSimulation::ApplySnapshot(const FUDSimulationSnapshot& Snapshot)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_ApplySnapshot");
+	for (const int32& Index : Snapshot.DirtyIndices)
+	{
+		SetEntityTransform(Snapshot.Handles[Index], Snapshot.Locations[Index], Snapshot.Rotations[Index]);
+	}
+}
+
+void FUDSimulation::ReceiveSnapshot(const FUDSimulationSnapshot& Snapshot)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_ReceiveSnapshot");
+	FUDPresentationState& P = Presentation;
+
+	// Entities that stopped moving are left exactly on their last target
+	for (const FUDEntityHandle& Handle : P.MovingHandles)
+	{
+		if (P.Handles[Handle.Index] == Handle)
+		{
+			P.FromLocations[Handle.Index] = P.ToLocations[Handle.Index];
+			P.FromRotations[Handle.Index] = P.ToRotations[Handle.Index];
+			SetEntityTransform(Handle, P.ToLocations[Handle.Index], P.ToRotations[Handle.Index]);
+		}
+	}
+	P.MovingHandles.Reset(Snapshot.DirtyIndices.Num());
+
+	const int32 NumSlots = Snapshot.NumSlots;
+	if (P.Handles.Num() < NumSlots)
+	{
+		P.Handles.SetNum(NumSlots);
+		P.FromLocations.SetNum(NumSlots);
+		P.ToLocations.SetNum(NumSlots);
+		P.Velocities.SetNum(NumSlots);
+		P.FromRotations.SetNum(NumSlots);
+		P.ToRotations.SetNum(NumSlots);
+	}
+
+	for (const int32& Index : Snapshot.DirtyIndices)
+	{
+		const FUDEntityHandle& Handle = Snapshot.Handles[Index];
+		const bool bKnownEntity = P.Handles[Handle.Index] == Handle;
+		P.Handles[Handle.Index] = Handle;
+		P.FromLocations[Handle.Index] = bKnownEntity ? P.ToLocations[Handle.Index] : Snapshot.Locations[Index];
+		P.FromRotations[Handle.Index] = bKnownEntity ? P.ToRotations[Handle.Index] : Snapshot.Rotations[Index];
+		P.ToLocations[Handle.Index] = Snapshot.Locations[Index];
+		P.ToRotations[Handle.Index] = Snapshot.Rotations[Index];
+		P.Velocities[Handle.Index] = Snapshot.Velocities[Index];
+		P.MovingHandles.Add(Handle);
+	}
+
+	const double FallbackStep = State.Config.GetStepSeconds();
+	P.StepSeconds = P.SnapshotTime > 0. ? FMath::Clamp(Snapshot.Time - P.SnapshotTime, UE_KINDA_SMALL_NUMBER, FallbackStep * 4.) : FallbackStep;
+	P.SnapshotTime = Snapshot.Time;
+}
+
+void FUDSimulation::ApplyInterpolation(const double& Time)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_ApplyInterpolation");
+	FUDPresentationState& P = Presentation;
+	if (P.MovingHandles.Num() == 0)
+	{
+		return;
+	}
+
+	// Presentation runs one step behind the simulation, alpha goes from the previous snapshot (0) to the latest one (1)
+	P.Alpha = P.StepSeconds > 0. ? (float)((Time - P.SnapshotTime) / P.StepSeconds) : 1.f;
+	const float MaxAlpha = State.Config.bExtrapolate ? 1.f + FMath::Max(State.Config.MaxExtrapolation, 0.f) : 1.f;
+	P.Alpha = FMath::Clamp(P.Alpha, 0.f, MaxAlpha);
+
+	const float InterpolationAlpha = FMath::Min(P.Alpha, 1.f);
+	const double ExtrapolationSeconds = (P.Alpha - InterpolationAlpha) * P.StepSeconds;
+	for (const FUDEntityHandle& Handle : P.MovingHandles)
+	{
+		const int32 Slot = Handle.Index;
+		const FVector Location = FMath::Lerp(P.FromLocations[Slot], P.ToLocations[Slot], InterpolationAlpha) + P.Velocities[Slot] * ExtrapolationSeconds;
+		const FRotator Rotation = FMath::Lerp(P.FromRotations[Slot], P.ToRotations[Slot], InterpolationAlpha);
+		SetEntityTransform(Handle, Location, Rotation);
+	}
+}
+
+void FUDSimulation::SetEntityTransform(const FUDEntityHandle& Handle, const FVector& Location, const FRotator& Rotation)
+{
+	const bool bActor = Presentation.ActorHandles.IsValidIndex(Handle.Index) && Presentation.ActorHandles[Handle.Index] == Handle;
+	if (!bActor)
+	{
+		InstancePresenter.SetTransform(Handle, Location, Rotation); // Skips the entities removed since
+		return;
+	}
+
+	// Teleport without sweep, overlaps or physics, the simulation already resolved the movement
+	USceneComponent* RootComponent = Presentation.Actors[Handle.Index]->GetRootComponent();
+	if (RootComponent)
+	{
+		RootComponent->SetWorldLocationAndRotationNoPhysics(Location, Rotation);
+	}
+}
+
+void FUDSimulation::SetPresentedActor(const FUDEntityHandle& Handle, AActor* Actor)
+{
+	if (Presentation.Actors.Num() <= Handle.Index)
+	{
+		Presentation.ActorHandles.SetNum(Handle.Index + 1);
+		Presentation.Actors.SetNumZeroed(Handle.Index + 1);
+	}
+	Presentation.ActorHandles[Handle.Index] = Actor ? Handle : FUDEntityHandle();
+	Presentation.Actors[Handle.Index] = Actor;
+}
+
+void FUDSimulation::QueueEntityChange(const EUDEntityChange& Type, const FUDEntityDesc& Entity)
+{
+	FScopeLock ChangesLock(&ChangesMutex);
+	FUDEntityChange& Change = PendingChanges.AddDefaulted_GetRef();
+	Change.Type = Type;
+	Change.Entity = Entity;
+}
+
+FUDEntityHandle FUDSimulation::RegisterActor(AActor* Actor, const EUDArchetype& Archetype)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_RegisterActor");
+	check(IsInGameThread());
+	check(Actor);
+	if (const FUDEntityHandle* ExistingHandle = ActorHandles.Find(Actor))
+	{
+		return *ExistingHandle;
+	}
+
+	if (!Actor->ActorHasTag(UD_DOD_TAG))
+	{
+		Actor->Tags.Add(UD_DOD_TAG);
+	}
+
+	FUDEntityDesc Entity = {};
+	Entity.Actor = Actor;
+	Entity.Transform = Actor->GetActorTransform(); // Read here, the simulation thread never touches the actors
+	Entity.Archetype = Archetype;
+	Entity.Handle = State.HandleAllocator.Allocate();
+	ActorHandles.Add(Actor, Entity.Handle);
+	SetPresentedActor(Entity.Handle, Actor);
+	QueueEntityChange(EUDEntityChange::Register, Entity);
+	return Entity.Handle;
+}
+
+void FUDSimulation::UnregisterActor(const FUDEntityHandle& Handle)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_UnregisterActor");
+	check(IsInGameThread());
+	if (Presentation.ActorHandles.IsValidIndex(Handle.Index) && Presentation.ActorHandles[Handle.Index] == Handle)
+	{
+		ActorHandles.Remove(Presentation.Actors[Handle.Index]);
+		SetPresentedActor(Handle, nullptr);
+	}
+	InstancePresenter.RemoveInstance(Handle);
+
+	FUDEntityDesc Entity = {};
+	Entity.Handle = Handle;
+	QueueEntityChange(EUDEntityChange::Unregister, Entity); // Stale handles are reported by the step
+}
+
+void FUDSimulation::SetViewers(const TArray<FVector>& InViewers)
+{
+	FScopeLock ViewersLock(&ViewersMutex);
+	PendingViewers = InViewers;
+	bViewersChanged = true;
+}
+
+void FUDSimulation::ApplyCorrections(const FUDCorrectionList& InCorrections)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_QueueCorrections");
+	FScopeLock CorrectionsLock(&CorrectionsMutex);
+	PendingCorrections.Indices.Append(InCorrections.Indices);
+	PendingCorrections.Handles.Append(InCorrections.Handles);
+	PendingCorrections.Locations.Append(InCorrections.Locations);
+	PendingCorrections.Rotations.Append(InCorrections.Rotations);
+	PendingCorrections.Velocities.Append(InCorrections.Velocities);
+}
+
+void FUDSimulation::SetMovementInput(const FUDEntityHandle& Handle, const FUDMovementInput& Input, const uint64& Step)
+{
+	FUDStepInput StepInput = {};
+	StepInput.Step = Step;
+	StepInput.Handle = Handle;
+	StepInput.Input = Input;
+	QueueInput(StepInput);
+}
+
+void FUDSimulation::AddImpulse(const FUDEntityHandle& Handle, const FVector& Impulse, const uint64& Step)
+{
+	FUDStepInput StepInput = {};
+	StepInput.Step = Step;
+	StepInput.Handle = Handle;
+	StepInput.Impulse = Impulse;
+	StepInput.bImpulse = true;
+	QueueInput(StepInput);
+}
+
+void FUDSimulation::QueueInput(const FUDStepInput& Input)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_QueueInput");
+	FScopeLock InputsLock(&InputsMutex);
+	PendingInputs.Add(Input);
+}
+
+void FUDSimulation::SetStepping(const float& StepRate, const int32& MaxSubSteps)
+{
+	FScopeLock SteppingLock(&SteppingMutex);
+	PendingStepRate = FMath::Max(StepRate, 1.f);
+	PendingMaxSubSteps = FMath::Max(MaxSubSteps, 1);
+	bSteppingChanged = true;
+}
+
+void FUDSimulation::InitializePresentation(AActor* Owner)
+{
+	InstancePresenter.Initialize(Owner);
+}
+
+FUDEntityHandle FUDSimulation::RegisterInstance(UStaticMesh* Mesh, const FTransform& Transform, const EUDArchetype& Archetype)
+{
+	check(IsInGameThread());
+	FUDEntityDesc Entity = {};
+	Entity.Mesh = Mesh;
+	Entity.Transform = Transform;
+	Entity.Archetype = Archetype;
+	Entity.Handle = State.HandleAllocator.Allocate();
+	QueueEntityChange(EUDEntityChange::Register, Entity);
+	InstancePresenter.AddInstance(Entity.Handle, Mesh, Transform);
+	return Entity.Handle;
+}
+
+void FUDSimulation::RegisterEntitiesAsync(TArray<FUDEntityDesc>&& Entities, TFunction<void(const TArray<FUDEntityHandle>& Handles)> OnRegistered)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_RegisterEntitiesAsync");
+	check(IsInGameThread());
+	TUniquePtr<FUDPendingRegistration> Registration = MakeUnique<FUDPendingRegistration>();
+	Registration->Entities.Reserve(Entities.Num());
+	Registration->Handles.SetNum(Entities.Num());
+	for (int32 n = 0; n < Entities.Num(); n++)
+	{
+		FUDEntityDesc& Entity = Entities[n];
+		if (Entity.Actor)
+		{
+			if (const FUDEntityHandle* ExistingHandle = ActorHandles.Find(Entity.Actor))
+			{
+				Registration->Handles[n] = *ExistingHandle; // Registered or queued before, or earlier in the batch
+				continue;
+			}
+			if (!Entity.Actor->ActorHasTag(UD_DOD_TAG))
+			{
+				Entity.Actor->Tags.Add(UD_DOD_TAG); // Actors are only touched on the game thread
+			}
+		}
+
+		Entity.Handle = State.HandleAllocator.Allocate();
+		Registration->Handles[n] = Entity.Handle;
+		if (Entity.Actor)
+		{
+			ActorHandles.Add(Entity.Actor, Entity.Handle);
+			SetPresentedActor(Entity.Handle, Entity.Actor);
+		}
+		Registration->Entities.Add(Entity);
+	}
+	Registration->OnRegistered = MoveTemp(OnRegistered);
+	FUDPendingRegistration* RegistrationPtr = Registration.Get(); // Owned by PendingRegistrations until the game thread finishes it
+	NumPendingRegistrations.fetch_add(1, std::memory_order_acq_rel);
+	Registration->Task = UE::Tasks::Launch(TEXT("UDRegisterEntities"), [this, RegistrationPtr]()
+	{
+		TArray<FUDEntityHandle> Handles = {}; // The reserved ones
+		State.RegisterEntities(RegistrationPtr->Entities, Handles);
+	});
+	PendingRegistrations.Add(MoveTemp(Registration));
+}
+
+void FUDSimulation::FinishRegistrations()
+{
+	// In the order they were requested, a later batch waits for the earlier ones
+	while (PendingRegistrations.Num() > 0 && PendingRegistrations[0]->Task.IsCompleted())
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_FinishRegistration");
+		const TUniquePtr<FUDPendingRegistration> Registration = MoveTemp(PendingRegistrations[0]);
+		PendingRegistrations.RemoveAt(0);
+		for (const FUDEntityDesc& Entity : Registration->Entities)
+		{
+			if (!Entity.Actor && Entity.Mesh)
+			{
+				InstancePresenter.AddInstance(Entity.Handle, Entity.Mesh, Entity.Transform);
+			}
+		}
+		if (Registration->OnRegistered)
+		{
+			Registration->OnRegistered(Registration->Handles);
+		}
+		NumPendingRegistrations.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
+
+AActor* FUDSimulation::MaterializeActor(const FUDEntityHandle& Handle, TSubclassOf<AActor> ActorClass)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_MaterializeActor");
+	check(IsInGameThread());
+	if (!World || !ActorClass || !InstancePresenter.HasInstance(Handle))
+	{
+		return nullptr;
+	}
+
+	FActorSpawnParameters SpawnParameters = {};
+	SpawnParameters.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	AActor* Actor = World->SpawnActor<AActor>(ActorClass, InstancePresenter.GetTransform(Handle), SpawnParameters);
+	if (!Actor)
+	{
+		return nullptr;
+	}
+
+	// The instance proves the entity is alive and actorless as far as the game thread knows, the step binds it
+	Actor->Tags.Add(UD_DOD_TAG);
+	ActorHandles.Add(Actor, Handle);
+	SetPresentedActor(Handle, Actor);
+	InstancePresenter.RemoveInstance(Handle);
+
+	FUDEntityDesc Entity = {};
+	Entity.Actor = Actor;
+	Entity.Handle = Handle;
+	QueueEntityChange(EUDEntityChange::Bind, Entity);
+	return Actor;
+}
+
+uint32 FUDSimulation::WriteReplicationPacket(const int32& ConnectionId, const FVector& ViewerLocation, TArray<uint8>& OutPacket)
+{
+	return Replication.WritePacket(ConnectionId, Snapshots.GetReadBuffer(), ViewerLocation, OutPacket);
+}
+
+void FUDSimulation::ReplicateIndex(const int32& Index, const bool& bSkipSource)
+{
+	const FUDSimulationSnapshot& Snapshot = Snapshots.GetReadBuffer();
+	if (ensureMsgf(Snapshot.Handles.IsValidIndex(Index), TEXT("ReplicateIndex %d is not in the last snapshot"), Index))
+	{
+		Replication.ForceEntity(Snapshot.Handles[Index].Index, bSkipSource);
+	}
+}
+
+TArray<int32> FUDSimulation::GetDifferences(const FUDSimulationState& ClientState, const float& ErrorTolerence)
+{
+	GetDifferences(ClientState, ErrorTolerence, Corrections);
+	return Corrections.Indices;
+}
+
+void FUDSimulation::GetDifferences(const FUDSimulationState& ClientState, const float& ErrorTolerence, FUDCorrectionList& OutCorrections)
+{
+	check(IsInGameThread());
+	UD::FindDifferences(Snapshots.GetReadBuffer(), ClientState, ErrorTolerence, State.Config.CorrectionRotationTolerance, State.Config, OutCorrections);
+}
+
+void FUDCorrectionList::Reset()
+{
+	Indices.Reset();
+	Handles.Reset();
+	Locations.Reset();
+	Rotations.Reset();
+	Velocities.Reset();
+}
+
+bool UD::EnqueueCommandToGameThread(FUDSimulationQueue& Queue, const int64 FrameDelay, TFunction<void(void)> LambdaToAdd)
+{
+	FUDSimulationCommand Command = {};
+	Command.Lambda = MoveTemp(LambdaToAdd);
+	Command.EnqueuedFrame = UKismetSystemLibrary::GetFrameCount();
+	Command.FrameDelay = FrameDelay;
+	return Queue.Enqueue(MoveTemp(Command));
+}
+
+bool UD::EnqueueGeneralCommandToGameThread(TFunction<void(void)> LambdaToAdd)
+{
+	return EnqueueCommandToGameThread(UD::GeneralQueue, 0, MoveTemp(LambdaToAdd));
+}
+
+int32 UD::GetChunkSize(const FUDSimulationConfig& Config)
+{
+	return Align(FMath::Max(Config.ChunkSize, 1), UD_STREAM_WIDTH);
+}
+
+int32 UD::GetNumChunks(const int32 Num, const FUDSimulationConfig& Config)
+{
+	return FMath::DivideAndRoundUp(Num, GetChunkSize(Config));
+}
+
+void UD::ParallelForChunks(const int32 Num, const FUDSimulationConfig& Config, TFunctionRef<void(int32 ChunkIndex, int32 Begin, int32 End)> ChunkFunction)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_ParallelForChunks");
+	const int32 ChunkSize = GetChunkSize(Config);
+	const int32 NumChunks = GetNumChunks(Num, Config);
+	if (NumChunks <= 0)
+	{
+		return;
+	}
+
+	// Each task owns a contiguous run of chunks so neighbouring entities stay on the same core
+	const int32 MaxTasks = Config.WorkerCount > 0 ? Config.WorkerCount : FTaskGraphInterface::Get().GetNumWorkerThreads() + 1;
+	const int32 NumTasks = FMath::Clamp(MaxTasks, 1, NumChunks);
+	FUDFrameArena* FrameArena = FUDFrameArena::GetCurrent();
+	FUDHeapCounter* HeapCounter = FUDHeapCounter::GetCurrent();
+	FUDHeapCounter::FScope TaskSystemScope(nullptr); // ParallelFor allocates its own task data
+	ParallelFor(NumTasks, [&](int32 TaskIndex)
+	{
+		FUDFrameArena::FScope ArenaScope(FrameArena);
+		FUDHeapCounter::FScope HeapScope(HeapCounter);
+		const int32 FirstChunk = (int64)NumChunks * TaskIndex / NumTasks;
+		const int32 LastChunk = (int64)NumChunks * (TaskIndex + 1) / NumTasks;
+		for (int32 ChunkIndex = FirstChunk; ChunkIndex < LastChunk; ChunkIndex++)
+		{
+			const int32 Begin = ChunkIndex * ChunkSize;
+			ChunkFunction(ChunkIndex, Begin, FMath::Min(Begin + ChunkSize, Num));
+		}
+	}, NumTasks == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+}
+
+void UD::MergeChunkIndices(const TArray<TArray<int32>>& ChunkIndices, TArray<int32>& OutIndices)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_MergeChunkIndices");
+	int32 NumIndices = 0;
+	for (const TArray<int32>& Indices : ChunkIndices)
+	{
+		NumIndices += Indices.Num();
+	}
+
+	OutIndices.Reset(NumIndices);
+	for (const TArray<int32>& Indices : ChunkIndices)
+	{
+		OutIndices.Append(Indices);
+	}
+}
+
+void UD::AddBuiltinSystems(FUDScheduler& Scheduler)
+{
+	// Rotations share no written component with locations, so the two run side by side between the LOD update and the corrections
+	FUDSystem LODSystem = {};
+	LODSystem.Name = TEXT("UD.LOD");
+	LODSystem.Reads = EUDComponents::Locations;
+	LODSystem.Writes = EUDComponents::LODs;
+	LODSystem.Execute = [](FUDSimulationState& State, const float& Delta) { State.UpdateLODs(); };
+	Scheduler.AddSystem(LODSystem);
+
+	FUDSystem LocationSystem = {};
+	LocationSystem.Name = TEXT("UD.Locations");
+	LocationSystem.Reads = EUDComponents::Movements | EUDComponents::Inputs | EUDComponents::Collisions | EUDComponents::LODs | EUDComponents::World;
+	LocationSystem.Writes = EUDComponents::Locations | EUDComponents::Activity;
+	LocationSystem.Execute = [](FUDSimulationState& State, const float& Delta) { State.UpdateLocations(Delta); };
+	Scheduler.AddSystem(LocationSystem);
+
+	FUDSystem RotationSystem = {};
+	RotationSystem.Name = TEXT("UD.Rotations");
+	RotationSystem.Reads = EUDComponents::Inputs | EUDComponents::LODs;
+	RotationSystem.Writes = EUDComponents::Rotations;
+	RotationSystem.Execute = [](FUDSimulationState& State, const float& Delta) { State.UpdateRotations(Delta); };
+	Scheduler.AddSystem(RotationSystem);
+
+	FUDSystem CorrectionSystem = {};
+	CorrectionSystem.Name = TEXT("UD.Corrections");
+	CorrectionSystem.Writes = EUDComponents::Locations | EUDComponents::Rotations;
+	CorrectionSystem.Execute = [](FUDSimulationState& State, const float& Delta) { State.SmoothCorrections(); };
+	Scheduler.AddSystem(CorrectionSystem);
+}
+
+FRandomStream UD::MakeEntityRandom(const FUDSimulationConfig& Config, const uint32& Ordinal)
+{
+	return FRandomStream((int32)UD::Core::CombineHashes((uint64)(uint32)Config.Seed, Ordinal));
+}
+
+int32 UD::FindDivergentChunk(const TArray<uint64>& LocalChunkHashes, const TArray<uint64>& RemoteChunkHashes)
+{
+	const int32 NumChunks = FMath::Min(LocalChunkHashes.Num(), RemoteChunkHashes.Num());
+	for (int32 ChunkIndex = 0; ChunkIndex < NumChunks; ChunkIndex++)
+	{
+		if (LocalChunkHashes[ChunkIndex] != RemoteChunkHashes[ChunkIndex])
+		{
+			return ChunkIndex;
+		}
+	}
+	return LocalChunkHashes.Num() == RemoteChunkHashes.Num() ? INDEX_NONE : NumChunks; // One side has more entities
+}
+
+void UD::FindDifferences(const FUDSimulationSnapshot& Authority, const FUDSimulationState& ClientState, const float& LocationTolerance, const float& RotationTolerance, const FUDSimulationConfig& Config, FUDCorrectionList& OutCorrections)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("Sim_FindDifferences");
+	OutCorrections.Reset();
+	const int32 NumEntities = ClientState.Num();
+	const int32 NumAuthority = Authority.Handles.Num();
+	const double LocationToleranceSquared = (double)LocationTolerance * LocationTolerance;
+
+	// One entity per register, the W lane is zeroed by the loads so it never exceeds the tolerances
+	OutCorrections.ChunkIndices.SetNum(GetNumChunks(NumEntities, Config));
+	ParallelForChunks(NumEntities, Config, [&](int32 ChunkIndex, int32 Begin, int32 End)
+	{
+		TArray<int32>& ChunkIndices = OutCorrections.ChunkIndices[ChunkIndex];
+		ChunkIndices.Reset();
+		const VectorRegister4Double LocationToleranceV = MakeVectorRegisterDouble(LocationToleranceSquared, LocationToleranceSquared, LocationToleranceSquared, LocationToleranceSquared);
+		const VectorRegister4Double RotationToleranceV = MakeVectorRegisterDouble((double)RotationTolerance, (double)RotationTolerance, (double)RotationTolerance, (double)RotationTolerance);
+		const int32 MatchEnd = FMath::Min(End, NumAuthority);
+		for (int32 i = Begin; i < MatchEnd; i++)
+		{
+			const FUDEntityHandle& AuthorityHandle = Authority.Handles[i];
+			if (ClientState.DenseToSparse[i] != AuthorityHandle.Index || ClientState.Generations[AuthorityHandle.Index] != AuthorityHandle.Generation)
+			{
+				ChunkIndices.Add(i); // Resolved by handle below
+				continue;
+			}
+
+			const VectorRegister4Double LocationDelta = VectorSubtract(VectorLoadFloat3(&Authority.Locations[i].X), VectorLoadFloat3(&ClientState.Locations[i].Value.X));
+			const VectorRegister4Double RotationDelta = VectorAbs(VectorNormalizeRotator(VectorSubtract(VectorLoadFloat3(&Authority.Rotations[i].Pitch), VectorLoadFloat3(&ClientState.Rotations[i].Value.Pitch))));
+			if (VectorAnyGreaterThan(VectorDot3(LocationDelta, LocationDelta), LocationToleranceV) | VectorAnyGreaterThan(RotationDelta, RotationToleranceV))
+			{
+				ChunkIndices.Add(i);
+			}
+		}
+		for (int32 i = MatchEnd; i < End; i++)
+		{
+			ChunkIndices.Add(i);
+		}
+	});
+	MergeChunkIndices(OutCorrections.ChunkIndices, OutCorrections.Candidates);
+
+	// Entities that moved in the dense arrays since the authority snapshot are only a handful after a removal, the slot map is only built for them
+	bool bSlotMapBuilt = false;
+	for (const int32& Index : OutCorrections.Candidates)
+	{
+		const FUDEntityHandle Handle = ClientState.GetHandle(Index);
+		int32 AuthorityIndex = Index;
+		if (Index >= NumAuthority || Authority.Handles[Index] != Handle)
+		{
+			if (!bSlotMapBuilt)
+			{
+				OutCorrections.SlotToIndex.Init(INDEX_NONE, ClientState.SparseToDense.Num());
+				for (int32 i = 0; i < NumAuthority; i++)
+				{
+					const int32 Slot = Authority.Handles[i].Index;
+					if (OutCorrections.SlotToIndex.IsValidIndex(Slot))
+					{
+						OutCorrections.SlotToIndex[Slot] = i;
+					}
+				}
+				bSlotMapBuilt = true;
+			}
+
+			AuthorityIndex = OutCorrections.SlotToIndex[Handle.Index];
+			if (AuthorityIndex == INDEX_NONE || Authority.Handles[AuthorityIndex] != Handle)
+			{
+				continue; // Unknown to the authority
+			}
+
+			const bool bLocation = FVector::DistSquared(Authority.Locations[AuthorityIndex], ClientState.Locations[Index].Value) > LocationToleranceSquared;
+			const bool bRotation = !Authority.Rotations[AuthorityIndex].Equals(ClientState.Rotations[Index].Value, RotationTolerance);
+			if (!bLocation && !bRotation)
+			{
+				continue;
+			}
+		}
+
+		OutCorrections.Indices.Add(Index);
+		OutCorrections.Handles.Add(Handle);
+		OutCorrections.Locations.Add(Authority.Locations[AuthorityIndex]);
+		OutCorrections.Rotations.Add(Authority.Rotations[AuthorityIndex]);
+		OutCorrections.Velocities.Add(Authority.Velocities[AuthorityIndex]);
+	}
 }
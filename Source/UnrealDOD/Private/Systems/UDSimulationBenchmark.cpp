@@ -0,0 +1,361 @@
+// Copyright - Jed
+
+
+#include "Systems/UDSimulation.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+#include "Math/RandomStream.h"
+
+namespace UD::Benchmark
+{
+	// Fills the state with actorless agents, separation is disabled to only measure the integration.
+	// The streams are always filled so the same state can be measured with both storage modes.
+	static void PopulateState(FUDSimulationState& State, const int32& NumEntities)
+	{
+		FRandomStream Random(NumEntities);
+		State.Config.bSeparation = false;
+		for (int32& ArchetypeEnd : State.ArchetypeEnds)
+		{
+			ArchetypeEnd = NumEntities;
+		}
+
+		State.Actors.SetNum(NumEntities);
+		State.Locations.SetNum(NumEntities);
+		State.Rotations.SetNum(NumEntities);
+		State.Movements.SetNum(NumEntities);
+		State.Inputs.SetNum(NumEntities);
+		State.Collisions.SetNum(NumEntities);
+		State.LODs.Init(EUDSimulationLOD::Full, NumEntities);
+		State.SparseToDense.SetNum(NumEntities);
+		State.DenseToSparse.SetNum(NumEntities);
+		State.Generations.SetNumZeroed(NumEntities);
+
+		for (int32 i = 0; i < NumEntities; i++)
+		{
+			State.SparseToDense[i] = i;
+			State.DenseToSparse[i] = i;
+			State.Locations[i].Value = Random.GetUnitVector() * Random.FRandRange(0., 100000.);
+			State.Movements[i].Acceleration = Random.FRandRange(1024., 1612.);
+			State.Inputs[i].Movement = Random.GetUnitVector();
+			State.Inputs[i].Rotation = FVector(0.f, Random.FRandRange(-1., 1.), 0.f);
+		}
+
+		State.Streams.Reset();
+		for (int32 i = 0; i < NumEntities; i++)
+		{
+			State.Streams.Add(State.Locations[i], State.Movements[i], State.Inputs[i]);
+		}
+	}
+
+	static double MeasureFrameTime(FUDSimulationState& State, const int32& NumFrames)
+	{
+		constexpr float Delta = 1.f / 30.f;
+		State.BeginStep();
+		State.UpdateLocations(Delta); // Warm up the chunk lists and the worker pool
+		State.UpdateRotations(Delta);
+
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 Frame = 0; Frame < NumFrames; Frame++)
+		{
+			State.BeginStep();
+			State.UpdateLocations(Delta);
+			State.UpdateRotations(Delta);
+		}
+		return (FPlatformTime::Seconds() - StartTime) / NumFrames;
+	}
+
+	static double MeasureLocationTime(FUDSimulationState& State, const int32& NumFrames)
+	{
+		constexpr float Delta = 1.f / 30.f;
+		State.BeginStep();
+		State.UpdateLocations(Delta);
+
+		const double StartTime = FPlatformTime::Seconds();
+		for (int32 Frame = 0; Frame < NumFrames; Frame++)
+		{
+			State.BeginStep();
+			State.UpdateLocations(Delta);
+		}
+		return (FPlatformTime::Seconds() - StartTime) / NumFrames;
+	}
+
+	static void RunScaling(const TArray<FString>& Args)
+	{
+		const int32 ChunkSize = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : FUDSimulationConfig().ChunkSize;
+		const int32 EntityCounts[] = { 10000, 100000, 1000000 };
+		const int32 WorkerCounts[] = { 1, 2, 4, 8, 16 };
+
+		for (const int32& NumEntities : EntityCounts)
+		{
+			FUDSimulationState State = {};
+			PopulateState(State, NumEntities);
+			const int32 NumFrames = FMath::Max(10, 2000000 / NumEntities);
+
+			double SingleWorkerTime = 0.;
+			for (const int32& WorkerCount : WorkerCounts)
+			{
+				State.Config.ChunkSize = ChunkSize;
+				State.Config.WorkerCount = WorkerCount;
+				const double FrameTime = MeasureFrameTime(State, NumFrames);
+				SingleWorkerTime = WorkerCount == 1 ? FrameTime : SingleWorkerTime;
+
+				UE_LOG(LogTemp, Display, TEXT("UD.Bench.Scaling - %7d entities, %2d workers, chunk %d: %8.3f ms/frame, %6.2f ns/entity, %5.2fx"),
+					NumEntities, WorkerCount, ChunkSize, FrameTime * 1000., FrameTime * 1e9 / NumEntities, SingleWorkerTime / FrameTime);
+			}
+		}
+	}
+
+	static FAutoConsoleCommand ScalingCommand(
+		TEXT("UD.Bench.Scaling"),
+		TEXT("Measures the chunked integration at 10k/100k/1M entities on 1/2/4/8/16 workers. Usage: UD.Bench.Scaling [ChunkSize]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&RunScaling));
+
+	static void RunLayout(const TArray<FString>& Args)
+	{
+		const int32 WorkerCount = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1;
+		const int32 EntityCounts[] = { 1000, 10000, 100000, 1000000 };
+
+		for (const int32& NumEntities : EntityCounts)
+		{
+			FUDSimulationState State = {};
+			State.Config.WorkerCount = WorkerCount;
+			PopulateState(State, NumEntities);
+			const int32 NumFrames = FMath::Max(10, 2000000 / NumEntities);
+
+			State.Config.StorageMode = EUDStorageMode::ArrayOfStructs;
+			const double ComponentTime = MeasureLocationTime(State, NumFrames);
+
+			State.Config.StorageMode = EUDStorageMode::StructOfArrays;
+			State.Config.bUseSIMD = false;
+			const double ScalarTime = MeasureLocationTime(State, NumFrames);
+
+			State.Config.bUseSIMD = true;
+			const double VectorTime = MeasureLocationTime(State, NumFrames);
+
+			UE_LOG(LogTemp, Display, TEXT("UD.Bench.Layout - %7d entities: AoS %6.2f ns/entity, SoA scalar %6.2f ns/entity (%5.2fx), SoA SIMD %6.2f ns/entity (%5.2fx)"),
+				NumEntities, ComponentTime * 1e9 / NumEntities, ScalarTime * 1e9 / NumEntities, ComponentTime / ScalarTime, VectorTime * 1e9 / NumEntities, ComponentTime / VectorTime);
+		}
+	}
+
+	static FAutoConsoleCommand LayoutCommand(
+		TEXT("UD.Bench.Layout"),
+		TEXT("Compares the component (AoS) integration with the scalar and SIMD stream (SoA) kernels from 1k to 1M entities. Usage: UD.Bench.Layout [WorkerCount]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&RunLayout));
+
+	static void RunSpatialHash(const TArray<FString>& Args)
+	{
+		const int32 NumEntities = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 100000;
+		const float Densities[] = { 0.25f, 1.f, 4.f, 16.f }; // Average entities per cell
+		constexpr int32 NumFrames = 20;
+
+		for (const float& Density : Densities)
+		{
+			FUDSimulationState State = {};
+			PopulateState(State, NumEntities);
+			State.Config.bSeparation = true;
+			State.Config.StorageMode = EUDStorageMode::StructOfArrays;
+
+			// Flat square sized so that every cell of two diameters holds Density entities on average
+			FRandomStream Random(NumEntities);
+			const float CellSize = FUDCollision().Size * 2.f;
+			const float Side = FMath::Sqrt(NumEntities / Density) * CellSize;
+			for (int32 i = 0; i < NumEntities; i++)
+			{
+				State.Streams.SetPosition(i, FVector(Random.FRandRange(0., Side), Random.FRandRange(0., Side), 0.));
+			}
+			const TConstArrayView<float> X(State.Streams.PositionX.GetData(), NumEntities);
+			const TConstArrayView<float> Y(State.Streams.PositionY.GetData(), NumEntities);
+
+			State.SpatialHash.Build(X, Y, CellSize, State.Config); // Warm up the allocations
+			double StartTime = FPlatformTime::Seconds();
+			for (int32 Frame = 0; Frame < NumFrames; Frame++)
+			{
+				State.SpatialHash.Build(X, Y, CellSize, State.Config);
+			}
+			const double BuildTime = (FPlatformTime::Seconds() - StartTime) / NumFrames;
+
+			TArray<int64> ChunkCandidates = {};
+			ChunkCandidates.SetNumZeroed(UD::GetNumChunks(NumEntities, State.Config));
+			StartTime = FPlatformTime::Seconds();
+			for (int32 Frame = 0; Frame < NumFrames; Frame++)
+			{
+				UD::ParallelForChunks(NumEntities, State.Config, [&](int32 ChunkIndex, int32 Begin, int32 End)
+				{
+					int64 Candidates = 0;
+					for (int32 i = Begin; i < End; i++)
+					{
+						State.SpatialHash.ForEachNeighbour(X[i], Y[i], [&Candidates](const int32 Other, const float OtherX, const float OtherY) { Candidates++; });
+					}
+					ChunkCandidates[ChunkIndex] = Candidates;
+				});
+			}
+			const double QueryTime = (FPlatformTime::Seconds() - StartTime) / NumFrames;
+
+			int64 NumCandidates = 0;
+			for (const int64& Candidates : ChunkCandidates)
+			{
+				NumCandidates += Candidates;
+			}
+
+			FUDFrameArena::FScope ArenaScope(State.FrameArena);
+			StartTime = FPlatformTime::Seconds();
+			for (int32 Frame = 0; Frame < NumFrames; Frame++)
+			{
+				State.BeginStep(); // Releases the scratch of the previous run
+				State.SeparateEntities();
+			}
+			const double SeparationTime = (FPlatformTime::Seconds() - StartTime) / NumFrames;
+
+			UE_LOG(LogTemp, Display, TEXT("UD.Bench.SpatialHash - %7d entities, %5.2f per cell: build %6.3f ms (%5.2f ns/entity), 3x3 query %6.3f ms (%5.1f candidates/entity), separation %6.3f ms, %.1f KB"),
+				NumEntities, Density, BuildTime * 1000., BuildTime * 1e9 / NumEntities, QueryTime * 1000., (double)NumCandidates / NumEntities,
+				SeparationTime * 1000., State.SpatialHash.GetAllocatedSize() / 1024.);
+		}
+	}
+
+	static FAutoConsoleCommand SpatialHashCommand(
+		TEXT("UD.Bench.SpatialHash"),
+		TEXT("Measures the spatial hash rebuild, the neighbour queries and the separation pass at several crowd densities. Usage: UD.Bench.SpatialHash [NumEntities]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&RunSpatialHash));
+
+	static void RunReplication(const TArray<FString>& Args)
+	{
+		const float PacketLoss = Args.Num() > 0 ? FCString::Atof(*Args[0]) / 100.f : 0.f;
+		const int32 EntityCounts[] = { 10000, 50000, 100000 };
+		constexpr float Delta = 1.f / 30.f;
+		constexpr int32 NumFrames = 60;
+
+		for (const int32& NumEntities : EntityCounts)
+		{
+			FUDSimulationState State = {};
+			PopulateState(State, NumEntities);
+
+			FUDReplicationServer Server = {};
+			FUDReplicationClient Client = {};
+			Server.Initialize(State.Config);
+			Client.Initialize(State.Config);
+			const int32 ConnectionId = Server.AddConnection();
+
+			// Loopback connection, a PacketLoss share of the packets is dropped on the way and those are never acked
+			FRandomStream Random(NumEntities);
+			FUDSimulationSnapshot Snapshot = {};
+			TArray<uint8> Packet = {};
+			int64 NumBytes = 0;
+			double ServerTime = 0.;
+			double ClientTime = 0.;
+			for (int32 Frame = 0; Frame < NumFrames; Frame++)
+			{
+				State.BeginStep();
+				State.UpdateLocations(Delta);
+				State.UpdateRotations(Delta);
+
+				Snapshot.Handles.SetNum(NumEntities);
+				Snapshot.Locations.SetNum(NumEntities);
+				Snapshot.Rotations.SetNum(NumEntities);
+				Snapshot.Velocities.SetNum(NumEntities);
+				for (int32 i = 0; i < NumEntities; i++)
+				{
+					Snapshot.Handles[i] = { i, 1 };
+					Snapshot.Locations[i] = State.Locations[i].Value;
+					Snapshot.Rotations[i] = State.Rotations[i].Value;
+					Snapshot.Velocities[i] = State.Locations[i].Velocity;
+				}
+
+				double StartTime = FPlatformTime::Seconds();
+				Server.WritePacket(ConnectionId, Snapshot, FVector::ZeroVector, Packet);
+				ServerTime += FPlatformTime::Seconds() - StartTime;
+				NumBytes += Packet.Num();
+
+				if (Random.FRand() < PacketLoss)
+				{
+					continue;
+				}
+
+				uint32 Sequence = 0;
+				StartTime = FPlatformTime::Seconds();
+				const bool bRead = Client.ReadPacket(Packet, Sequence);
+				ClientTime += FPlatformTime::Seconds() - StartTime;
+				if (bRead)
+				{
+					Server.ReceiveAck(ConnectionId, Sequence);
+				}
+			}
+
+			double TotalError = 0.;
+			int32 NumUpToDate = 0;
+			for (int32 i = 0; i < NumEntities; i++)
+			{
+				const double Error = Client.HasEntity(i) ? FVector::Dist(Client.Locations[i], Snapshot.Locations[i]) : 0.;
+				TotalError += Error;
+				NumUpToDate += Client.HasEntity(i) && Error <= State.Config.ReplicationErrorTolerance ? 1 : 0;
+			}
+
+			UE_LOG(LogTemp, Display, TEXT("UD.Bench.Replication - %7d entities, %4.1f%% loss: %7.1f bytes/frame (%5.2f bits/entity), server %6.3f ms, client %6.3f ms, mean error %7.2f, %5.1f%% within tolerance"),
+				NumEntities, PacketLoss * 100.f, (double)NumBytes / NumFrames, NumBytes * 8. / NumFrames / NumEntities, ServerTime * 1000. / NumFrames, ClientTime * 1000. / NumFrames,
+				TotalError / NumEntities, NumUpToDate * 100. / NumEntities);
+		}
+	}
+
+	static FAutoConsoleCommand ReplicationCommand(
+		TEXT("UD.Bench.Replication"),
+		TEXT("Replicates 10k/50k/100k moving entities over a loopback connection and reports the bandwidth, the encode and decode times and the client error. Usage: UD.Bench.Replication [PacketLossPercent]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&RunReplication));
+
+	static void RunDifferences(const TArray<FString>& Args)
+	{
+		const float DriftRatio = Args.Num() > 0 ? FCString::Atof(*Args[0]) / 100.f : 1.f / 100.f;
+		const int32 EntityCounts[] = { 10000, 100000, 1000000 };
+		constexpr int32 NumFrames = 20;
+
+		for (const int32& NumEntities : EntityCounts)
+		{
+			FUDSimulationState State = {};
+			PopulateState(State, NumEntities);
+
+			// The authority is the client state with a share of the entities pushed past the tolerance
+			FRandomStream Random(NumEntities);
+			FUDSimulationSnapshot Authority = {};
+			Authority.Handles.SetNum(NumEntities);
+			Authority.Locations.SetNum(NumEntities);
+			Authority.Rotations.SetNum(NumEntities);
+			Authority.Velocities.SetNum(NumEntities);
+			for (int32 i = 0; i < NumEntities; i++)
+			{
+				const bool bDrifted = Random.FRand() < DriftRatio;
+				Authority.Handles[i] = State.GetHandle(i);
+				Authority.Locations[i] = State.Locations[i].Value + (bDrifted ? Random.GetUnitVector() * 50. : FVector::ZeroVector);
+				Authority.Rotations[i] = State.Rotations[i].Value;
+				Authority.Velocities[i] = State.Locations[i].Velocity;
+			}
+
+			FUDCorrectionList Corrections = {};
+			UD::FindDifferences(Authority, State, 2.f, State.Config.CorrectionRotationTolerance, State.Config, Corrections); // Warm up the allocations
+			const double StartTime = FPlatformTime::Seconds();
+			for (int32 Frame = 0; Frame < NumFrames; Frame++)
+			{
+				UD::FindDifferences(Authority, State, 2.f, State.Config.CorrectionRotationTolerance, State.Config, Corrections);
+			}
+			const double DiffTime = (FPlatformTime::Seconds() - StartTime) / NumFrames;
+
+			// Spread over a few steps like a client would, the state converges back on the authority
+			State.Config.CorrectionSmoothingSteps = 4;
+			const double ApplyStartTime = FPlatformTime::Seconds();
+			State.ApplyCorrections(Corrections);
+			State.ClearDirty();
+			for (int32 Step = 0; Step < State.Config.CorrectionSmoothingSteps; Step++)
+			{
+				State.SmoothCorrections();
+			}
+			const double ApplyTime = FPlatformTime::Seconds() - ApplyStartTime;
+			const int32 NumCorrections = Corrections.Num();
+			UD::FindDifferences(Authority, State, 2.f, State.Config.CorrectionRotationTolerance, State.Config, Corrections);
+
+			UE_LOG(LogTemp, Display, TEXT("UD.Bench.Differences - %7d entities: diff %6.3f ms (%5.2f ns/entity), %6d corrections, apply and smooth %6.3f ms, %d left after smoothing"),
+				NumEntities, DiffTime * 1000., DiffTime * 1e9 / NumEntities, NumCorrections, ApplyTime * 1000., Corrections.Num());
+		}
+	}
+
+	static FAutoConsoleCommand DifferencesCommand(
+		TEXT("UD.Bench.Differences"),
+		TEXT("Measures GetDifferences against an authority with a share of drifted entities, then applies and smooths the corrections. Usage: UD.Bench.Differences [DriftPercent]"),
+		FConsoleCommandWithArgsDelegate::CreateStatic(&RunDifferences));
+}
@@ -0,0 +1,93 @@
+// Copyright - Jed
+
+
+#include "Systems/UDSimulationStats.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+
+CSV_DEFINE_CATEGORY(UnrealDOD, true);
+
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Step (ms)"), STAT_UD_StepMs, STATGROUP_UnrealDOD);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Step P50 (ms)"), STAT_UD_StepP50Ms, STATGROUP_UnrealDOD);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Step P95 (ms)"), STAT_UD_StepP95Ms, STATGROUP_UnrealDOD);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Step P99 (ms)"), STAT_UD_StepP99Ms, STATGROUP_UnrealDOD);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Sleep (ms)"), STAT_UD_SleepMs, STATGROUP_UnrealDOD);
+DECLARE_FLOAT_COUNTER_STAT(TEXT("Overrun total (ms)"), STAT_UD_OverrunMs, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Entities integrated"), STAT_UD_NumIntegrated, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sweeps"), STAT_UD_NumSweeps, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Dirty entities"), STAT_UD_NumDirty, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Steps"), STAT_UD_NumSteps, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Overruns"), STAT_UD_NumOverruns, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Dropped steps"), STAT_UD_NumDroppedSteps, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Late inputs"), STAT_UD_NumLateInputs, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Skipped snapshots"), STAT_UD_NumSkippedSnapshots, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Commands enqueued"), STAT_UD_NumCommandsEnqueued, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Commands dropped"), STAT_UD_NumCommandsDropped, STATGROUP_UnrealDOD);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Step heap allocations"), STAT_UD_NumStepHeapAllocations, STATGROUP_UnrealDOD);
+DECLARE_MEMORY_STAT(TEXT("Scratch peak"), STAT_UD_ScratchPeak, STATGROUP_UnrealDOD);
+
+void FUDStepTimeHistory::Add(const double& Seconds)
+{
+	Samples[NextSample] = Seconds;
+	NextSample = (NextSample + 1) % UD_STATS_HISTORY;
+	NumSamples = FMath::Min(NumSamples + 1, UD_STATS_HISTORY);
+}
+
+void FUDStepTimeHistory::GetPercentiles(double& OutP50, double& OutP95, double& OutP99)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimStats_GetPercentiles");
+	if (NumSamples == 0)
+	{
+		OutP50 = OutP95 = OutP99 = 0.;
+		return;
+	}
+
+	// Nearest rank, the order of the samples does not matter once the window is full
+	Sorted.Reset();
+	Sorted.Append(Samples, NumSamples);
+	Sorted.Sort();
+	auto Rank = [this](const int32& Percent) { return Sorted[FMath::Clamp(FMath::DivideAndRoundUp(Percent * NumSamples, 100) - 1, 0, NumSamples - 1)]; };
+	OutP50 = Rank(50);
+	OutP95 = Rank(95);
+	OutP99 = Rank(99);
+}
+
+void UD::ReportStats(const FUDSimulationStats& Stats)
+{
+	SET_FLOAT_STAT(STAT_UD_StepMs, Stats.LastStepSeconds * 1000.);
+	SET_FLOAT_STAT(STAT_UD_StepP50Ms, Stats.StepSecondsP50 * 1000.);
+	SET_FLOAT_STAT(STAT_UD_StepP95Ms, Stats.StepSecondsP95 * 1000.);
+	SET_FLOAT_STAT(STAT_UD_StepP99Ms, Stats.StepSecondsP99 * 1000.);
+	SET_FLOAT_STAT(STAT_UD_SleepMs, Stats.SleepSeconds * 1000.);
+	SET_FLOAT_STAT(STAT_UD_OverrunMs, Stats.OverrunSeconds * 1000.);
+	SET_DWORD_STAT(STAT_UD_NumIntegrated, Stats.StepCounters.NumIntegrated);
+	SET_DWORD_STAT(STAT_UD_NumSweeps, Stats.StepCounters.NumSweeps);
+	SET_DWORD_STAT(STAT_UD_NumDirty, Stats.NumDirty);
+	SET_DWORD_STAT(STAT_UD_NumSteps, Stats.NumSteps);
+	SET_DWORD_STAT(STAT_UD_NumOverruns, Stats.NumOverruns);
+	SET_DWORD_STAT(STAT_UD_NumDroppedSteps, Stats.NumDroppedSteps);
+	SET_DWORD_STAT(STAT_UD_NumLateInputs, Stats.NumLateInputs);
+	SET_DWORD_STAT(STAT_UD_NumSkippedSnapshots, Stats.NumSkippedSnapshots);
+	SET_DWORD_STAT(STAT_UD_NumCommandsEnqueued, Stats.NumCommandsEnqueued);
+	SET_DWORD_STAT(STAT_UD_NumCommandsDropped, Stats.NumCommandsDropped);
+	SET_DWORD_STAT(STAT_UD_NumStepHeapAllocations, Stats.NumStepHeapAllocations);
+	SET_MEMORY_STAT(STAT_UD_ScratchPeak, Stats.ScratchPeakBytes);
+
+	// One row per game frame in the csvprofile capture, the totals are diffed between rows by the tools
+	CSV_CUSTOM_STAT(UnrealDOD, StepMs, (float)(Stats.LastStepSeconds * 1000.), ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, StepP50Ms, (float)(Stats.StepSecondsP50 * 1000.), ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, StepP95Ms, (float)(Stats.StepSecondsP95 * 1000.), ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, StepP99Ms, (float)(Stats.StepSecondsP99 * 1000.), ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, SleepMs, (float)(Stats.SleepSeconds * 1000.), ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, OverrunMs, (float)(Stats.OverrunSeconds * 1000.), ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, NumIntegrated, (int32)Stats.StepCounters.NumIntegrated, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, NumSweeps, (int32)Stats.StepCounters.NumSweeps, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, NumDirty, (int32)Stats.NumDirty, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, NumOverruns, (int32)Stats.NumOverruns, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, NumDroppedSteps, (int32)Stats.NumDroppedSteps, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, NumLateInputs, (int32)Stats.NumLateInputs, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, NumSkippedSnapshots, (int32)Stats.NumSkippedSnapshots, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, NumCommandsEnqueued, (int32)Stats.NumCommandsEnqueued, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, NumCommandsDropped, (int32)Stats.NumCommandsDropped, ECsvCustomStatOp::Set);
+	CSV_CUSTOM_STAT(UnrealDOD, NumStepHeapAllocations, (int32)Stats.NumStepHeapAllocations, ECsvCustomStatOp::Set);
+}
@@ -0,0 +1,210 @@
+// Copyright - Jed
+
+
+#include "Systems/UDSimulationStreams.h"
+#include "Systems/UDSimulation.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+template<typename FunctionType>
+void FUDMovementStreams::ForEachStream(FunctionType Function)
+{
+	for (FUDStream* Stream : { &PositionX, &PositionY, &PositionZ, &VelocityX, &VelocityY, &VelocityZ, &InputX, &InputY, &InputZ, &Acceleration, &Deceleration, &MaxSpeed, &Gravity })
+	{
+		Function(*Stream);
+	}
+}
+
+int32 FUDMovementStreams::Add(const FUDLocation& Location, const FUDMovement& Movement, const FUDMovementInput& Input)
+{
+	const int32 Index = NumEntities++;
+	if (PositionX.Num() < NumEntities)
+	{
+		ForEachStream([](FUDStream& Stream) { Stream.AddZeroed(UD_STREAM_WIDTH); });
+	}
+	Set(Index, Location, Movement, Input);
+	return Index;
+}
+
+int32 FUDMovementStreams::AddZeroed(const int32& Count)
+{
+	const int32 Index = NumEntities;
+	NumEntities += Count;
+	const int32 NumPadded = Align(NumEntities, UD_STREAM_WIDTH);
+	if (PositionX.Num() < NumPadded)
+	{
+		ForEachStream([NumPadded](FUDStream& Stream) { Stream.AddZeroed(NumPadded - Stream.Num()); });
+	}
+	return Index;
+}
+
+void FUDMovementStreams::Set(const int32& Index, const FUDLocation& Location, const FUDMovement& Movement, const FUDMovementInput& Input)
+{
+	check(Index >= 0 && Index < NumEntities);
+	SetPosition(Index, Location.Value);
+	SetVelocity(Index, Location.Velocity);
+	SetInput(Index, Input);
+	Acceleration[Index] = Movement.Acceleration;
+	Deceleration[Index] = Movement.Deceleration;
+	MaxSpeed[Index] = Movement.MaxSpeed;
+	Gravity[Index] = Movement.Gravity;
+}
+
+void FUDMovementStreams::SetInput(const int32& Index, const FUDMovementInput& Input)
+{
+	InputX[Index] = (float)Input.Movement.X;
+	InputY[Index] = (float)Input.Movement.Y;
+	InputZ[Index] = (float)Input.Movement.Z;
+}
+
+void FUDMovementStreams::RemoveAtSwap(const int32& Index)
+{
+	check(Index >= 0 && Index < NumEntities);
+	const int32 LastIndex = --NumEntities;
+	ForEachStream([&](FUDStream& Stream)
+	{
+		Stream[Index] = Stream[LastIndex];
+		Stream[LastIndex] = 0.f; // Keep the zeroed padding
+	});
+}
+
+void FUDMovementStreams::Move(const int32& From, const int32& To)
+{
+	check(From >= 0 && From < NumEntities && To >= 0 && To < NumEntities);
+	ForEachStream([&](FUDStream& Stream) { Stream[To] = Stream[From]; });
+}
+
+void FUDMovementStreams::Rebase(const FVector& NewOrigin)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimStreams_Rebase");
+	const FVector Offset = Origin - NewOrigin;
+	for (int32 i = 0; i < NumEntities; i++)
+	{
+		PositionX[i] = (float)(PositionX[i] + Offset.X);
+		PositionY[i] = (float)(PositionY[i] + Offset.Y);
+		PositionZ[i] = (float)(PositionZ[i] + Offset.Z);
+	}
+	Origin = NewOrigin;
+}
+
+SIZE_T FUDMovementStreams::GetAllocatedSize() const
+{
+	SIZE_T Size = 0;
+	for (const FUDStream* Stream : { &PositionX, &PositionY, &PositionZ, &VelocityX, &VelocityY, &VelocityZ, &InputX, &InputY, &InputZ, &Acceleration, &Deceleration, &MaxSpeed, &Gravity })
+	{
+		Size += Stream->GetAllocatedSize();
+	}
+	return Size;
+}
+
+UD::Core::FMovementStreamsView FUDMovementStreams::GetView()
+{
+	UD::Core::FMovementStreamsView View = {};
+	View.PositionX = PositionX.GetData();
+	View.PositionY = PositionY.GetData();
+	View.PositionZ = PositionZ.GetData();
+	View.VelocityX = VelocityX.GetData();
+	View.VelocityY = VelocityY.GetData();
+	View.VelocityZ = VelocityZ.GetData();
+	View.InputX = InputX.GetData();
+	View.InputY = InputY.GetData();
+	View.InputZ = InputZ.GetData();
+	View.Acceleration = Acceleration.GetData();
+	View.Deceleration = Deceleration.GetData();
+	View.MaxSpeed = MaxSpeed.GetData();
+	View.Gravity = Gravity.GetData();
+	return View;
+}
+
+void FUDMovementStreams::Reset()
+{
+	ForEachStream([](FUDStream& Stream) { Stream.Reset(); });
+	NumEntities = 0;
+	Origin = FVector::ZeroVector;
+}
+
+void UD::IntegrateStreams_Scalar(FUDMovementStreams& Streams, const int32& Begin, const int32& End, const float& Delta)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimStreams_Integrate_Scalar");
+	check(Align(End, UD_STREAM_WIDTH) <= Streams.PositionX.Num());
+	UD::Core::IntegrateScalar(Streams.GetView(), Begin, End, Delta);
+}
+
+void UD::IntegrateStreams_Vector(FUDMovementStreams& Streams, const int32& Begin, const int32& End, const float& Delta)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimStreams_Integrate_Vector");
+	float* RESTRICT PosX = Streams.PositionX.GetData();
+	float* RESTRICT PosY = Streams.PositionY.GetData();
+	float* RESTRICT PosZ = Streams.PositionZ.GetData();
+	float* RESTRICT VelX = Streams.VelocityX.GetData();
+	float* RESTRICT VelY = Streams.VelocityY.GetData();
+	float* RESTRICT VelZ = Streams.VelocityZ.GetData();
+	const float* RESTRICT InX = Streams.InputX.GetData();
+	const float* RESTRICT InY = Streams.InputY.GetData();
+	const float* RESTRICT InZ = Streams.InputZ.GetData();
+	const float* RESTRICT Acceleration = Streams.Acceleration.GetData();
+	const float* RESTRICT Deceleration = Streams.Deceleration.GetData();
+	const float* RESTRICT MaxSpeed = Streams.MaxSpeed.GetData();
+	const float* RESTRICT Gravity = Streams.Gravity.GetData();
+
+	const VectorRegister4Float DeltaV = VectorSetFloat1(Delta);
+	const VectorRegister4Float Zero = VectorZeroFloat();
+	const VectorRegister4Float One = VectorOneFloat();
+	const VectorRegister4Float SmallNumber = VectorSetFloat1(UE_SMALL_NUMBER);
+	const VectorRegister4Float KindaSmallNumber = VectorSetFloat1(UE_KINDA_SMALL_NUMBER);
+
+	const int32 AlignedEnd = Align(End, UD_STREAM_WIDTH);
+	check(Begin % UD_STREAM_WIDTH == 0 && AlignedEnd <= Streams.PositionX.Num());
+	for (int32 i = Begin; i < AlignedEnd; i += UD_STREAM_WIDTH)
+	{
+		VectorRegister4Float Vx = VectorLoadAligned(VelX + i);
+		VectorRegister4Float Vy = VectorLoadAligned(VelY + i);
+		VectorRegister4Float Vz = VectorLoadAligned(VelZ + i);
+
+		const VectorRegister4Float Accel = VectorLoadAligned(Acceleration + i);
+		VectorRegister4Float Ax = VectorMultiply(VectorLoadAligned(InX + i), Accel);
+		VectorRegister4Float Ay = VectorMultiply(VectorLoadAligned(InY + i), Accel);
+		VectorRegister4Float Az = VectorSubtract(VectorMultiply(VectorLoadAligned(InZ + i), Accel), VectorLoadAligned(Gravity + i));
+
+		// Lanes without deceleration or velocity get a zero scale, the division result is discarded for them
+		const VectorRegister4Float Decel = VectorLoadAligned(Deceleration + i);
+		const VectorRegister4Float SpeedSquared = VectorMultiplyAdd(Vx, Vx, VectorMultiplyAdd(Vy, Vy, VectorMultiply(Vz, Vz)));
+		const VectorRegister4Float Speed = VectorSqrt(SpeedSquared);
+		const VectorRegister4Float DecelMask = VectorBitwiseAnd(VectorCompareGT(Decel, Zero), VectorCompareGT(SpeedSquared, SmallNumber));
+		const VectorRegister4Float DecelScale = VectorSelect(DecelMask, VectorDivide(VectorMultiply(VectorMin(Speed, Decel), Decel), Speed), Zero);
+		Ax = VectorNegateMultiplyAdd(Vx, DecelScale, Ax);
+		Ay = VectorNegateMultiplyAdd(Vy, DecelScale, Ay);
+		Az = VectorNegateMultiplyAdd(Vz, DecelScale, Az);
+
+		Vx = VectorMultiplyAdd(Ax, DeltaV, Vx);
+		Vy = VectorMultiplyAdd(Ay, DeltaV, Vy);
+		Vz = VectorMultiplyAdd(Az, DeltaV, Vz);
+
+		const VectorRegister4Float MaxSpeedV = VectorLoadAligned(MaxSpeed + i);
+		const VectorRegister4Float NewSpeedSquared = VectorMultiplyAdd(Vx, Vx, VectorMultiplyAdd(Vy, Vy, VectorMultiply(Vz, Vz)));
+		const VectorRegister4Float ClampMask = VectorCompareGT(NewSpeedSquared, VectorMultiply(MaxSpeedV, MaxSpeedV));
+		VectorRegister4Float ClampScale = VectorSelect(ClampMask, VectorMultiply(MaxSpeedV, VectorReciprocalSqrtAccurate(NewSpeedSquared)), One);
+		ClampScale = VectorSelect(VectorCompareLT(MaxSpeedV, KindaSmallNumber), Zero, ClampScale);
+		Vx = VectorMultiply(Vx, ClampScale);
+		Vy = VectorMultiply(Vy, ClampScale);
+		Vz = VectorMultiply(Vz, ClampScale);
+
+		VectorStoreAligned(Vx, VelX + i);
+		VectorStoreAligned(Vy, VelY + i);
+		VectorStoreAligned(Vz, VelZ + i);
+		VectorStoreAligned(VectorMultiplyAdd(Vx, DeltaV, VectorLoadAligned(PosX + i)), PosX + i);
+		VectorStoreAligned(VectorMultiplyAdd(Vy, DeltaV, VectorLoadAligned(PosY + i)), PosY + i);
+		VectorStoreAligned(VectorMultiplyAdd(Vz, DeltaV, VectorLoadAligned(PosZ + i)), PosZ + i);
+	}
+}
+
+void UD::IntegrateStreams(FUDMovementStreams& Streams, const int32& Begin, const int32& End, const float& Delta, const bool& bUseSIMD)
+{
+	if (bUseSIMD)
+	{
+		IntegrateStreams_Vector(Streams, Begin, End, Delta);
+	}
+	else
+	{
+		IntegrateStreams_Scalar(Streams, Begin, End, Delta);
+	}
+}
@@ -0,0 +1,47 @@
+// Copyright - Jed
+
+
+#include "Systems/UDSpatialHash.h"
+#include "Systems/UDSimulation.h"
+#include "Async/ParallelFor.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+
+void FUDSpatialHash::Build(const TConstArrayView<float>& X, const TConstArrayView<float>& Y, const float& InCellSize, const FUDSimulationConfig& Config)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimSpatialHash_Build");
+	check(X.Num() == Y.Num());
+
+	const int32 NumEntities = X.Num();
+	BeginBuild(NumEntities, InCellSize);
+	BeginSort(UD::GetNumChunks(NumEntities, Config));
+	UD::ParallelForChunks(NumEntities, Config, [&](int32 ChunkIndex, int32 Begin, int32 End)
+	{
+		HashRange(X.GetData(), Y.GetData(), Begin, End);
+		CountRange(ChunkIndex, Begin, End);
+	});
+
+	{
+		TRACE_CPUPROFILER_EVENT_SCOPE_STR("SimSpatialHash_PrefixPartitions");
+		PrefixPartitions();
+	}
+
+	UD::ParallelForChunks(NumEntities, Config, [&](int32 ChunkIndex, int32 Begin, int32 End)
+	{
+		ScatterRange(ChunkIndex, Begin, End);
+	});
+
+	{
+		FUDHeapCounter* HeapCounter = FUDHeapCounter::GetCurrent();
+		FUDHeapCounter::FScope TaskSystemScope(nullptr); // ParallelFor allocates its own task data
+		ParallelFor(NumPartitions, [&](int32 Partition)
+		{
+			FUDHeapCounter::FScope HeapScope(HeapCounter);
+			SortPartition(Partition);
+		}, Config.WorkerCount == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+	}
+
+	UD::ParallelForChunks(NumEntities, Config, [&](int32 ChunkIndex, int32 Begin, int32 End)
+	{
+		GatherRange(X.GetData(), Y.GetData(), Begin, End);
+	});
+}
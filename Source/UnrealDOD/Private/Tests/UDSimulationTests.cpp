@@ -0,0 +1,549 @@
+// Copyright - Jed
+
+
+#include "Systems/UDSimulation.h"
+#include "Systems/UDScheduler.h"
+#include "Systems/UDQuery.h"
+#include "Systems/UDSimulationStreams.h"
+#include "Misc/AutomationTest.h"
+#include "Math/RandomStream.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace UD::Tests
+{
+	constexpr float Delta = 1.f / 30.f;
+
+	// Registers actorless agents spread over a square and gives them a random input so they keep moving
+	static void PopulateState(FUDSimulationState& State, const int32& NumEntities, TArray<FUDEntityHandle>& OutHandles)
+	{
+		FRandomStream Random(NumEntities);
+		TArray<FUDEntityDesc> Entities = {};
+		Entities.SetNum(NumEntities);
+		for (FUDEntityDesc& Entity : Entities)
+		{
+			Entity.Transform.SetLocation(FVector(Random.FRandRange(-20000., 20000.), Random.FRandRange(-20000., 20000.), 0.));
+		}
+		State.RegisterEntities(Entities, OutHandles);
+
+		for (const FUDEntityHandle& Handle : OutHandles)
+		{
+			FUDMovementInput Input = {};
+			Input.Movement = FVector(Random.FRandRange(-1., 1.), Random.FRandRange(-1., 1.), 0.).GetSafeNormal();
+			Input.Rotation = FVector(0., Random.FRandRange(-1., 1.), 0.);
+			State.SetMovementInput(Handle, Input);
+		}
+	}
+
+	// Every expected entity has to sit in the range of its archetype with its own location, and the partial arrays must end with their ranges
+	static bool CheckEntities(FAutomationTestBase& Test, const FUDSimulationState& State, const TMap<FUDEntityHandle, FUDEntityDesc>& Expected, const TCHAR* Stage)
+	{
+		int32 NumPerArchetype[(int32)EUDArchetype::Num] = {};
+		for (const TPair<FUDEntityHandle, FUDEntityDesc>& Entity : Expected)
+		{
+			const int32 Index = State.GetDenseIndex(Entity.Key);
+			if (Index == INDEX_NONE || !(State.GetHandle(Index) == Entity.Key) || State.GetArchetype(Index) != Entity.Value.Archetype
+				|| State.Locations[Index].Value != Entity.Value.Transform.GetLocation())
+			{
+				Test.AddError(FString::Printf(TEXT("%s - Entity (%d, generation %u) lost its slot, its archetype or its location"), Stage, Entity.Key.Index, Entity.Key.Generation));
+				return false;
+			}
+			NumPerArchetype[(int32)Entity.Value.Archetype]++;
+		}
+
+		bool bValid = Test.TestEqual(FString::Printf(TEXT("%s - Entities"), Stage), State.Num(), Expected.Num());
+		for (int32 Archetype = 0; Archetype < (int32)EUDArchetype::Num; Archetype++)
+		{
+			const EUDArchetype Range = (EUDArchetype)Archetype;
+			bValid &= Test.TestEqual(FString::Printf(TEXT("%s - Range %d size"), Stage, Archetype), State.GetArchetypeEnd(Range) - State.GetArchetypeBegin(Range), NumPerArchetype[Archetype]);
+		}
+		bValid &= Test.TestEqual(FString::Printf(TEXT("%s - Movements"), Stage), State.Movements.Num(), State.NumMoving());
+		bValid &= Test.TestEqual(FString::Printf(TEXT("%s - Inputs"), Stage), State.Inputs.Num(), State.NumMoving());
+		bValid &= Test.TestEqual(FString::Printf(TEXT("%s - Collisions"), Stage), State.Collisions.Num(), State.GetArchetypeEnd(EUDArchetype::Agent));
+		return bValid;
+	}
+
+	static void Step(FUDSimulationState& State, FUDScheduler& Scheduler, const bool& bParallel)
+	{
+		State.ClearDirty();
+		State.BeginStep();
+		Scheduler.Run(State, Delta, bParallel);
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUDStepHeapAllocationsTest, "UnrealDOD.Simulation.StepHeapAllocations",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FUDStepHeapAllocationsTest::RunTest(const FString& Parameters)
+{
+#if UD_HEAP_COUNTER
+	FUDHeapCounter::Install();
+
+	FUDSimulationState State = {};
+	TArray<FUDEntityHandle> Handles = {};
+	UD::Tests::PopulateState(State, 20000, Handles);
+	FUDScheduler Scheduler = {};
+	UD::AddBuiltinSystems(Scheduler);
+
+	for (const bool bParallel : { false, true })
+	{
+		FUDHeapCounter::FScope HeapScope(&State.HeapCounter);
+		for (int32 Step = 0; Step < 4; Step++)
+		{
+			UD::Tests::Step(State, Scheduler, bParallel); // Grows the persistent arrays and the arena to the crowd
+		}
+
+		const uint64 NumWarmAllocations = State.HeapCounter.GetNumAllocations();
+		for (int32 Step = 0; Step < 16; Step++)
+		{
+			UD::Tests::Step(State, Scheduler, bParallel);
+		}
+		TestEqual(FString::Printf(TEXT("Heap allocations of the steady %s steps"), bParallel ? TEXT("parallel") : TEXT("serial")),
+			State.HeapCounter.GetNumAllocations() - NumWarmAllocations, (uint64)0);
+	}
+	return true;
+#else
+	AddWarning(TEXT("UD_HEAP_COUNTER is off in this build, the step allocations are not counted"));
+	return true;
+#endif
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUDStreamKernelsTest, "UnrealDOD.Simulation.StreamKernels",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FUDStreamKernelsTest::RunTest(const FString& Parameters)
+{
+	// The vector kernel rounds differently from the scalar one, so after a second of steps they only have to agree within a relative tolerance
+	constexpr int32 NumEntities = 4099; // Ends in the padding of a block
+	constexpr int32 NumSteps = 30;
+	constexpr float Tolerance = 1e-4f;
+
+	FRandomStream Random(NumEntities);
+	FUDMovementStreams Scalar = {};
+	FUDMovementStreams Vector = {};
+	for (int32 i = 0; i < NumEntities; i++)
+	{
+		FUDLocation Location = {};
+		Location.Value = Random.GetUnitVector() * Random.FRandRange(0., 10000.);
+		Location.Velocity = i % 7 == 0 ? FVector::ZeroVector : Random.GetUnitVector() * Random.FRandRange(0., 2000.); // Some lanes skip the deceleration
+		FUDMovement Movement = {};
+		Movement.Acceleration = Random.FRandRange(1024., 1612.);
+		Movement.MaxSpeed = i % 11 == 0 ? 0.f : Movement.MaxSpeed; // Some lanes are clamped to a stop
+		FUDMovementInput Input = {};
+		Input.Movement = Random.GetUnitVector();
+		Scalar.Add(Location, Movement, Input);
+		Vector.Add(Location, Movement, Input);
+	}
+
+	for (int32 Step = 0; Step < NumSteps; Step++)
+	{
+		UD::IntegrateStreams_Scalar(Scalar, 0, NumEntities, UD::Tests::Delta);
+		UD::IntegrateStreams_Vector(Vector, 0, NumEntities, UD::Tests::Delta);
+	}
+
+	for (int32 i = 0; i < NumEntities; i++)
+	{
+		const FVector ScalarValues[] = { Scalar.GetPosition(i), Scalar.GetVelocity(i) };
+		const FVector VectorValues[] = { Vector.GetPosition(i), Vector.GetVelocity(i) };
+		for (int32 Value = 0; Value < 2; Value++)
+		{
+			const FVector Error = (ScalarValues[Value] - VectorValues[Value]).GetAbs() / ScalarValues[Value].GetAbs().ComponentMax(FVector::OneVector);
+			if (Error.GetMax() > Tolerance)
+			{
+				AddError(FString::Printf(TEXT("Entity %d %s differs after %d steps, scalar %s, vector %s"),
+					i, Value == 0 ? TEXT("position") : TEXT("velocity"), NumSteps, *ScalarValues[Value].ToString(), *VectorValues[Value].ToString()));
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUDLODHysteresisTest, "UnrealDOD.Simulation.LODHysteresis",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FUDLODHysteresisTest::RunTest(const FString& Parameters)
+{
+	FUDSimulationState State = {};
+	State.Config.bLOD = true;
+	State.Config.LODRebucketSteps = 1; // Every step re-buckets the whole crowd
+	State.Config.LODReducedDistance = 5000.f;
+	State.Config.LODDormantDistance = 20000.f;
+	State.Config.LODHysteresis = 0.1f;
+	State.Viewers.Add(FVector::ZeroVector);
+	const FUDEntityHandle Handle = State.RegisterEntity(FTransform::Identity, EUDArchetype::Mover);
+	const int32 Index = State.GetDenseIndex(Handle);
+
+	// Distance to the viewer and the tier expected after it, a coarser tier needs the margin while a finer one is immediate
+	struct FMove
+	{
+		double Distance = 0.;
+		EUDSimulationLOD LOD = EUDSimulationLOD::Full;
+	};
+	const FMove Moves[] = {
+		{ 5100., EUDSimulationLOD::Full },		// Past the reduced distance, within its margin
+		{ 5600., EUDSimulationLOD::Reduced },
+		{ 5100., EUDSimulationLOD::Reduced },	// Back within the margin
+		{ 4900., EUDSimulationLOD::Full },
+		{ 5400., EUDSimulationLOD::Full },
+		{ 21000., EUDSimulationLOD::Reduced },	// Within the dormant margin
+		{ 22500., EUDSimulationLOD::Dormant },
+		{ 21000., EUDSimulationLOD::Dormant },
+		{ 19000., EUDSimulationLOD::Reduced },
+		{ 4000., EUDSimulationLOD::Full },
+	};
+	for (const FMove& Move : Moves)
+	{
+		State.Locations[Index].Value = FVector(Move.Distance, 0., 0.);
+		State.UpdateLODs();
+		TestEqual(FString::Printf(TEXT("Tier at %.0f cm"), Move.Distance), (int32)State.LODs[Index], (int32)Move.LOD);
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUDSleepWakeTest, "UnrealDOD.Simulation.SleepWake",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FUDSleepWakeTest::RunTest(const FString& Parameters)
+{
+	FUDSimulationState State = {};
+	State.Config.bSleep = true;
+	State.Config.SleepSteps = 8;
+	FUDScheduler Scheduler = {};
+	UD::AddBuiltinSystems(Scheduler);
+
+	// Two idle movers and one that keeps its input, without gravity nothing else moves them
+	FUDEntityHandle Handles[3] = {};
+	for (int32 n = 0; n < 3; n++)
+	{
+		Handles[n] = State.RegisterEntity(FTransform(FVector(n * 10000., 0., 0.)), EUDArchetype::Mover);
+		State.Movements[State.GetDenseIndex(Handles[n])].Gravity = 0.f;
+	}
+	State.SetMovementInput(Handles[0], FUDMovementInput());
+	State.SetMovementInput(Handles[1], FUDMovementInput());
+	const int32 Indices[3] = { State.GetDenseIndex(Handles[0]), State.GetDenseIndex(Handles[1]), State.GetDenseIndex(Handles[2]) };
+
+	for (int32 Step = 1; Step <= State.Config.SleepSteps; Step++)
+	{
+		UD::Tests::Step(State, Scheduler, false);
+		const bool bAsleep = Step == State.Config.SleepSteps;
+		TestTrue(FString::Printf(TEXT("Idle entity %s after %d still steps"), bAsleep ? TEXT("asleep") : TEXT("awake"), Step), State.IsAwake(Indices[0]) != bAsleep);
+		TestTrue(FString::Printf(TEXT("Moving entity awake after %d steps"), Step), State.IsAwake(Indices[2]));
+	}
+
+	UD::Tests::Step(State, Scheduler, false);
+	TestEqual(TEXT("Awake entities once the idle ones slept"), State.NumAwake(), 1);
+
+	// An input and an impulse both wake their entity right away and the next step moves it
+	FUDMovementInput Input = {};
+	Input.Movement = FVector(0., 1., 0.);
+	State.SetMovementInput(Handles[0], Input);
+	State.AddImpulse(Handles[1], FVector(0., 0., 500.));
+	TestTrue(TEXT("Woken by an input"), State.IsAwake(Indices[0]));
+	TestTrue(TEXT("Woken by an impulse"), State.IsAwake(Indices[1]));
+
+	const FVector Locations[2] = { State.Locations[Indices[0]].Value, State.Locations[Indices[1]].Value };
+	UD::Tests::Step(State, Scheduler, false);
+	TestEqual(TEXT("Awake entities after the wake"), State.NumAwake(), 3);
+	TestTrue(TEXT("Entity woken by an input moved"), State.Locations[Indices[0]].Value != Locations[0]);
+	TestTrue(TEXT("Entity woken by an impulse moved"), State.Locations[Indices[1]].Value != Locations[1]);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUDArchetypeRangesTest, "UnrealDOD.Simulation.ArchetypeRanges",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FUDArchetypeRangesTest::RunTest(const FString& Parameters)
+{
+	// Interleaved archetypes, every registration in front of a later range moves an entity of each later range
+	FUDSimulationState State = {};
+	TMap<FUDEntityHandle, FUDEntityDesc> Expected = {};
+	TArray<FUDEntityHandle> Handles = {};
+	for (int32 n = 0; n < 60; n++)
+	{
+		FUDEntityDesc Entity = {};
+		Entity.Transform.SetLocation(FVector(n * 100., 0., 0.));
+		Entity.Archetype = (EUDArchetype)(n % (int32)EUDArchetype::Num);
+		Handles.Add(State.RegisterEntity(Entity.Transform, Entity.Archetype));
+		Expected.Add(Handles.Last(), Entity);
+	}
+	if (!UD::Tests::CheckEntities(*this, State, Expected, TEXT("Registered")))
+	{
+		return false;
+	}
+
+	// Removals from every range, the first and the last entity of a range included
+	TArray<FUDEntityHandle> Removed = {};
+	for (int32 n = 0; n < Handles.Num(); n += 4)
+	{
+		State.UnregisterActor(Handles[n]);
+		Expected.Remove(Handles[n]);
+		Removed.Add(Handles[n]);
+	}
+	State.UnregisterActor(Handles.Last());
+	Expected.Remove(Handles.Last());
+	Removed.Add(Handles.Last());
+	if (!UD::Tests::CheckEntities(*this, State, Expected, TEXT("Unregistered")))
+	{
+		return false;
+	}
+
+	// The released slots are handed out again with a bumped generation, the old handles stay stale
+	for (const FUDEntityHandle& Handle : Removed)
+	{
+		FUDEntityDesc Entity = {};
+		Entity.Transform.SetLocation(FVector(0., Handle.Index * 100., 0.));
+		Entity.Archetype = EUDArchetype::Mover;
+		const FUDEntityHandle NewHandle = State.RegisterEntity(Entity.Transform, Entity.Archetype);
+		Expected.Add(NewHandle, Entity);
+
+		TestFalse(FString::Printf(TEXT("Removed handle %d is stale"), Handle.Index), State.IsValidHandle(Handle));
+		const bool bReused = Removed.ContainsByPredicate([&NewHandle](const FUDEntityHandle& Old) { return Old.Index == NewHandle.Index && Old.Generation + 1 == NewHandle.Generation; });
+		TestTrue(FString::Printf(TEXT("Slot %d reused with the next generation"), NewHandle.Index), bReused);
+	}
+	for (const FUDEntityHandle& Handle : Removed)
+	{
+		TestFalse(FString::Printf(TEXT("Removed handle %d stays stale once its slot is reused"), Handle.Index), State.IsValidHandle(Handle));
+	}
+	return UD::Tests::CheckEntities(*this, State, Expected, TEXT("Reused"));
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUDSchedulerSerialTest, "UnrealDOD.Simulation.SchedulerMatchesSerial",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FUDSchedulerSerialTest::RunTest(const FString& Parameters)
+{
+	constexpr int32 NumSteps = 30;
+
+	// Steers every entity from its location, so it has to run after the integration and before the next one reads the inputs
+	FUDSystem SteerSystem = {};
+	SteerSystem.Name = TEXT("UD.Tests.Steer");
+	SteerSystem.Reads = EUDComponents::Locations;
+	SteerSystem.Writes = EUDComponents::Inputs;
+	SteerSystem.Execute = [](FUDSimulationState& State, const float& Delta)
+	{
+		for (int32 i = 0; i < State.NumMoving(); i++)
+		{
+			const FVector& Location = State.Locations[i].Value;
+			State.Inputs[i].Movement = (-Location).GetSafeNormal2D();
+			State.Inputs[i].Rotation = FVector(0., FMath::Sign(Location.X), 0.);
+		}
+	};
+
+	// Deterministic states spawn the same accelerations, the graph run has to end exactly where the serial run does
+	FUDSimulationState States[2] = {};
+	FUDScheduler Schedulers[2] = {};
+	for (int32 Run = 0; Run < 2; Run++)
+	{
+		States[Run].Config.bDeterministic = true;
+		TArray<FUDEntityHandle> Handles = {};
+		UD::Tests::PopulateState(States[Run], 20000, Handles);
+		UD::AddBuiltinSystems(Schedulers[Run]);
+		Schedulers[Run].AddSystem(SteerSystem);
+	}
+	for (int32 Step = 0; Step < NumSteps; Step++)
+	{
+		UD::Tests::Step(States[0], Schedulers[0], false);
+		UD::Tests::Step(States[1], Schedulers[1], true);
+	}
+
+	TArray<uint64> ChunkHashes = {};
+	TestEqual(TEXT("State hash of the graph run"), States[1].ComputeStateHash(ChunkHashes), States[0].ComputeStateHash(ChunkHashes));
+	for (int32 i = 0; i < States[0].Num(); i++)
+	{
+		if (States[0].Locations[i].Value != States[1].Locations[i].Value || States[0].Rotations[i].Value != States[1].Rotations[i].Value)
+		{
+			AddError(FString::Printf(TEXT("Entity %d differs after %d steps, serial %s, graph %s"),
+				i, NumSteps, *States[0].Locations[i].Value.ToString(), *States[1].Locations[i].Value.ToString()));
+			return false;
+		}
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUDDirtyMasksTest, "UnrealDOD.Simulation.DirtyMasks",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FUDDirtyMasksTest::RunTest(const FString& Parameters)
+{
+	// Masks of several steps merged into one have to walk the union of their indices once each, in ascending order
+	constexpr int32 NumBits = 1000; // Ends inside a word
+	FRandomStream Random(NumBits);
+	TArray<FUDDirtyMask> StepMasks = {};
+	StepMasks.SetNum(4);
+	TBitArray<> Expected(false, NumBits);
+	for (FUDDirtyMask& Mask : StepMasks)
+	{
+		Mask.Init(NumBits);
+		for (int32 n = 0; n < NumBits / 4; n++)
+		{
+			const int32 Index = n == 0 ? NumBits - 1 : Random.RandRange(0, NumBits - 1);
+			Mask.Set(Index);
+			Expected[Index] = true;
+		}
+	}
+	FUDDirtyMask Merged = {};
+	Merged.Init(NumBits);
+	for (const FUDDirtyMask& Mask : StepMasks)
+	{
+		Merged.Or(Mask);
+	}
+
+	TArray<int32> Walked = {};
+	Merged.ForEachSetBit([&Walked](const int32 Index) { Walked.Add(Index); });
+	TArray<int32> ExpectedIndices = {};
+	for (TConstSetBitIterator<> It(Expected); It; ++It)
+	{
+		ExpectedIndices.Add(It.GetIndex());
+	}
+	TestEqual(TEXT("Set bits of the merged mask"), Merged.CountSetBits(), ExpectedIndices.Num());
+	TestTrue(TEXT("Indices walked from the merged mask"), Walked == ExpectedIndices);
+
+	// After a parallel step exactly the entities that moved or turned are marked, the chunk boundaries included
+	FUDSimulationState State = {};
+	TArray<FUDEntityHandle> Handles = {};
+	UD::Tests::PopulateState(State, 5000, Handles);
+	for (int32 n = 0; n < Handles.Num(); n += 3)
+	{
+		State.SetMovementInput(Handles[n], FUDMovementInput());
+		State.Movements[State.GetDenseIndex(Handles[n])].Gravity = 0.f;
+	}
+	FUDScheduler Scheduler = {};
+	UD::AddBuiltinSystems(Scheduler);
+
+	TArray<FUDLocation> Locations = State.Locations;
+	TArray<FUDRotation> Rotations = State.Rotations;
+	UD::Tests::Step(State, Scheduler, true);
+	for (int32 i = 0; i < State.Num(); i++)
+	{
+		const bool bMoved = State.Locations[i].Value != Locations[i].Value;
+		const bool bTurned = State.Rotations[i].Value != Rotations[i].Value;
+		if (State.GetDirtyMask(EUDDirty::Location).IsSet(i) != bMoved || State.GetDirtyMask(EUDDirty::Rotation).IsSet(i) != bTurned)
+		{
+			AddError(FString::Printf(TEXT("Entity %d moved %d turned %d, its location bit is %d and its rotation bit %d"), i, (int32)bMoved, (int32)bTurned,
+				(int32)State.GetDirtyMask(EUDDirty::Location).IsSet(i), (int32)State.GetDirtyMask(EUDDirty::Rotation).IsSet(i)));
+			return false;
+		}
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUDQueryRangesTest, "UnrealDOD.Simulation.QueryRanges",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FUDQueryRangesTest::RunTest(const FString& Parameters)
+{
+	FUDSimulationState State = {};
+	TArray<FUDEntityHandle> Handles = {};
+	for (int32 n = 0; n < 90; n++)
+	{
+		Handles.Add(State.RegisterEntity(FTransform(FVector(n * 100., 0., 0.)), (EUDArchetype)(n % (int32)EUDArchetype::Num)));
+	}
+
+	// Every query visits each entity holding its components once, in dense order, with the components of that entity
+	auto IsPrefix = [](const TArray<int32>& Indices, const int32& Num)
+	{
+		bool bPrefix = Indices.Num() == Num;
+		for (int32 n = 0; bPrefix && n < Num; n++)
+		{
+			bPrefix = Indices[n] == n;
+		}
+		return bPrefix;
+	};
+	TArray<int32> Visited = {};
+	bool bOwnComponents = true;
+	UD::ForEach<FUDLocation, const FUDCollision>(State, [&](const int32 i, FUDLocation& Location, const FUDCollision& Collision)
+	{
+		Visited.Add(i);
+		bOwnComponents &= &Location == &State.Locations[i] && &Collision == &State.Collisions[i];
+	});
+	TestTrue(TEXT("Collision query visits the agents"), IsPrefix(Visited, State.GetArchetypeEnd(EUDArchetype::Agent)));
+
+	Visited.Reset();
+	UD::ForEach<FUDRotation, const FUDMovement, FUDMovementInput>(State, [&](const int32 i, FUDRotation& Rotation, const FUDMovement& Movement, FUDMovementInput& Input)
+	{
+		Visited.Add(i);
+		bOwnComponents &= &Rotation == &State.Rotations[i] && &Movement == &State.Movements[i] && &Input == &State.Inputs[i];
+	});
+	TestTrue(TEXT("Movement query visits the agents and movers"), IsPrefix(Visited, State.NumMoving()));
+
+	Visited.Reset();
+	UD::ForEach<FUDLocation>(State, [&](const int32 i, FUDLocation& Location) { Visited.Add(i); });
+	TestTrue(TEXT("Location query visits every entity"), IsPrefix(Visited, State.Num()));
+
+	// The awake query only follows the active indices, the sleeping agents are skipped
+	for (int32 n = 0; n < Handles.Num(); n += 6)
+	{
+		State.SetMovementInput(Handles[n], FUDMovementInput());
+	}
+	State.Config.bSleep = true;
+	State.Config.SleepSteps = 1;
+	for (int32 i = 0; i < State.NumMoving(); i++)
+	{
+		State.Movements[i].Gravity = 0.f;
+	}
+	State.BeginStep();
+	State.UpdateLocations(UD::Tests::Delta);
+	State.BeginStep();
+
+	Visited.Reset();
+	const int32 NumActive = State.GetActiveIndices().Num();
+	UD::ForEachActive<FUDLocation, const FUDMovementInput>(State, 0, NumActive, [&](const int32 i, FUDLocation& Location, const FUDMovementInput& Input)
+	{
+		Visited.Add(i);
+		bOwnComponents &= &Location == &State.Locations[i] && &Input == &State.Inputs[i] && State.IsAwake(i);
+	});
+	TestTrue(TEXT("Awake query visits the active indices"), Visited == State.GetActiveIndices());
+	TestTrue(TEXT("Awake query skips the sleepers"), NumActive < State.NumMoving());
+	TestTrue(TEXT("Queries hand every entity its own components"), bOwnComponents);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FUDBulkRegistrationTest, "UnrealDOD.Simulation.BulkRegistration",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FUDBulkRegistrationTest::RunTest(const FString& Parameters)
+{
+	// A batch lands on a state that already holds every archetype, so each later range shifts by the entities added in front of it
+	FUDSimulationState State = {};
+	TMap<FUDEntityHandle, FUDEntityDesc> Expected = {};
+	for (int32 n = 0; n < 30; n++)
+	{
+		FUDEntityDesc Entity = {};
+		Entity.Transform.SetLocation(FVector(n * 100., 0., 0.));
+		Entity.Archetype = (EUDArchetype)(n % (int32)EUDArchetype::Num);
+		Expected.Add(State.RegisterEntity(Entity.Transform, Entity.Archetype), Entity);
+	}
+
+	// Reserved handles are taken ahead of the batch like the queued registrations do, the others are allocated by it
+	TArray<FUDEntityDesc> Entities = {};
+	Entities.SetNum(100);
+	for (int32 n = 0; n < Entities.Num(); n++)
+	{
+		Entities[n].Transform.SetLocation(FVector(0., n * 100., 0.));
+		Entities[n].Archetype = (EUDArchetype)((int32)EUDArchetype::Num - 1 - n % (int32)EUDArchetype::Num);
+		if (n % 5 == 0)
+		{
+			Entities[n].Handle = State.HandleAllocator.Allocate();
+		}
+	}
+	TArray<FUDEntityHandle> Handles = {};
+	State.RegisterEntities(Entities, Handles);
+
+	if (!TestEqual(TEXT("Handles returned"), Handles.Num(), Entities.Num()))
+	{
+		return false;
+	}
+	for (int32 n = 0; n < Entities.Num(); n++)
+	{
+		if (Entities[n].Handle.IsSet())
+		{
+			TestTrue(FString::Printf(TEXT("Entity %d keeps its reserved handle"), n), Handles[n] == Entities[n].Handle);
+		}
+		TestFalse(FString::Printf(TEXT("Entity %d has its own handle"), n), Expected.Contains(Handles[n]));
+		Expected.Add(Handles[n], Entities[n]);
+	}
+	return UD::Tests::CheckEntities(*this, State, Expected, TEXT("Bulk registered"));
+}
+
+#endif
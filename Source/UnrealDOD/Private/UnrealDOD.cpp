@@ -1,11 +1,18 @@
 // Copyright - Jed
 
 #include "UnrealDOD.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Parse.h"
+#include "Systems/UDHeapCounter.h"
 
 #define LOCTEXT_NAMESPACE "FUnrealDODModule"
 
 void FUnrealDODModule::StartupModule()
 {
+	if (FParse::Param(FCommandLine::Get(), TEXT("UDHeapCounter")))
+	{
+		FUDHeapCounter::Install(); // Fills FUDSimulationStats::NumStepHeapAllocations
+	}
 }
 
 void FUnrealDODModule::ShutdownModule()
@@ -0,0 +1,39 @@
+// Copyright - Jed
+
+#pragma once
+
+// Engine independent simulation core, plain C++17 on the standard library only.
+// Everything under Core/ is shared by the UnrealDOD module and by Tools/UDCoreBench, it must never include engine headers.
+
+#include <cstdint>
+#include <cstddef>
+
+#ifndef UD_CORE_CHECK
+	#ifdef check // Inside the engine
+		#define UD_CORE_CHECK(Expr) check(Expr)
+	#else
+		#include <cassert>
+		#define UD_CORE_CHECK(Expr) assert(Expr)
+	#endif
+#endif
+
+#define UD_CORE_CACHE_LINE_SIZE 64
+
+namespace UD::Core
+{
+	inline constexpr int32_t StreamWidth = 4;			// Same as UD_STREAM_WIDTH
+	inline constexpr float SmallNumber = 1.e-8f;		// Same as UE_SMALL_NUMBER
+	inline constexpr float KindaSmallNumber = 1.e-4f;	// Same as UE_KINDA_SMALL_NUMBER
+
+	constexpr int32_t AlignUp(const int32_t& Value, const int32_t& Alignment) { return (Value + Alignment - 1) & ~(Alignment - 1); }
+
+	constexpr uint32_t RoundUpToPowerOfTwo(const uint32_t& Value)
+	{
+		uint32_t Result = 1;
+		while (Result < Value)
+		{
+			Result <<= 1;
+		}
+		return Result;
+	}
+}
@@ -0,0 +1,80 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "Core/UDCore.h"
+#include <cstring>
+
+namespace UD::Core
+{
+	// Streaming 64 bit hash over words, four independent lanes so consecutive words do not wait on each other's multiply.
+	// Values are hashed by their bits, callers feed fields one by one so struct padding never reaches the hash.
+	class FStateHasher
+	{
+	public:
+
+		explicit FStateHasher(const uint64_t& Seed = 0)
+		{
+			Lanes[0] = Seed + Prime1 + Prime2;
+			Lanes[1] = Seed + Prime2;
+			Lanes[2] = Seed;
+			Lanes[3] = Seed - Prime1;
+		}
+
+		void AddWord(const uint64_t& Word)
+		{
+			uint64_t& Lane = Lanes[NumWords & 3];
+			Lane = RotateLeft(Lane + Word * Prime2, 31) * Prime1;
+			NumWords++;
+		}
+
+		void AddFloat(const float& Value)
+		{
+			uint32_t Bits = 0;
+			std::memcpy(&Bits, &Value, sizeof(Bits));
+			AddWord(Bits);
+		}
+
+		void AddDouble(const double& Value)
+		{
+			uint64_t Bits = 0;
+			std::memcpy(&Bits, &Value, sizeof(Bits));
+			AddWord(Bits);
+		}
+
+		uint64_t Finish() const
+		{
+			uint64_t Hash = RotateLeft(Lanes[0], 1) + RotateLeft(Lanes[1], 7) + RotateLeft(Lanes[2], 12) + RotateLeft(Lanes[3], 18);
+			return Mix(Hash ^ NumWords);
+		}
+
+	private:
+
+		static constexpr uint64_t Prime1 = 0x9E3779B185EBCA87ull;
+		static constexpr uint64_t Prime2 = 0xC2B2AE3D27D4EB4Full;
+
+		static uint64_t RotateLeft(const uint64_t& Value, const int32_t& Bits) { return (Value << Bits) | (Value >> (64 - Bits)); }
+
+		uint64_t Lanes[4] = {};
+		uint64_t NumWords = 0;
+
+	public:
+
+		// Final avalanche, also used to combine finished hashes
+		static uint64_t Mix(uint64_t Hash)
+		{
+			Hash ^= Hash >> 33;
+			Hash *= Prime2;
+			Hash ^= Hash >> 29;
+			Hash *= Prime1;
+			Hash ^= Hash >> 32;
+			return Hash;
+		}
+	};
+
+	// Order dependent, combining chunk hashes in chunk order gives the state hash
+	inline uint64_t CombineHashes(const uint64_t& Hash, const uint64_t& Other)
+	{
+		return FStateHasher::Mix(Hash ^ (Other + 0x9E3779B97F4A7C15ull + (Hash << 6) + (Hash >> 2)));
+	}
+}
@@ -0,0 +1,299 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "Core/UDCore.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace UD::Core
+{
+	// Uniform grid on the ground plane, rebuilt from scratch every frame.
+	// Entities are counting sorted by cell so the entities of a cell are contiguous and a neighbour query walks a few short runs.
+	// Cells are hashed into a power of two bucket table so the grid has no bounds, two cells sharing a bucket only cost extra candidates.
+	// Build is split in phases so the caller can run every pass but PrefixPartitions on its own workers.
+	class FSpatialHash
+	{
+	public:
+
+		static constexpr int32_t NumPartitions = 64; // Never more than the buckets, each holds at least one
+
+		// X and Y are indexed by dense index, CellSize should be at least the largest query distance
+		void Build(const float* X, const float* Y, const int32_t& NumEntities, const float& InCellSize)
+		{
+			BeginBuild(NumEntities, InCellSize);
+			HashRange(X, Y, 0, NumEntities);
+			Sort();
+			GatherRange(X, Y, 0, NumEntities);
+		}
+
+		// Every phase on the calling thread
+		void Sort()
+		{
+			const int32_t NumEntities = (int32_t)EntityBuckets.size();
+			BeginSort(1);
+			CountRange(0, 0, NumEntities);
+			PrefixPartitions();
+			ScatterRange(0, 0, NumEntities);
+			for (int32_t Partition = 0; Partition < NumPartitions; Partition++)
+			{
+				SortPartition(Partition);
+			}
+		}
+
+		void BeginBuild(const int32_t& NumEntities, const float& InCellSize)
+		{
+			CellSize = std::max(InCellSize, KindaSmallNumber);
+			InvCellSize = 1.f / CellSize;
+
+			// Twice as many buckets as entities keeps the runs short without making the prefix sum dominate
+			const uint32_t NumBuckets = RoundUpToPowerOfTwo((uint32_t)std::max(NumEntities * 2, MinBuckets));
+			BucketMask = NumBuckets - 1;
+			PartitionShift = 0;
+			while ((NumBuckets >> PartitionShift) > (uint32_t)NumPartitions)
+			{
+				PartitionShift++;
+			}
+			EntityBuckets.resize(NumEntities);
+			BucketStarts.resize(NumBuckets + 1);
+			BucketCursors.resize(NumBuckets);
+			PartitionedIndices.resize(NumEntities);
+			SortedIndices.resize(NumEntities);
+			SortedX.resize(NumEntities);
+			SortedY.resize(NumEntities);
+		}
+
+		// Parallel safe on disjoint ranges
+		void HashRange(const float* X, const float* Y, const int32_t& Begin, const int32_t& End)
+		{
+			for (int32_t i = Begin; i < End; i++)
+			{
+				EntityBuckets[i] = HashCell(GetCell(X[i]), GetCell(Y[i])) & BucketMask;
+			}
+		}
+
+		// Counting sort in two levels so every pass but the prefix sums runs on disjoint data and a bucket still lists its entities in dense order.
+		// The entities are first scattered by partition, a contiguous run of buckets, with one count row per chunk of the dense range.
+		// Each partition is then counting sorted on its own. The result is the same for any number of chunks.
+		void BeginSort(const int32_t& NumChunks)
+		{
+			ChunkPartitionCounts.resize((size_t)std::max(NumChunks, 1) * NumPartitions);
+		}
+
+		// Parallel safe on disjoint chunks, after HashRange covered the chunk
+		void CountRange(const int32_t& ChunkIndex, const int32_t& Begin, const int32_t& End)
+		{
+			int32_t* Counts = &ChunkPartitionCounts[(size_t)ChunkIndex * NumPartitions];
+			std::memset(Counts, 0, NumPartitions * sizeof(int32_t));
+			for (int32_t i = Begin; i < End; i++)
+			{
+				Counts[EntityBuckets[i] >> PartitionShift]++;
+			}
+		}
+
+		// Serial, turns the chunk counts into scatter offsets, partitions first then chunks in dense order
+		void PrefixPartitions()
+		{
+			const int32_t NumChunks = (int32_t)(ChunkPartitionCounts.size() / NumPartitions);
+			int32_t Offset = 0;
+			for (int32_t Partition = 0; Partition < NumPartitions; Partition++)
+			{
+				PartitionStarts[Partition] = Offset;
+				for (int32_t Chunk = 0; Chunk < NumChunks; Chunk++)
+				{
+					int32_t& Count = ChunkPartitionCounts[(size_t)Chunk * NumPartitions + Partition];
+					const int32_t ChunkCount = Count;
+					Count = Offset;
+					Offset += ChunkCount;
+				}
+			}
+			PartitionStarts[NumPartitions] = Offset;
+			BucketStarts[BucketMask + 1] = Offset;
+		}
+
+		// Parallel safe on disjoint chunks, same chunks as CountRange
+		void ScatterRange(const int32_t& ChunkIndex, const int32_t& Begin, const int32_t& End)
+		{
+			int32_t* Cursors = &ChunkPartitionCounts[(size_t)ChunkIndex * NumPartitions];
+			for (int32_t i = Begin; i < End; i++)
+			{
+				PartitionedIndices[Cursors[EntityBuckets[i] >> PartitionShift]++] = i;
+			}
+		}
+
+		// Parallel safe on disjoint partitions, writes only the buckets and the sorted slots of the partition
+		void SortPartition(const int32_t& Partition)
+		{
+			const uint32_t FirstBucket = (uint32_t)Partition << PartitionShift;
+			const uint32_t EndBucket = std::min((uint32_t)(Partition + 1) << PartitionShift, BucketMask + 1);
+			const int32_t Begin = PartitionStarts[Partition];
+			const int32_t End = PartitionStarts[Partition + 1];
+			for (uint32_t b = FirstBucket; b < EndBucket; b++)
+			{
+				BucketCursors[b] = 0;
+			}
+			for (int32_t s = Begin; s < End; s++)
+			{
+				BucketCursors[EntityBuckets[PartitionedIndices[s]]]++;
+			}
+			int32_t Start = Begin;
+			for (uint32_t b = FirstBucket; b < EndBucket; b++)
+			{
+				BucketStarts[b] = Start;
+				Start += BucketCursors[b];
+				BucketCursors[b] = BucketStarts[b];
+			}
+			for (int32_t s = Begin; s < End; s++)
+			{
+				const int32_t i = PartitionedIndices[s];
+				SortedIndices[BucketCursors[EntityBuckets[i]]++] = i;
+			}
+		}
+
+		// Parallel safe on disjoint ranges of the sorted arrays
+		void GatherRange(const float* X, const float* Y, const int32_t& Begin, const int32_t& End)
+		{
+			for (int32_t s = Begin; s < End; s++)
+			{
+				SortedX[s] = X[SortedIndices[s]];
+				SortedY[s] = Y[SortedIndices[s]];
+			}
+		}
+
+		void Reset()
+		{
+			BucketMask = 0;
+			BucketStarts.clear();
+			EntityBuckets.clear();
+			BucketCursors.clear();
+			ChunkPartitionCounts.clear();
+			PartitionedIndices.clear();
+			SortedIndices.clear();
+			SortedX.clear();
+			SortedY.clear();
+		}
+
+		// Calls Function(Index, X, Y) for every entity in the 3x3 cells around the position, distances are left to the caller
+		template<typename FunctionType>
+		void ForEachNeighbour(const float& X, const float& Y, FunctionType&& Function) const
+		{
+			if (BucketStarts.empty())
+			{
+				return;
+			}
+
+			const int32_t CellX = GetCell(X);
+			const int32_t CellY = GetCell(Y);
+			uint32_t Visited[9] = {};
+			int32_t NumVisited = 0;
+			for (int32_t OffsetY = -1; OffsetY <= 1; OffsetY++)
+			{
+				for (int32_t OffsetX = -1; OffsetX <= 1; OffsetX++)
+				{
+					const uint32_t Bucket = HashCell(CellX + OffsetX, CellY + OffsetY) & BucketMask;
+					bool bVisited = false;
+					for (int32_t v = 0; v < NumVisited; v++)
+					{
+						bVisited |= Visited[v] == Bucket;
+					}
+					if (bVisited)
+					{
+						continue; // Two neighbour cells in the same bucket, the run was already walked
+					}
+					Visited[NumVisited++] = Bucket;
+
+					const int32_t RunEnd = BucketStarts[Bucket + 1];
+					for (int32_t s = BucketStarts[Bucket]; s < RunEnd; s++)
+					{
+						Function(SortedIndices[s], SortedX[s], SortedY[s]);
+					}
+				}
+			}
+		}
+
+		int32_t Num() const { return (int32_t)SortedIndices.size(); }
+		const int32_t* GetSortedIndices() const { return SortedIndices.data(); }
+		float GetCellSize() const { return CellSize; }
+		int32_t GetNumBuckets() const { return std::max((int32_t)BucketStarts.size() - 1, 0); }
+		size_t GetAllocatedSize() const
+		{
+			return BucketStarts.capacity() * sizeof(int32_t) + EntityBuckets.capacity() * sizeof(uint32_t) + BucketCursors.capacity() * sizeof(int32_t)
+				+ ChunkPartitionCounts.capacity() * sizeof(int32_t) + PartitionedIndices.capacity() * sizeof(int32_t) + SortedIndices.capacity() * sizeof(int32_t) + SortedX.capacity() * sizeof(float) + SortedY.capacity() * sizeof(float);
+		}
+
+	private:
+
+		static constexpr int32_t MinBuckets = NumPartitions;
+
+		int32_t GetCell(const float& Value) const { return (int32_t)std::floor(Value * InvCellSize); }
+		static uint32_t HashCell(const int32_t& CellX, const int32_t& CellY) { return ((uint32_t)CellX * 73856093u) ^ ((uint32_t)CellY * 19349663u); }
+
+		float CellSize = 100.f;
+		float InvCellSize = 0.01f;
+		uint32_t BucketMask = 0;
+		uint32_t PartitionShift = 0;	// Bucket to partition
+
+		std::vector<int32_t> BucketStarts = {};		// Start of every bucket run in the sorted arrays, plus the end of the last one
+		std::vector<uint32_t> EntityBuckets = {};	// Indexed by dense index
+		std::vector<int32_t> BucketCursors = {};
+		std::vector<int32_t> ChunkPartitionCounts = {};	// Row per chunk, counts then scatter cursors
+		std::vector<int32_t> PartitionedIndices = {};	// Dense indices grouped by partition, in dense order within one
+		int32_t PartitionStarts[NumPartitions + 1] = {};
+
+		// Cell ordered copies, read by the queries instead of the dense arrays
+		std::vector<int32_t> SortedIndices = {};
+		std::vector<float> SortedX = {};
+		std::vector<float> SortedY = {};
+	};
+
+	// Push that moves Index out of every neighbour closer than the sum of both radii, each side of a pair moves by half the overlap.
+	// Returns false when there is nothing to push. GetRadius(Index) returns the radius of any entity.
+	template<typename RadiusGetterType>
+	bool ComputeSeparation(const FSpatialHash& Hash, const int32_t& Index, const float& X, const float& Y, RadiusGetterType&& GetRadius,
+		const float& Stiffness, const float& MaxPush, float& OutPushX, float& OutPushY)
+	{
+		const float Radius = GetRadius(Index);
+		float PushX = 0.f;
+		float PushY = 0.f;
+		Hash.ForEachNeighbour(X, Y, [&](const int32_t Other, const float OtherX, const float OtherY)
+		{
+			const float MinDistance = Radius + GetRadius(Other);
+			const float DeltaX = X - OtherX;
+			const float DeltaY = Y - OtherY;
+			const float DistanceSquared = DeltaX * DeltaX + DeltaY * DeltaY;
+			if (Other == Index || DistanceSquared >= MinDistance * MinDistance)
+			{
+				return;
+			}
+
+			const float Distance = std::sqrt(DistanceSquared);
+			const float Push = (MinDistance - Distance) * 0.5f * Stiffness;
+			if (Distance > KindaSmallNumber)
+			{
+				PushX += DeltaX / Distance * Push;
+				PushY += DeltaY / Distance * Push;
+			}
+			else
+			{
+				PushX += Other < Index ? Push : -Push; // Stacked entities split along X in a deterministic direction
+			}
+		});
+
+		if (PushX == 0.f && PushY == 0.f)
+		{
+			return false;
+		}
+
+		const float PushSize = std::sqrt(PushX * PushX + PushY * PushY);
+		if (PushSize > MaxPush)
+		{
+			PushX *= MaxPush / PushSize;
+			PushY *= MaxPush / PushSize;
+		}
+		OutPushX = PushX;
+		OutPushY = PushY;
+		return true;
+	}
+}
@@ -0,0 +1,100 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "Core/UDCore.h"
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+namespace UD::Core
+{
+	// Bounded lock free ring for exactly one producer thread and one consumer thread.
+	// Head and tail live on their own cache lines, each side caches the other side's index to avoid
+	// touching the shared line on every call.
+	template<typename ElementType>
+	class TSpscRing
+	{
+	public:
+
+		explicit TSpscRing(const uint32_t InCapacity = 64)
+		{
+			Slots.resize(RoundUpToPowerOfTwo(std::max<uint32_t>(InCapacity, 2)));
+			Mask = (uint32_t)Slots.size() - 1;
+		}
+
+		TSpscRing(const TSpscRing&) = delete;
+		TSpscRing& operator=(const TSpscRing&) = delete;
+
+		// Producer, returns false instead of waiting when the ring is full
+		bool Push(ElementType&& Element)
+		{
+			const uint32_t Tail = TailIndex.load(std::memory_order_relaxed);
+			if (Tail - CachedHead > Mask)
+			{
+				CachedHead = HeadIndex.load(std::memory_order_acquire);
+				if (Tail - CachedHead > Mask)
+				{
+					return false;
+				}
+			}
+			Slots[Tail & Mask] = std::move(Element);
+			TailIndex.store(Tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Consumer, the element stays valid until Pop
+		ElementType* Peek()
+		{
+			const uint32_t Head = HeadIndex.load(std::memory_order_relaxed);
+			if (Head == CachedTail)
+			{
+				CachedTail = TailIndex.load(std::memory_order_acquire);
+				if (Head == CachedTail)
+				{
+					return nullptr;
+				}
+			}
+			return &Slots[Head & Mask];
+		}
+
+		// Consumer
+		void Pop()
+		{
+			const uint32_t Head = HeadIndex.load(std::memory_order_relaxed);
+			UD_CORE_CHECK(Head != TailIndex.load(std::memory_order_acquire));
+			Slots[Head & Mask] = ElementType(); // Release whatever the element holds on the consumer side
+			HeadIndex.store(Head + 1, std::memory_order_release);
+		}
+
+		// Consumer
+		bool Pop(ElementType& OutElement)
+		{
+			ElementType* Element = Peek();
+			if (!Element)
+			{
+				return false;
+			}
+			OutElement = std::move(*Element);
+			Pop();
+			return true;
+		}
+
+		// Approximate when called from a third thread
+		uint32_t Num() const { return TailIndex.load(std::memory_order_acquire) - HeadIndex.load(std::memory_order_acquire); }
+		bool IsEmpty() const { return Num() == 0; }
+		uint32_t Capacity() const { return Mask + 1; }
+
+	private:
+
+		std::vector<ElementType> Slots = {};
+		uint32_t Mask = 0;
+
+		alignas(UD_CORE_CACHE_LINE_SIZE) std::atomic<uint32_t> TailIndex{ 0 };	// Written by the producer
+		uint32_t CachedHead = 0;												// Producer copy of HeadIndex
+
+		alignas(UD_CORE_CACHE_LINE_SIZE) std::atomic<uint32_t> HeadIndex{ 0 };	// Written by the consumer
+		uint32_t CachedTail = 0;												// Consumer copy of TailIndex
+	};
+}
@@ -0,0 +1,77 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "Core/UDCore.h"
+#include <algorithm>
+#include <cmath>
+
+namespace UD::Core
+{
+	// Raw pointers to the split movement streams, one float per entity per stream.
+	// Streams are padded with zeroed lanes up to a multiple of StreamWidth so kernels never need a scalar tail.
+	struct FMovementStreamsView
+	{
+		float* PositionX = nullptr;
+		float* PositionY = nullptr;
+		float* PositionZ = nullptr;
+		float* VelocityX = nullptr;
+		float* VelocityY = nullptr;
+		float* VelocityZ = nullptr;
+		const float* InputX = nullptr;
+		const float* InputY = nullptr;
+		const float* InputZ = nullptr;
+		const float* Acceleration = nullptr;
+		const float* Deceleration = nullptr;
+		const float* MaxSpeed = nullptr;
+		const float* Gravity = nullptr;
+	};
+
+	// Gravity + input acceleration + deceleration + max speed clamp, then moves the position by the new velocity.
+	// End is rounded up into the padding.
+	inline void IntegrateScalar(const FMovementStreamsView& Streams, const int32_t& Begin, const int32_t& End, const float& Delta)
+	{
+		float* PosX = Streams.PositionX;
+		float* PosY = Streams.PositionY;
+		float* PosZ = Streams.PositionZ;
+		float* VelX = Streams.VelocityX;
+		float* VelY = Streams.VelocityY;
+		float* VelZ = Streams.VelocityZ;
+
+		const int32_t AlignedEnd = AlignUp(End, StreamWidth);
+		for (int32_t i = Begin; i < AlignedEnd; i++)
+		{
+			float AccX = Streams.InputX[i] * Streams.Acceleration[i];
+			float AccY = Streams.InputY[i] * Streams.Acceleration[i];
+			float AccZ = Streams.InputZ[i] * Streams.Acceleration[i] - Streams.Gravity[i];
+
+			// Same as FVector::GetSafeNormal, the deceleration force is only applied to a non zero velocity
+			const float Decel = Streams.Deceleration[i];
+			const float SpeedSquared = VelX[i] * VelX[i] + VelY[i] * VelY[i] + VelZ[i] * VelZ[i];
+			if (Decel > 0.f && SpeedSquared > SmallNumber)
+			{
+				const float Speed = std::sqrt(SpeedSquared);
+				const float DecelScale = std::min(Speed, Decel) * Decel / Speed;
+				AccX -= VelX[i] * DecelScale;
+				AccY -= VelY[i] * DecelScale;
+				AccZ -= VelZ[i] * DecelScale;
+			}
+
+			VelX[i] += AccX * Delta;
+			VelY[i] += AccY * Delta;
+			VelZ[i] += AccZ * Delta;
+
+			// Same as FVector::GetClampedToMaxSize
+			const float MaxSpeed = Streams.MaxSpeed[i];
+			const float NewSpeedSquared = VelX[i] * VelX[i] + VelY[i] * VelY[i] + VelZ[i] * VelZ[i];
+			const float ClampScale = MaxSpeed < KindaSmallNumber ? 0.f : NewSpeedSquared > MaxSpeed * MaxSpeed ? MaxSpeed / std::sqrt(NewSpeedSquared) : 1.f;
+			VelX[i] *= ClampScale;
+			VelY[i] *= ClampScale;
+			VelZ[i] *= ClampScale;
+
+			PosX[i] += VelX[i] * Delta;
+			PosY[i] += VelY[i] * Delta;
+			PosZ[i] += VelZ[i] * Delta;
+		}
+	}
+}
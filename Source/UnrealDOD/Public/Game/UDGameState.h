@@ -25,6 +25,9 @@ protected:
 	virtual void Tick(float DeltaSeconds);
 	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "DOD")
+	FUDSimulationConfig SimulationConfig = {};
+
 private:
 
 	FUDSimulation* Simulation = nullptr;
@@ -0,0 +1,72 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Components tracked by the change masks, a mask is only written by the systems that write its component
+enum class EUDDirty : uint8
+{
+	Location,	// EUDComponents::Locations
+	Rotation,	// EUDComponents::Rotations
+	Velocity,	// EUDComponents::Locations, integrated or stopped
+	Num
+};
+
+// One bit per dense index in 64 bit words, merged word by word and walked with count trailing zeros
+struct UNREALDOD_API FUDDirtyMask
+{
+	void Init(const int32& InNumBits); // Every bit cleared, the allocation is kept
+	void CopyFrom(const FUDDirtyMask& Other);
+	void Or(const FUDDirtyMask& Other); // Both masks must have the same size
+
+	FORCEINLINE void Set(const int32& Index) { Words[Index >> 6] |= 1ull << (Index & 63); };
+	FORCEINLINE void SetAtomic(const int32& Index) { FPlatformAtomics::InterlockedOr((volatile int64*)&Words[Index >> 6], (int64)(1ull << (Index & 63))); };
+	FORCEINLINE bool IsSet(const int32& Index) const { return (Words[Index >> 6] >> (Index & 63)) & 1; };
+	FORCEINLINE int32 Num() const { return NumBits; };
+	int32 CountSetBits() const;
+
+	template<typename FunctionType>
+	void ForEachSetBit(FunctionType&& Function) const
+	{
+		for (int32 WordIndex = 0; WordIndex < Words.Num(); WordIndex++)
+		{
+			for (uint64 Word = Words[WordIndex]; Word != 0; Word &= Word - 1)
+			{
+				Function(WordIndex * 64 + (int32)FMath::CountTrailingZeros64(Word));
+			}
+		}
+	}
+
+private:
+
+	TArray<uint64> Words = {};
+	int32 NumBits = 0;
+};
+
+// Sets the bits of one parallel chunk. Chunks cover disjoint ascending index ranges, only the words at both ends can be shared with the
+// neighbour chunks so only those are written atomically.
+struct FUDDirtyMaskChunkWriter
+{
+	FUDDirtyMaskChunkWriter(FUDDirtyMask& InMask, const int32& FirstIndex, const int32& LastIndex)
+		: Mask(InMask), FirstWord(FirstIndex >> 6), LastWord(LastIndex >> 6) {};
+
+	FORCEINLINE void Set(const int32& Index)
+	{
+		const int32 Word = Index >> 6;
+		if (Word == FirstWord || Word == LastWord)
+		{
+			Mask.SetAtomic(Index);
+		}
+		else
+		{
+			Mask.Set(Index);
+		}
+	}
+
+private:
+
+	FUDDirtyMask& Mask;
+	int32 FirstWord = 0;
+	int32 LastWord = 0;
+};
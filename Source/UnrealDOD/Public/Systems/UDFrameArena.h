@@ -0,0 +1,147 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+
+// Bump allocator for the scratch data of one simulation step, everything is released at once by Reset.
+// The blocks are kept between steps and merged into one when a step needed more than the first, so a steady simulation never reaches the heap for its scratch.
+// Thread safe, the systems of a step allocate from the same arena.
+class UNREALDOD_API FUDFrameArena
+{
+public:
+
+	FUDFrameArena() = default;
+	FUDFrameArena(const FUDFrameArena&) = delete;
+	FUDFrameArena& operator=(const FUDFrameArena&) = delete;
+	~FUDFrameArena();
+
+	void* Allocate(const SIZE_T& Size, const uint32& Alignment);
+	void* Reallocate(void* Data, const SIZE_T& PreviousSize, const SIZE_T& Size, const uint32& Alignment); // Grows in place when Data is the last allocation
+	void Reset(); // Invalidates every allocation
+
+	FORCEINLINE uint64 GetNumHeapAllocations() const { return NumHeapAllocations; };	// Blocks the arena requested from the heap since it was created, see FUDHeapCounter for every allocation of a step
+	FORCEINLINE SIZE_T GetUsedBytes() const { return UsedBytes; };						// Since the last reset
+	FORCEINLINE SIZE_T GetPeakBytes() const { return PeakBytes; };
+	SIZE_T GetAllocatedSize() const;
+
+	// Arena used by TUDFrameAllocator on this thread
+	static FUDFrameArena* GetCurrent();
+
+	struct UNREALDOD_API FScope
+	{
+		explicit FScope(FUDFrameArena& Arena);
+		explicit FScope(FUDFrameArena* Arena); // None leaves the thread without an arena
+		~FScope();
+
+	private:
+
+		FUDFrameArena* Previous = nullptr;
+	};
+
+private:
+
+	struct FBlock
+	{
+		uint8* Data = nullptr;
+		SIZE_T Size = 0;
+	};
+
+	void* AllocateLocked(const SIZE_T& Size, const uint32& Alignment);
+	void AddBlock(const SIZE_T& MinSize);
+
+	mutable FCriticalSection Mutex;
+	TArray<FBlock, TInlineAllocator<4>> Blocks = {};
+	int32 BlockIndex = 0;			// Block allocated from
+	SIZE_T Offset = 0;				// In the current block
+	uint8* LastAllocation = nullptr;
+	SIZE_T UsedBytes = 0;
+	SIZE_T PeakBytes = 0;
+	uint64 NumHeapAllocations = 0;
+};
+
+// TArray allocator policy on the current frame arena, the elements must not outlive the next reset.
+// Shrinking never gives memory back and the arena owns the memory, so the containers never free anything.
+template<uint32 Alignment = DEFAULT_ALIGNMENT>
+class TUDFrameAllocator
+{
+public:
+
+	using SizeType = int32;
+
+	enum { NeedsElementType = false };
+	enum { RequireRangeCheck = true };
+
+	class ForAnyElementType
+	{
+	public:
+
+		ForAnyElementType() = default;
+		ForAnyElementType(const ForAnyElementType&) = delete;
+		ForAnyElementType& operator=(const ForAnyElementType&) = delete;
+
+		FORCEINLINE void MoveToEmpty(ForAnyElementType& Other)
+		{
+			checkSlow(this != &Other);
+			Data = Other.Data;
+			Arena = Other.Arena;
+			Other.Data = nullptr;
+		}
+
+		FORCEINLINE FScriptContainerElement* GetAllocation() const { return Data; }
+
+		void ResizeAllocation(SizeType PreviousNumElements, SizeType NumElements, SIZE_T NumBytesPerElement)
+		{
+			if (NumElements == 0)
+			{
+				Data = nullptr;
+				return;
+			}
+
+			Arena = Data ? Arena : FUDFrameArena::GetCurrent();
+			checkf(Arena, TEXT("TUDFrameAllocator - Allocating outside of a FUDFrameArena::FScope"));
+			Data = (FScriptContainerElement*)Arena->Reallocate(Data, (SIZE_T)PreviousNumElements * NumBytesPerElement, (SIZE_T)NumElements * NumBytesPerElement, Alignment);
+		}
+
+		FORCEINLINE SizeType CalculateSlackReserve(SizeType NumElements, SIZE_T NumBytesPerElement) const
+		{
+			return DefaultCalculateSlackReserve(NumElements, NumBytesPerElement, false, Alignment);
+		}
+
+		FORCEINLINE SizeType CalculateSlackShrink(SizeType NumElements, SizeType NumAllocatedElements, SIZE_T NumBytesPerElement) const
+		{
+			return NumAllocatedElements; // The memory would not be reused before the reset anyway
+		}
+
+		FORCEINLINE SizeType CalculateSlackGrow(SizeType NumElements, SizeType NumAllocatedElements, SIZE_T NumBytesPerElement) const
+		{
+			return DefaultCalculateSlackGrow(NumElements, NumAllocatedElements, NumBytesPerElement, false, Alignment);
+		}
+
+		FORCEINLINE SIZE_T GetAllocatedSize(SizeType NumAllocatedElements, SIZE_T NumBytesPerElement) const { return NumAllocatedElements * NumBytesPerElement; }
+		FORCEINLINE bool HasAllocation() const { return !!Data; }
+		FORCEINLINE SizeType GetInitialCapacity() const { return 0; }
+
+	private:
+
+		FScriptContainerElement* Data = nullptr;
+		FUDFrameArena* Arena = nullptr; // Kept so a container grown on a worker stays in the arena it started in
+	};
+
+	template<typename ElementType>
+	class ForElementType : public ForAnyElementType
+	{
+	public:
+
+		FORCEINLINE ElementType* GetAllocation() const { return (ElementType*)ForAnyElementType::GetAllocation(); }
+	};
+};
+
+template<uint32 Alignment>
+struct TAllocatorTraits<TUDFrameAllocator<Alignment>> : TAllocatorTraitsBase<TUDFrameAllocator<Alignment>>
+{
+	enum { IsZeroConstruct = true };
+};
+
+using FUDFrameIndices = TArray<int32, TUDFrameAllocator<>>; // Dense indices valid until the next step
@@ -0,0 +1,72 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/DataAsset.h"
+#include "UDGroundField.generated.h"
+
+UENUM()
+enum class EUDGroundSample : uint8
+{
+	Outside,	// Not covered by the field
+	Valid,
+	Complex,	// Overhangs, holes or geometry the grid cannot describe, callers should fall back to a trace
+};
+
+// Height and normal grid baked from the static geometry of a level, sampled by the simulation thread instead of tracing.
+// Vertices are CellSize apart from Origin, normals are quantized to 8 bits per axis and always point up.
+UCLASS(BlueprintType)
+class UNREALDOD_API UUDGroundField : public UDataAsset
+{
+	GENERATED_BODY()
+
+public:
+
+	// Game thread, traces NumX * NumY vertices plus one or two traces per cell to flag the complex ones
+	void Bake(UWorld* World, const FBox& Bounds, const float& InCellSize);
+
+	// Bilinear lookup, any thread
+	EUDGroundSample Sample(const float& X, const float& Y, float& OutHeight, FVector3f& OutNormal) const;
+
+	FORCEINLINE bool IsEmpty() const { return Heights.Num() == 0; };
+
+	// Height difference between the baked surface and a trace at the cell center above which the cell is flagged complex
+	UPROPERTY(EditAnywhere, Category = "Bake", meta = (ClampMin = "0"))
+	float ComplexTolerance = 10.f;
+
+protected:
+
+	UPROPERTY(VisibleAnywhere, Category = "Field")
+	FVector2f Origin = FVector2f::ZeroVector;
+
+	UPROPERTY(VisibleAnywhere, Category = "Field")
+	float CellSize = 100.f;
+
+	UPROPERTY(VisibleAnywhere, Category = "Field")
+	int32 NumX = 0;
+
+	UPROPERTY(VisibleAnywhere, Category = "Field")
+	int32 NumY = 0;
+
+	UPROPERTY()
+	TArray<float> Heights = {};		// Per vertex
+
+	UPROPERTY()
+	TArray<int8> NormalsX = {};		// Per vertex, Z is rebuilt from X and Y
+
+	UPROPERTY()
+	TArray<int8> NormalsY = {};
+
+	UPROPERTY()
+	TArray<uint8> ComplexCells = {};	// Per cell, 1 for complex
+
+private:
+
+	FORCEINLINE FVector3f GetNormal(const int32& Vertex) const
+	{
+		const float X = NormalsX[Vertex] / 127.f;
+		const float Y = NormalsY[Vertex] / 127.f;
+		return FVector3f(X, Y, FMath::Sqrt(FMath::Max(1.f - X * X - Y * Y, 0.f)));
+	};
+};
@@ -0,0 +1,41 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+// Wraps GMalloc to count the heap allocations of the threads inside a scope, off in shipping builds
+#ifndef UD_HEAP_COUNTER
+	#define UD_HEAP_COUNTER !UE_BUILD_SHIPPING
+#endif
+
+// Heap allocations made by the threads inside one of its scopes. The steps count into the counter of their state so a test can check that
+// their scratch only comes from the frame arena. Nothing is counted until Install wrapped GMalloc.
+class UNREALDOD_API FUDHeapCounter
+{
+public:
+
+	static void Install(); // Once, with -UDHeapCounter on the command line or from a test, the allocator is never unwrapped
+	static bool IsInstalled();
+	static FUDHeapCounter* GetCurrent(); // Counter of this thread, none outside of a scope
+
+	FORCEINLINE uint64 GetNumAllocations() const { return NumAllocations.load(std::memory_order_relaxed); }; // Mallocs and reallocs since the counter was created
+	FORCEINLINE void Add() { NumAllocations.fetch_add(1, std::memory_order_relaxed); };
+
+	// Counts the allocations of this thread into Counter while alive. A null counter pauses the counting around engine calls that allocate
+	// their own bookkeeping, such as the task system, the workers they start count again with the counter they were given.
+	struct UNREALDOD_API FScope
+	{
+		explicit FScope(FUDHeapCounter* Counter);
+		~FScope();
+
+	private:
+
+		FUDHeapCounter* Previous = nullptr;
+	};
+
+private:
+
+	std::atomic<uint64> NumAllocations{ 0 };
+};
@@ -0,0 +1,58 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/GCObject.h"
+
+class AActor;
+class UStaticMesh;
+class UInstancedStaticMeshComponent;
+struct FUDEntityHandle;
+
+// Renders actorless entities as instances, one instanced static mesh component per mesh. Game thread only.
+// Transforms are buffered by SetTransform and pushed in contiguous runs by Flush.
+// Lives outside any UObject, so it reports the owner, meshes and components it holds to the garbage collector itself.
+struct UNREALDOD_API FUDInstancePresenter : public FGCObject
+{
+	void Initialize(AActor* InOwner);
+
+	// FGCObject
+	virtual void AddReferencedObjects(FReferenceCollector& Collector) override;
+	virtual FString GetReferencerName() const override { return TEXT("FUDInstancePresenter"); };
+
+	void AddInstance(const FUDEntityHandle& Handle, UStaticMesh* Mesh, const FTransform& Transform);
+	void RemoveInstance(const FUDEntityHandle& Handle); // Hides the instance and recycles its slot
+	bool HasInstance(const FUDEntityHandle& Handle) const;
+	FTransform GetTransform(const FUDEntityHandle& Handle) const;
+
+	void SetTransform(const FUDEntityHandle& Handle, const FVector& Location, const FRotator& Rotation);
+	void Flush();
+
+private:
+
+	struct FInstance
+	{
+		uint32 Generation = 0;
+		int32 MeshIndex = INDEX_NONE;
+		int32 InstanceIndex = INDEX_NONE;
+	};
+
+	struct FMeshInstances
+	{
+		TObjectPtr<UStaticMesh> Mesh = nullptr;
+		TObjectPtr<UInstancedStaticMeshComponent> Component = nullptr;
+		TArray<FTransform> Transforms = {};			// Mirror of the component instances
+		TArray<int32> DirtyInstances = {};
+		TBitArray<> DirtyMask = {};
+		TArray<int32> FreeInstances = {};
+	};
+
+	int32 FindOrAddMesh(UStaticMesh* Mesh);
+	const FInstance* FindInstance(const FUDEntityHandle& Handle) const;
+
+	TObjectPtr<AActor> Owner = nullptr;
+	TArray<FMeshInstances> Meshes = {};
+	TArray<FInstance> Instances = {};				// Indexed by sparse slot
+	TArray<FTransform> RunTransforms = {};			// Scratch for Flush
+};
@@ -0,0 +1,100 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Systems/UDSimulation.h"
+#include <type_traits>
+
+// Dense array of every component a query can ask for. The archetypes are ordered so each component covers a prefix of the dense arrays.
+template<typename ComponentType>
+struct TUDComponentTraits;
+
+#define UD_QUERY_COMPONENT(ComponentType, Array) \
+	template<> \
+	struct TUDComponentTraits<ComponentType> \
+	{ \
+		static FORCEINLINE ComponentType* GetData(FUDSimulationState& State) { return State.Array.GetData(); }; \
+		static FORCEINLINE int32 Num(const FUDSimulationState& State) { return State.Array.Num(); }; \
+	};
+
+UD_QUERY_COMPONENT(FUDLocation, Locations)
+UD_QUERY_COMPONENT(FUDRotation, Rotations)
+UD_QUERY_COMPONENT(FUDMovement, Movements)
+UD_QUERY_COMPONENT(FUDMovementInput, Inputs)
+UD_QUERY_COMPONENT(FUDCollision, Collisions)
+UD_QUERY_COMPONENT(EUDSimulationLOD, LODs)
+
+#undef UD_QUERY_COMPONENT
+
+namespace UD
+{
+	namespace Query
+	{
+		template<typename ComponentType>
+		FORCEINLINE ComponentType* GetData(FUDSimulationState& State) { return TUDComponentTraits<std::remove_const_t<ComponentType>>::GetData(State); };
+
+		template<typename FunctionType, typename... ComponentTypes>
+		FORCEINLINE void Run(const int32 Begin, const int32 End, FunctionType& Function, ComponentTypes*... Components)
+		{
+			for (int32 i = Begin; i < End; i++)
+			{
+				Function(i, Components[i]...);
+			}
+		}
+
+		template<typename FunctionType, typename... ComponentTypes>
+		FORCEINLINE void RunIndexed(const int32* Indices, const int32 Begin, const int32 End, FunctionType& Function, ComponentTypes*... Components)
+		{
+			for (int32 n = Begin; n < End; n++)
+			{
+				const int32 i = Indices[n];
+				Function(i, Components[i]...);
+			}
+		}
+	}
+
+	// End of the dense range holding every component
+	template<typename... ComponentTypes>
+	FORCEINLINE int32 GetQueryEnd(const FUDSimulationState& State)
+	{
+		static_assert(sizeof...(ComponentTypes) > 0, "A query needs at least one component");
+		int32 End = MAX_int32;
+		((End = FMath::Min(End, TUDComponentTraits<std::remove_const_t<ComponentTypes>>::Num(State))), ...);
+		return End;
+	}
+
+	// Calls Function(Index, Components&...) for every entity holding the components, a const component is passed by const reference.
+	// One loop is generated per component set with the function inlined into it, e.g. ForEach<FUDLocation, const FUDMovement>(State, Function).
+	template<typename... ComponentTypes, typename FunctionType>
+	FORCEINLINE void ForEach(FUDSimulationState& State, FunctionType&& Function)
+	{
+		Query::Run(0, GetQueryEnd<ComponentTypes...>(State), Function, Query::GetData<ComponentTypes>(State)...);
+	}
+
+	// Begin and End in the dense arrays, clamped to the entities holding the components
+	template<typename... ComponentTypes, typename FunctionType>
+	FORCEINLINE void ForEachInRange(FUDSimulationState& State, const int32& Begin, const int32& End, FunctionType&& Function)
+	{
+		Query::Run(Begin, FMath::Min(End, GetQueryEnd<ComponentTypes...>(State)), Function, Query::GetData<ComponentTypes>(State)...);
+	}
+
+	// Awake entities only, Begin and End in the active indices of the last BeginStep which must all hold the components
+	template<typename... ComponentTypes, typename FunctionType>
+	FORCEINLINE void ForEachActive(FUDSimulationState& State, const int32& Begin, const int32& End, FunctionType&& Function)
+	{
+		const TArray<int32>& ActiveIndices = State.GetActiveIndices();
+		check(Begin >= End || ActiveIndices[End - 1] < GetQueryEnd<ComponentTypes...>(State)); // Ascending, the last one is enough
+		Query::RunIndexed(ActiveIndices.GetData(), Begin, End, Function, Query::GetData<ComponentTypes>(State)...);
+	}
+
+	// Chunks of the query on UD::ParallelForChunks, Function may only write the components of the entity it is called for
+	template<typename... ComponentTypes, typename FunctionType>
+	void ParallelForEach(FUDSimulationState& State, FunctionType&& Function)
+	{
+		UD::ParallelForChunks(GetQueryEnd<ComponentTypes...>(State), State.Config, [&State, &Function](int32 ChunkIndex, int32 Begin, int32 End)
+		{
+			Query::Run(Begin, End, Function, Query::GetData<ComponentTypes>(State)...);
+		});
+	}
+}
@@ -0,0 +1,139 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Systems/UDSimulationConfig.h"
+
+struct FUDEntityHandle;
+struct FUDSimulationSnapshot;
+
+#define UD_REPLICATION_HISTORY 4		// Received states kept per entity by the client, deltas against older baselines are sent in full
+#define UD_REPLICATION_IN_FLIGHT 64		// Unacked packets remembered per connection
+#define UD_REPLICATION_MAX_SLOTS (1 << 20)	// Sparse slots a client accepts, bounds what a single packet can make it allocate
+
+// Entity state on the integer grids of the replication settings
+struct UNREALDOD_API FUDQuantizedEntity
+{
+	int32 Position[3] = {};
+	int32 Velocity[3] = {};
+	uint32 Yaw = 0;
+};
+
+// Server side of one client. Game thread.
+struct UNREALDOD_API FUDReplicationConnection
+{
+	struct FBaseline
+	{
+		FUDQuantizedEntity State = {};
+		uint32 Generation = 0;
+		uint32 Sequence = 0;
+		bool bValid = false;	// The client acked this state
+	};
+
+	struct FSentEntity
+	{
+		int32 Slot = INDEX_NONE;
+		uint32 Generation = 0;
+		FUDQuantizedEntity State = {};
+		bool bRemoved = false;
+	};
+
+	struct FPacket
+	{
+		uint32 Sequence = 0;
+		TArray<FSentEntity> Entities = {};
+	};
+
+	TArray<FBaseline> Baselines = {};	// Indexed by sparse slot
+	TArray<float> Priorities = {};		// Indexed by sparse slot, grows every frame an entity is not sent
+	TBitArray<> ForcedSlots = {};		// See FUDReplicationServer::ForceEntity
+	TBitArray<> ForcedFullSlots = {};
+	FPacket InFlight[UD_REPLICATION_IN_FLIGHT] = {};
+	uint32 NextSequence = 1;
+};
+
+// Writes delta compressed, quantized and bit packed entity states for every connection, prioritized within a byte budget.
+// An entity is sent when it moved past the error tolerance since the state its client last acked. Game thread.
+struct UNREALDOD_API FUDReplicationServer
+{
+	void Initialize(const FUDSimulationConfig& InConfig);
+
+	int32 AddConnection();
+	void RemoveConnection(const int32& ConnectionId);
+
+	// Writes the next packet of a connection, ViewerLocation drives the relevance of the entities
+	uint32 WritePacket(const int32& ConnectionId, const FUDSimulationSnapshot& Snapshot, const FVector& ViewerLocation, TArray<uint8>& OutPacket);
+	void ReceiveAck(const int32& ConnectionId, const uint32& Sequence);
+
+	// Sends the entity with the next packet of every connection, bSkipSource sends the full state instead of a delta against the acked one
+	void ForceEntity(const int32& Slot, const bool& bSkipSource);
+
+	FORCEINLINE int32 GetNumConnections() const { return Connections.Num(); };
+
+private:
+
+	struct FCandidate
+	{
+		int32 Index = INDEX_NONE;	// In the snapshot, INDEX_NONE for removals
+		int32 Slot = INDEX_NONE;
+		float Priority = 0.f;
+	};
+
+	FUDReplicationConnection* FindConnection(const int32& ConnectionId);
+	static void Grow(FUDReplicationConnection& Connection, const int32& NumSlots);
+
+	FUDSimulationConfig Config = {};
+	TSparseArray<FUDReplicationConnection> Connections = {};
+	TArray<FCandidate> Candidates = {};	// Scratch for WritePacket
+	TBitArray<> PresentSlots = {};		// Scratch for WritePacket
+};
+
+// Decodes the packets of FUDReplicationServer, indexed by the sparse slots of the server. Game thread.
+struct UNREALDOD_API FUDReplicationClient
+{
+	void Initialize(const FUDSimulationConfig& InConfig);
+
+	// Returns false on a malformed or stale packet and leaves the state untouched, only the packets read successfully have to be acked back to the server
+	bool ReadPacket(const TArray<uint8>& Packet, uint32& OutSequence);
+
+	FORCEINLINE bool HasEntity(const int32& Slot) const { return bPresent.IsValidIndex(Slot) && bPresent[Slot]; };
+
+	TArray<uint32> Generations = {};
+	TArray<FVector> Locations = {};
+	TArray<FVector> Velocities = {};
+	TArray<float> Yaws = {};
+	TBitArray<> bPresent = {};
+	TArray<int32> UpdatedSlots = {};		// Written by the last packet, removals included
+
+private:
+
+	struct FReceived
+	{
+		FUDQuantizedEntity State = {};
+		uint32 Sequence = 0;
+	};
+
+	struct FDecoded
+	{
+		int32 Slot = INDEX_NONE;
+		uint32 Generation = 0;
+		FUDQuantizedEntity State = {};
+		bool bRemoved = false;
+		bool bFull = false;		// Carries its generation, a delta keeps the one the client has
+	};
+
+	void Grow(const int32& Slot);
+	const FReceived* FindBaseline(const int32& Slot, const uint32& Sequence) const;
+
+	FUDSimulationConfig Config = {};
+	TArray<FReceived> History = {};			// UD_REPLICATION_HISTORY per slot, indexed by sequence
+	uint32 LatestSequence = 0;
+	TArray<FDecoded> Decoded = {};			// Scratch of ReadPacket, applied once the whole packet read fine
+};
+
+namespace UD
+{
+	FUDQuantizedEntity QuantizeEntity(const FUDSimulationConfig& Config, const FVector& Location, const FVector& Velocity, const float& Yaw);
+	void DequantizeEntity(const FUDSimulationConfig& Config, const FUDQuantizedEntity& State, FVector& OutLocation, FVector& OutVelocity, float& OutYaw);
+}
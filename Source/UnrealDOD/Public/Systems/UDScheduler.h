@@ -0,0 +1,60 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FUDSimulationState;
+
+// Parts of the state a system reads or writes
+enum class EUDComponents : uint32
+{
+	None		= 0,
+	Locations	= 1 << 0,	// Streams included
+	Rotations	= 1 << 1,
+	Movements	= 1 << 2,
+	Inputs		= 1 << 3,
+	Collisions	= 1 << 4,
+	LODs		= 1 << 5,	// Tiers and the step stagger
+	Activity	= 1 << 6,	// Awake bits and still steps, the active lists are only rebuilt between steps
+	World		= 1 << 7,	// Scene queries and actors
+	All			= 0xFFFFFFFF
+};
+ENUM_CLASS_FLAGS(EUDComponents);
+
+// Runs on a worker with the state lock held by the simulation thread, marks what it changed in the change masks of the components it writes
+using FUDSystemFunction = TFunction<void(FUDSimulationState& State, const float& Delta)>;
+
+struct UNREALDOD_API FUDSystem
+{
+	FName Name = NAME_None;
+	EUDComponents Reads = EUDComponents::None;
+	EUDComponents Writes = EUDComponents::None;
+	FUDSystemFunction Execute = {};
+	bool bEnabled = true;
+};
+
+// Runs the registered systems once per step. A system waits for every earlier system it conflicts with, a write against a read or a write
+// of the same component, so the result is the one of a serial run in registration order while unrelated systems share the workers.
+struct UNREALDOD_API FUDScheduler
+{
+	bool AddSystem(const FUDSystem& System, const FName& Before = NAME_None); // Appended unless Before names a registered system, false when the name is taken
+	bool RemoveSystem(const FName& Name);
+	bool SetSystemEnabled(const FName& Name, const bool& bEnabled);
+
+	// Simulation thread, bParallel false runs the systems one after the other on the calling thread
+	void Run(FUDSimulationState& State, const float& Delta, const bool& bParallel);
+
+	int32 Num() const;
+	FString DescribeGraph() const; // One line per system with the systems it waits for
+
+private:
+
+	int32 FindSystem(const FName& Name) const;
+	void BuildGraph(); // Holds Mutex
+
+	mutable FCriticalSection Mutex;					// Any thread registers, the simulation thread holds it for the whole run
+	TArray<FUDSystem> Systems = {};
+	TArray<TArray<int32>> Dependencies = {};		// Per system, the earlier enabled systems it conflicts with
+	bool bGraphDirty = true;
+};
@@ -3,8 +3,27 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "Templates/SubclassOf.h"
+#include "Math/RandomStream.h"
+#include "Tasks/Task.h"
+#include "CollisionQueryParams.h"
+#include "Systems/UDSimulationConfig.h"
+#include "Systems/UDSimulationStats.h"
+#include "Systems/UDDirtyMask.h"
+#include "Systems/UDFrameArena.h"
+#include "Systems/UDHeapCounter.h"
+#include "Systems/UDInstancePresenter.h"
+#include "Systems/UDReplication.h"
+#include "Systems/UDScheduler.h"
+#include "Systems/UDSimulationStreams.h"
+#include "Systems/UDSpatialHash.h"
+#include "Systems/UDSpscRing.h"
+#include "Systems/UDTripleBuffer.h"
 
 #define UD_DOD_TAG "DOD"
+#define UD_HASH_CHUNK_SIZE 1024 // Entities per state hash chunk, fixed so peers with different threading settings still compare
+#define UD_DOD_INSTANCE_TAG "DODInstance" // Static mesh actors converted to instances at BeginPlay
 
 struct UNREALDOD_API FUDSimulationCommand
 {
@@ -13,30 +32,25 @@ struct UNREALDOD_API FUDSimulationCommand
 	int64 EnqueuedFrame = 0;
 };
 
+// Any thread -> game thread transport. The systems run on workers so there can be several producers, they take turns on a short lock,
+// the game thread is the only consumer and pops without it.
 struct UNREALDOD_API FUDSimulationQueue
 {
-	TArray<FUDSimulationCommand> Commands = {};
-	int32 MaxSize = 3;
+	explicit FUDSimulationQueue(const int32 InMaxSize = 3) : Commands(InMaxSize) {};
 
-	FUDSimulationQueue() : bFinishedExecution(false), bLocked(false) {};
+	void ExecuteCommands();								// Game thread
+	bool Enqueue(FUDSimulationCommand&& Command);		// Any thread, returns false and counts an overflow when full
+	void Clear();										// Game thread
 
-	void ExecuteCommands();
-	void Enqueue(const FUDSimulationCommand& Command);
-	void Clear();
-
-	bool IsLocked() const { return bLocked; };					// Simulation thread
-	void Lock() { check(!IsInGameThread()); bLocked = true; };	// Simulation thread
-	void Unlock() { check(!IsInGameThread()); bLocked = false; };	// Simulation thread
-	void SleepUntilUnlocked();
-
-	bool DoneExecuting() const { return bFinishedExecution; };		// Game thread
-	void FinishExecution() { bFinishedExecution = true; };			// Game thread
-	void WaitForExecution() { bFinishedExecution = false; };		// Game thread
+	FORCEINLINE uint32 GetNumOverflows() const { return NumOverflows.load(std::memory_order_relaxed); };	// Commands dropped because the queue was full
+	FORCEINLINE uint32 GetNumEnqueued() const { return NumEnqueued.load(std::memory_order_relaxed); };
 
 protected:
 
-	uint8 bFinishedExecution : 1;
-	uint8 bLocked : 1; // This makes sure no concurrency issues happen with the queue
+	TUDSpscRing<FUDSimulationCommand> Commands;
+	FCriticalSection ProducersMutex;					// Makes the producers a single one for the ring
+	std::atomic<uint32> NumOverflows{ 0 };
+	std::atomic<uint32> NumEnqueued{ 0 };
 };
 
 struct UNREALDOD_API FUDActor	
@@ -49,6 +63,18 @@ struct UNREALDOD_API FUDActor
 	FORCEINLINE const bool operator==(const FUDActor& Other) const { return this->Ptr == Other.Ptr; };
 };
 
+// Stable reference to an entity, the dense index of an entity changes whenever another one is unregistered
+struct UNREALDOD_API FUDEntityHandle
+{
+	int32 Index = INDEX_NONE;	// Sparse slot, owned by the entity for its whole lifetime
+	uint32 Generation = 0;		// Bumped every time the slot is released so stale handles can be detected
+
+	FORCEINLINE bool IsSet() const { return Index != INDEX_NONE; };
+	FORCEINLINE bool operator==(const FUDEntityHandle& Other) const { return Index == Other.Index && Generation == Other.Generation; };
+	FORCEINLINE bool operator!=(const FUDEntityHandle& Other) const { return !(*this == Other); };
+	FORCEINLINE friend uint32 GetTypeHash(const FUDEntityHandle& Handle) { return HashCombine(::GetTypeHash(Handle.Index), ::GetTypeHash(Handle.Generation)); };
+};
+
 struct UNREALDOD_API FUDLocation
 {
 	FVector Value = FVector::ZeroVector;
@@ -61,17 +87,14 @@ struct UNREALDOD_API FUDMovement
 	float Deceleration = 0.1f;
 	float MaxSpeed = 1000.f;
 	float Gravity = 980.f; // Make it a vector if direction is needed
-	uint8 bEnableCollision : 1;
-
-	FUDMovement() : bEnableCollision(true) {};
-}; 
+};
 
 struct UNREALDOD_API FUDCollision
 {
 	float Size = 50.f;
-	float Height = 5.f;
-	float AcceptableSlope = 4.f;
-	float AcceptableDistance = 5.f;
+	float Height = 5.f;					// Distance from the ground to the entity origin
+	float AcceptableSlope = 45.f;		// Degrees, steeper ground makes the entity slide
+	float AcceptableDistance = 5.f;		// Entities closer to the ground than this snap to it
 	uint8 MaxSlopeIteration = 10;
 };
 
@@ -87,44 +110,293 @@ struct UNREALDOD_API FUDMovementInput
 	FVector Rotation = FVector::ZeroVector;
 };
 
+struct UNREALDOD_API FUDSweepRequest
+{
+	int32 Index = INDEX_NONE;
+	FVector TargetLocation = FVector::ZeroVector;
+};
+
+// Component sets, the dense arrays hold one contiguous range per archetype in this order
+enum class EUDArchetype : uint8
+{
+	Agent,		// Movement, input and collision: ground, sweeps and separation
+	Mover,		// Movement and input, for projectiles and anything that ignores the world
+	Static,		// Transform only, never stepped
+	Num
+};
+
+// Simulation tiers, picked by the distance to the closest viewer
+enum class EUDSimulationLOD : uint8
+{
+	Full,		// Every step, ground and sweeps
+	Reduced,	// Every LODReducedInterval steps, ground field only
+	Dormant,	// Every LODDormantInterval steps, follows its horizontal velocity
+};
+
+// Remaining part of a correction, applied a fraction per step by FUDSimulationState::SmoothCorrections
+struct UNREALDOD_API FUDSmoothedCorrection
+{
+	FUDEntityHandle Handle = {};
+	FVector LocationOffset = FVector::ZeroVector;
+	FRotator RotationOffset = FRotator::ZeroRotator;
+	int32 StepsLeft = 0;
+};
+
+struct FUDCorrectionList;
+
+// Entity registered in bulk or queued by FUDSimulation, gathered on the game thread
+struct UNREALDOD_API FUDEntityDesc
+{
+	AActor* Actor = nullptr;		// None for an actorless entity
+	UStaticMesh* Mesh = nullptr;	// Actorless entities with a mesh are presented as instances by FUDSimulation
+	FTransform Transform = FTransform::Identity;
+	EUDArchetype Archetype = EUDArchetype::Agent;
+	FUDEntityHandle Handle = {};	// Reserved from FUDHandleAllocator before the entity exists, allocated by the registration when unset
+};
+
+// Sparse slots and their generations, any thread. Handles are handed out ahead of their entity so registrations can be queued.
+struct UNREALDOD_API FUDHandleAllocator
+{
+	FUDEntityHandle Allocate();
+	void Release(const FUDEntityHandle& Handle); // Bumps the generation, a later Allocate hands the slot out again
+
+private:
+
+	FCriticalSection Mutex;
+	TArray<uint32> Generations = {}; // Of the next handle of every slot
+	TArray<int32> FreeSlots = {};
+};
+
+// Structural change queued by the game thread, applied by the next step in the order they were made
+enum class EUDEntityChange : uint8
+{
+	Register,	// Entity, with its reserved handle
+	Bind,		// Entity.Actor to the actorless Entity.Handle
+	Unregister,	// Entity.Handle
+};
+
+struct UNREALDOD_API FUDEntityChange
+{
+	EUDEntityChange Type = EUDEntityChange::Register;
+	FUDEntityDesc Entity = {};
+};
+
+// Bulk registration populated on a worker, finished on the game thread
+struct UNREALDOD_API FUDPendingRegistration
+{
+	TArray<FUDEntityDesc> Entities = {}; // The new ones, with their reserved handles
+	TArray<FUDEntityHandle> Handles = {}; // One per requested entity, reserved by the game thread
+	TFunction<void(const TArray<FUDEntityHandle>& Handles)> OnRegistered = {};
+	UE::Tasks::FTask Task = {};
+};
+
+// Sweeps gathered by one chunk during the integration and resolved together with shared query params
+struct UNREALDOD_API FUDSweepBatch
+{
+	TArray<FUDSweepRequest, TUDFrameAllocator<>> Requests = {}; // Emptied by BeginStep
+	int32 NumSweeps = 0; // Issued by the last ResolveSweeps, slides included
+	FCollisionQueryParams QueryParams = FCollisionQueryParams(SCENE_QUERY_STAT(UDSimulationSweep), false);
+};
+
 struct UNREALDOD_API FUDSimulationState
 {
 	TArray<FUDLocation>			Locations		= {};
 	TArray<FUDRotation>			Rotations		= {};
-	TArray<FUDMovement>			Movements		= {};
-	TArray<FUDMovementInput>	Inputs			= {};
-	TArray<FUDCollision>		Collisions		= {};
+	TArray<FUDMovement>			Movements		= {}; // Agents and movers only
+	TArray<FUDMovementInput>	Inputs			= {}; // Agents and movers only
+	TArray<FUDCollision>		Collisions		= {}; // Agents only
 	TArray<FUDActor>			Actors			= {};
-	TArray<FUDSimulationQueue>	MovementQueues	= {};
+	TArray<EUDSimulationLOD>	LODs			= {}; // Only read when UsesLOD()
+	TBitArray<>					Awake			= {}; // Asleep entities are skipped by the steps, see ActiveIndices
+	TArray<uint8>				StillSteps		= {}; // Consecutive steps without input nor velocity
 	// put this at the end for a better data layout
 	TArray<int32>				IndicesToReplicate = {};
 
-	int32 RegisterActor(AActor* Actor);
-	void UnregisterActor(const int32& Index);
-	FUDSimulationQueue& GetActorMovementQueue(const int32& Index);
+	FUDMovementStreams			Streams			= {}; // Only filled with EUDStorageMode::StructOfArrays, agents and movers only
+	FUDFrameArena				FrameArena;			  // Scratch of the current step, reset by BeginStep
+	FUDHeapCounter				HeapCounter;		  // Heap allocations of the steps, counted by whoever runs them, see FUDHeapCounter::FScope
+	FUDDirtyMask				DirtyMasks[(int32)EUDDirty::Num] = {}; // Changed since ClearDirty, written by the systems
+	FUDStepCounters				StepCounters	= {}; // Current step
+	int32						ArchetypeEnds[(int32)EUDArchetype::Num] = {}; // End of every archetype range in the dense arrays
+	FUDSimulationConfig			Config			= {};
+	UWorld*						World			= nullptr; // Collision queries, none without a world
+	FUDSpatialHash				SpatialHash		= {}; // Rebuilt by SeparateEntities every frame
+	TArray<FVector>				Viewers			= {}; // Drive the LOD tiers, none keeps every entity at full rate
+
+	// Sparse set, every array above is the packed dense side
+	TArray<int32>				SparseToDense	= {}; // INDEX_NONE for free slots
+	TArray<uint32>				Generations		= {};
+	TArray<int32>				DenseToSparse	= {};
+	FUDHandleAllocator			HandleAllocator;	  // Owns the slots, Generations above only follows the registered entities
+	TMap<AActor*, FUDEntityHandle> ActorHandles	= {};
+
+	// Structural changes take the lock. FUDSimulation only makes them from its steps or from a bulk registration, never from the game thread.
+	FUDEntityHandle RegisterActor(AActor* Actor, const EUDArchetype& Archetype = EUDArchetype::Agent); // Game thread, reads the actor transform
+	FUDEntityHandle RegisterEntity(const FTransform& Transform, const EUDArchetype& Archetype = EUDArchetype::Agent); // Actorless, presented by FUDInstancePresenter
+	FUDEntityHandle RegisterEntity(const FUDEntityDesc& Entity); // Any thread, the actor must already be tagged
+	void RegisterEntities(const TArray<FUDEntityDesc>& Entities, TArray<FUDEntityHandle>& OutHandles); // One lock and one growth of every array, any thread, the actors must already be tagged
+	bool BindActor(const FUDEntityHandle& Handle, AActor* Actor); // Gives an actorless entity its actor, which must already be tagged
+	void UnregisterActor(const FUDEntityHandle& Handle);
+	void SetMovementInput(const FUDEntityHandle& Handle, const FUDMovementInput& Input);
+	void AddImpulse(const FUDEntityHandle& Handle, const FVector& Impulse); // Adds to the velocity and wakes the entity
+
+	FORCEINLINE int32 Num() const { return Actors.Num(); };
+	FORCEINLINE int32 GetArchetypeBegin(const EUDArchetype& Archetype) const { return Archetype == EUDArchetype::Agent ? 0 : ArchetypeEnds[(int32)Archetype - 1]; };
+	FORCEINLINE int32 GetArchetypeEnd(const EUDArchetype& Archetype) const { return ArchetypeEnds[(int32)Archetype]; };
+	FORCEINLINE int32 NumMoving() const { return ArchetypeEnds[(int32)EUDArchetype::Mover]; }; // Agents and movers lead the dense arrays
+	EUDArchetype GetArchetype(const int32& Index) const;
+	FORCEINLINE bool IsValidHandle(const FUDEntityHandle& Handle) const { return GetDenseIndex(Handle) != INDEX_NONE; };
+	int32 GetDenseIndex(const FUDEntityHandle& Handle) const; // INDEX_NONE for stale handles
+	FUDEntityHandle GetHandle(const int32& Index) const;
+	FORCEINLINE bool UsesStreams() const { return Config.StorageMode == EUDStorageMode::StructOfArrays; };
+	FORCEINLINE bool CanQueryWorld() const { return World && !Config.bDeterministic; }; // The physics scene is not part of the lockstep state
+	FORCEINLINE bool IsAwake(const int32& Index) const { return Awake[Index]; };
+	FORCEINLINE int32 NumAwake() const { return ActiveIndices.Num(); }; // As of the last step
+	FORCEINLINE const TArray<int32>& GetActiveIndices() const { return ActiveIndices; }; // Ascending, as of the last BeginStep
+	FORCEINLINE bool UsesLOD() const { return Config.bLOD && !Config.bDeterministic && Viewers.Num() > 0; };
+
+	uint64 ComputeStateHash(TArray<uint64>& OutChunkHashes) const; // Hashes every UD_HASH_CHUNK_SIZE entities in parallel then combines the chunks in order
+
+	void ClearDirty(); // Sizes the change masks to the entities and clears them
+	FORCEINLINE const FUDDirtyMask& GetDirtyMask(const EUDDirty& Component) const { return DirtyMasks[(int32)Component]; };
+	void BeginStep(); // Releases the scratch of the previous step and rebuilds the active lists, the systems of a step only read them so they can run side by side
+	void UpdateLODs(); // Advances the step stagger and re-buckets the next LODRebucketSteps share of the entities
+	void UpdateLocations(const float& Delta);	// The moved entities are set in the location and velocity change masks
+	void UpdateRotations(const float& Delta);	// The turned entities are set in the rotation change mask
+	int32 UpdateLocationsChunk(const int32& Begin, const int32& End, const float& Delta, const bool& bAgents, FUDFrameIndices& OutActorsToUpdate, FUDSweepBatch& OutSweeps, FUDFrameIndices& OutSleepers); // Begin and End in ActiveIndices, all of one archetype, returns the entities integrated. Picks the specialized loop.
+	int32 UpdateLocationsChunk_Streams(const int32& Begin, const int32& End, const float& Delta, FUDFrameIndices& OutActorsToUpdate, FUDSweepBatch& OutSweeps, FUDFrameIndices& OutSleepers); // Begin and End in ActiveBlocks, returns the lanes integrated
+	void ResolveSweeps(FUDSweepBatch& Sweeps, FUDFrameIndices& OutActorsToUpdate); // Moves collided entities and slides them along the hit normal
+	void UpdateRotationsChunk(const int32& Begin, const int32& End, const float& Delta, FUDFrameIndices& OutActorsToUpdate); // Begin and End in ActiveIndices, picks the specialized loop
+	void SeparateEntities(); // Pushes overlapping agents apart, marks them in the location mask and wakes the sleeping ones
+	void SeparateEntitiesChunk(const int32& Begin, const int32& End, const float& MaxPush, FUDFrameIndices& OutPushed);
+
+	void ApplyCorrections(const FUDCorrectionList& Corrections); // Snaps the velocities and queues the location and rotation offsets, takes the lock, FUDSimulation calls it from its steps
+	void SmoothCorrections(); // Applies one step of the queued corrections
+	bool ResolveGround(const int32& Index, FVector& InOutLocation, FVector& InOutVelocity, const bool& bAllowTrace) const; // Returns true when the entity stands on the ground
+	bool TraceGround(const int32& Index, const FVector& Location, float& OutHeight, FVector3f& OutNormal) const;
+
+	FCriticalSection Mutex; // Held by the simulation thread for a whole frame and by structural changes
 
-	TArray<int32> UpdateLocations(const float& Delta);	// Returns array of actors changed
-	TArray<int32> UpdateRotations(const float& Delta);	// Returns array of actors changed
-	void UpdateActorLocation(const int32& Index, const float& Delta);
-	void UpdateActorRotation(const int32& Index, const float& Delta);
-	void UpdateActorsLocations(const TArray<int32>& Indices, const float& Delta);
-	void UpdateActorsRotations(const TArray<int32>& Indices, const float& Delta);
+private:
 
-	bool CheckCollision(FVector& OutPosition, const AActor* Actor, const FUDCollision& Collision, const FVector& CurrentPosition, const FVector& TargetPosition);
-	bool CanMove(const AActor* Actor, const FVector& CurrentPosition, const FVector& TargetPosition, FVector& OutPos);
-	void WaitUntilUnlocked();
+	FUDEntityHandle AddEntity(AActor* Actor, const FVector& InLocation, const FRotator& InRotation, const EUDArchetype& Archetype, const FUDEntityHandle& Reserved = {});
+	void InitializeEntity(const int32& Index, AActor* Actor, const FVector& InLocation, const FRotator& InRotation, const EUDArchetype& Archetype); // Fills the components of a slot left free in its archetype range
+	FUDEntityHandle AssignHandle(const FUDEntityHandle& Reserved, const int32& Index); // Points the reserved slot, or a newly allocated one when unset, at Index
+	void RemoveAtSwap(const int32& Index); // Fills the hole with the last entity of the archetype, then every later range moves its last entity down by one
+	void MoveEntity(const int32& From, const int32& To); // Copies the components and patches the sparse slot, From is left as a hole
+	void FinishStreamLanes(const int32& Begin, const int32& End, const EUDSimulationLOD& LOD, const bool& bAgents, FUDFrameIndices& OutActorsToUpdate, FUDSweepBatch& OutSweeps, FUDFrameIndices& OutSleepers);
+
+	// One loop per feature set, the features are constant over a chunk so the checks are compiled out instead of taken per entity
+	template<bool bAgents, bool bUseLOD>
+	int32 UpdateLocationsKernel(const int32& Begin, const int32& End, const float& Delta, FUDFrameIndices& OutActorsToUpdate, FUDSweepBatch& OutSweeps, FUDFrameIndices& OutSleepers);
+	template<bool bUseLOD>
+	void UpdateRotationsKernel(const int32& Begin, const int32& End, const float& Delta, FUDFrameIndices& OutActorsToUpdate);
+	void EmptyFrameScratch(); // The containers on the frame arena drop their memory, called by BeginStep when the arena is reset
+
+	// Per chunk lists on the frame arena, only the outer arrays are kept between steps
+	TArray<FUDFrameIndices> ChunkActorsToUpdate = {};
+	TArray<FUDFrameIndices> ChunkRotationsToUpdate = {}; // Apart from ChunkActorsToUpdate since rotations run next to locations
+	TArray<FUDFrameIndices> ChunkSleepers = {};
+	TArray<FUDSweepBatch> ChunkSweeps = {};		// Kept for their query params
+	TArray<int32> ChunkNumIntegrated = {};
+	uint32 NumSpawned = 0; // Seeds the entity randomness in deterministic mode
+	TArray<float, TUDFrameAllocator<>> SeparationX = {};	// Ground plane positions gathered for the spatial hash in component mode
+	TArray<float, TUDFrameAllocator<>> SeparationY = {};
+	void WakeEntity(const int32& Index);
+	bool UpdateStillness(const int32& Index); // Counts the still steps, true once the entity can sleep
+	void RefreshActiveIndices(); // Rebuilds the active lists after entities woke, slept, were added or removed
+	void SleepEntities();
+	void RecenterStreams(); // Moves the stream origin to the crowd once it drifted past UD_STREAM_REBASE_DISTANCE
+
+	EUDSimulationLOD ComputeLOD(const int32& Index) const;
+	EUDSimulationLOD GetBlockLOD(const int32& Block) const; // Finest tier of a UD_STREAM_WIDTH block, the stream kernels step whole blocks
+	int32 GetStepInterval(const EUDSimulationLOD& LOD, const int32& Block) const; // Steps to integrate now, 0 when the block waits for its turn
+
+	TArray<int32> ActiveIndices = {};		// Awake dense indices in ascending order
+	TArray<int32> ActiveBlocks = {};		// UD_STREAM_WIDTH blocks holding at least one awake entity, the stream kernels step whole blocks
+	bool bActiveDirty = true;
+	bool bStreamsMoved = false; // Entities were added, the stream origin is checked by the next BeginStep
+
+	uint64 LODStep = 0;
+	int32 LODCursor = 0;
+	TArray<FUDSmoothedCorrection> SmoothedCorrections = {};
+	TArray<int32> CorrectionSlots = {};		// Sparse slot to SmoothedCorrections, INDEX_NONE when not corrected
+};
 
-	uint8 bLocked : 1;
-	FUDSimulationState() : bLocked(false) {};
+// Game thread side of the interpolation, indexed by sparse slot so it survives dense swaps
+struct UNREALDOD_API FUDPresentationState
+{
+	TArray<FUDEntityHandle>	Handles			= {};
+	TArray<FVector>			FromLocations	= {};
+	TArray<FVector>			ToLocations		= {};
+	TArray<FVector>			Velocities		= {};
+	TArray<FRotator>		FromRotations	= {};
+	TArray<FRotator>		ToRotations		= {};
+	TArray<FUDEntityHandle>	MovingHandles	= {}; // Dirty in the latest snapshot
+	TArray<FUDEntityHandle>	ActorHandles	= {}; // Owner of the slot in Actors, the game thread never reads the state the steps reshape
+	TArray<AActor*>			Actors			= {}; // Indexed by sparse slot, none for actorless entities
+	double					SnapshotTime	= 0.;
+	double					StepSeconds		= 0.;
+	float					Alpha			= 0.f;
 };
 
+// Input stamped with the step it applies to, queued by FUDSimulation and applied at the start of that step
+struct UNREALDOD_API FUDStepInput
+{
+	uint64 Step = 0;
+	FUDEntityHandle Handle = {};
+	FUDMovementInput Input = {};
+	FVector Impulse = FVector::ZeroVector;
+	bool bImpulse = false; // Adds Impulse to the velocity instead of setting Input
+};
+
+struct UNREALDOD_API FUDStepHash
+{
+	uint64 Step = 0;
+	uint64 Hash = 0;
+};
+
+// Copy of the render relevant components, published by the simulation thread once per frame and never modified after
+struct UNREALDOD_API FUDSimulationSnapshot
+{
+	TArray<FUDEntityHandle>	Handles		= {};
+	TArray<FVector>			Locations	= {};
+	TArray<FRotator>		Rotations	= {};
+	TArray<FVector>			Velocities	= {};
+	TArray<int32>			DirtyIndices = {}; // Changed since the last snapshot the game thread read, ascending
+	FUDDirtyMask			DirtyMasks[(int32)EUDDirty::Num] = {}; // Same window per component, entities carried from a skipped snapshot are set in every mask
+	int32					NumSlots	= 0; // Sparse slots of the state, dirty handles index below it
+	uint64					Frame		= 0;
+	double					Time		= 0.; // Scheduled time of the last step, spaced by exactly one step
+	FUDSimulationStats		Stats		= {};
+	TArray<FUDStepHash>		StepHashes	= {}; // Deterministic mode, every step since the last snapshot the game thread read
+	TArray<uint64>			ChunkHashes	= {}; // Deterministic mode, chunks of the last step
+};
+
+// Authoritative values of the client entities that drifted past the tolerance, compact enough to be sent every network tick
+struct UNREALDOD_API FUDCorrectionList
+{
+	TArray<int32>			Indices		= {}; // Dense indices in the compared client state
+	TArray<FUDEntityHandle>	Handles		= {}; // Client handles
+	TArray<FVector>			Locations	= {};
+	TArray<FRotator>		Rotations	= {};
+	TArray<FVector>			Velocities	= {};
+
+	FORCEINLINE int32 Num() const { return Indices.Num(); };
+	void Reset();
+
+	// Scratch of UD::FindDifferences, kept to reuse the allocations every tick
+	TArray<TArray<int32>>	ChunkIndices = {};
+	TArray<int32>			Candidates	= {};
+	TArray<int32>			SlotToIndex	= {};
+};
 
 struct UNREALDOD_API FUDSimulation : public FRunnable
 {
 
 public:
 
-	FUDSimulation(UWorld* InWorld);
+	FUDSimulation(UWorld* InWorld, const FUDSimulationConfig& InConfig = FUDSimulationConfig());
 	virtual ~FUDSimulation() override;
 
 	// Thread
@@ -134,26 +406,110 @@ public:
 
 	// Simulation
 	void Tick_GameThread(const float& Delta);
+	FORCEINLINE float GetInterpolationAlpha() const { return Presentation.Alpha; }; // Past 1 when extrapolating
+	FORCEINLINE const FUDSimulationStats& GetStats() const { return Stats; }; // Game thread, as of the last snapshot read
+	FORCEINLINE const TArray<FUDStepHash>& GetStepHashes() const { return StepHashes; }; // Game thread, steps hashed since the previous snapshot read
+	FORCEINLINE const TArray<uint64>& GetChunkHashes() const { return ChunkHashes; }; // Game thread, to localize a divergence with UD::FindDivergentChunk
 	
-	FORCEINLINE int32 RegisterActor(AActor* Actor) { return State.RegisterActor(Actor); };
-	FORCEINLINE void UnregisterActor(const int32& Index) { return State.UnregisterActor(Index); };
-
-	void ReplicateIndex(const int32& Index, const bool& bSkipSource);
+	// Structural changes, game thread. The handle is reserved at once, the entity is added, bound or removed by the next step.
+	FUDEntityHandle RegisterActor(AActor* Actor, const EUDArchetype& Archetype = EUDArchetype::Agent);
+	// Bulk registration, game thread. The actors are tagged and the handles reserved here, the components are populated on a worker and the simulation
+	// only starts stepping once every pending batch is in. OnRegistered runs on the game thread with one handle per entity, after the instances were added.
+	void RegisterEntitiesAsync(TArray<FUDEntityDesc>&& Entities, TFunction<void(const TArray<FUDEntityHandle>& Handles)> OnRegistered = nullptr);
+	FORCEINLINE bool IsRegistering() const { return NumPendingRegistrations.load(std::memory_order_acquire) > 0; };
+	void UnregisterActor(const FUDEntityHandle& Handle);
+
+	// Input, any thread. Applied at the start of Step, so peers in lockstep that stamp the same step stay identical whatever step was running
+	// when the input came in. The default applies to the next step run, an input stamped for a step already run is applied late and counted.
+	void SetMovementInput(const FUDEntityHandle& Handle, const FUDMovementInput& Input, const uint64& Step = 0);
+	void AddImpulse(const FUDEntityHandle& Handle, const FVector& Impulse, const uint64& Step = 0);
+	FORCEINLINE uint64 GetNextStep() const { return NextStep.load(std::memory_order_acquire); }; // Any thread, first step not run yet
+
+	// Instanced presentation, game thread
+	void InitializePresentation(AActor* Owner);
+	FUDEntityHandle RegisterInstance(UStaticMesh* Mesh, const FTransform& Transform, const EUDArchetype& Archetype = EUDArchetype::Agent);
+	AActor* MaterializeActor(const FUDEntityHandle& Handle, TSubclassOf<AActor> ActorClass); // Replaces the instance by a spawned actor
+
+	// Replication, game thread from the last snapshot read
+	FORCEINLINE FUDReplicationServer& GetReplication() { return Replication; };
+	uint32 WriteReplicationPacket(const int32& ConnectionId, const FVector& ViewerLocation, TArray<uint8>& OutPacket);
+	void ReplicateIndex(const int32& Index, const bool& bSkipSource); // Index in the last snapshot read, sent with the next packet of every connection
 	TArray<int32> GetDifferences(const FUDSimulationState& ClientState, const float& ErrorTolerence); // Returns the list of indices that have to be corrected
+	void GetDifferences(const FUDSimulationState& ClientState, const float& ErrorTolerence, FUDCorrectionList& OutCorrections); // Game thread against the last snapshot read, ClientState must not be stepping
+	void ApplyCorrections(const FUDCorrectionList& InCorrections); // Game thread, queued and applied by the next step so the game thread never waits for a running one
+	void SetViewers(const TArray<FVector>& InViewers); // Game thread, picked up by the next step
+	void SetStepping(const float& StepRate, const int32& MaxSubSteps); // Any thread, picked up by the next wake of the simulation thread
+
+	// Systems run every step, any thread, waits for the running step. Built-in systems: UD.LOD, UD.Locations, UD.Rotations and UD.Corrections.
+	FORCEINLINE bool AddSystem(const FUDSystem& System, const FName& Before = NAME_None) { return Scheduler.AddSystem(System, Before); };
+	FORCEINLINE bool RemoveSystem(const FName& Name) { return Scheduler.RemoveSystem(Name); };
+	FORCEINLINE bool SetSystemEnabled(const FName& Name, const bool& bEnabled) { return Scheduler.SetSystemEnabled(Name, bEnabled); };
+	FORCEINLINE FString DescribeSystems() const { return Scheduler.DescribeGraph(); };
 
 	
 private:
 
 	FUDSimulation() : bIsRunning(false) {};
 
+	void StepSimulation(const float& Delta);										// Simulation thread, one fixed step
+	void WaitUntil(const double& Deadline) const;									// Simulation thread
+	void ApplyStepInputs(const uint64& Step);										// Simulation thread, the queued inputs stamped up to Step
+	void ApplyEntityChanges();														// Simulation thread, the queued structural changes
+	void QueueEntityChange(const EUDEntityChange& Type, const FUDEntityDesc& Entity); // Game thread
+	void SetPresentedActor(const FUDEntityHandle& Handle, AActor* Actor);			// Game thread, none clears the slot
+	void QueueInput(const FUDStepInput& Input);										// Any thread
+	void PublishSnapshot(const double& Time);										// Simulation thread, the state change masks hold the entities to publish
+	void ApplySnapshot(const FUDSimulationSnapshot& Snapshot);						// Game thread
+	void ReceiveSnapshot(const FUDSimulationSnapshot& Snapshot);					// Game thread, interpolation targets
+	void ApplyInterpolation(const double& Time);									// Game thread
+	void SetEntityTransform(const FUDEntityHandle& Handle, const FVector& Location, const FRotator& Rotation); // Game thread, actor or instance
+	void FinishRegistrations();														// Game thread, completed bulk registrations
+
 private:
 
 	FUDSimulationState State = FUDSimulationState();
+	FUDScheduler Scheduler = {};
+
+	// Write-back
+	TUDTripleBuffer<FUDSimulationSnapshot> Snapshots = {};
+	TArray<FUDEntityHandle> CarriedDirtyHandles = {};	// Dirty entities of a snapshot the game thread never read
+	uint64 SimulationFrame = 0;
+	FUDSimulationStats SimulationStats = {};		// Simulation thread
+	FUDSimulationStats Stats = {};					// Game thread copy
+	FUDStepTimeHistory StepTimes = {};				// Simulation thread
+	FUDDirtyMask PublishMask = {};					// Simulation thread, every component of the steps run since the last snapshot
+	TArray<FUDStepHash> PendingStepHashes = {};		// Simulation thread, hashed since the last publish or carried from a skipped snapshot
+	TArray<uint64> PendingChunkHashes = {};
+	TArray<FUDStepHash> StepHashes = {};			// Game thread copies
+	TArray<uint64> ChunkHashes = {};
+	FUDPresentationState Presentation = {};
+	FUDInstancePresenter InstancePresenter = {};
+	FUDReplicationServer Replication = {};
+	FUDCorrectionList Corrections = {};			// Game thread, scratch of GetDifferences
+	TArray<TUniquePtr<FUDPendingRegistration>> PendingRegistrations = {}; // Game thread, in the order they were requested
+	std::atomic<int32> NumPendingRegistrations{ 0 };	// The simulation thread waits for zero before stepping
+	FCriticalSection ViewersMutex;				// Short lived, unlike State.Mutex which is held for whole steps
+	TArray<FVector> PendingViewers = {};
+	bool bViewersChanged = false;
+	FCriticalSection CorrectionsMutex;			// Short lived, same as ViewersMutex
+	FUDCorrectionList PendingCorrections = {};
+	FUDCorrectionList StepCorrections = {};		// Simulation thread, swapped with PendingCorrections at the start of a step
+	TMap<AActor*, FUDEntityHandle> ActorHandles = {}; // Game thread, the queued registrations included
+	FCriticalSection ChangesMutex;				// Short lived, same as ViewersMutex
+	TArray<FUDEntityChange> PendingChanges = {};
+	TArray<FUDEntityChange> StepChanges = {};	// Simulation thread, swapped with PendingChanges at the start of a step
+	FCriticalSection InputsMutex;				// Short lived, same as ViewersMutex
+	TArray<FUDStepInput> PendingInputs = {};
+	TArray<FUDStepInput> StepInputs = {};		// Simulation thread, ordered by step, holds the inputs of the steps to come
+	std::atomic<uint64> NextStep{ 0 };
+	FCriticalSection SteppingMutex;
+	float PendingStepRate = 0.f;
+	int32 PendingMaxSubSteps = 0;
+	bool bSteppingChanged = false;
 
 	// Threading
 	FRunnableThread* CurrentThread = nullptr;
 	uint8 bIsRunning : 1;
-	double FramePerSecond = 30.;
 
 	// Context
 	UWorld* World = nullptr;
@@ -161,8 +517,23 @@ private:
 
 namespace UD
 {
-	static FUDSimulationQueue GeneralQueue = FUDSimulationQueue();
+	extern UNREALDOD_API FUDSimulationQueue GeneralQueue; // Any thread to the game thread
+
+	bool EnqueueCommandToGameThread(FUDSimulationQueue& Queue, const int64 FrameDelay, TFunction<void(void)> LambdaToAdd);
+	bool EnqueueGeneralCommandToGameThread(TFunction<void(void)> LambdaToAdd);
+
+	// Splits [0, Num) into Config.ChunkSize ranges and runs them on at most Config.WorkerCount tasks
+	int32 GetChunkSize(const FUDSimulationConfig& Config); // Rounded to UD_STREAM_WIDTH so every chunk starts on a vector boundary
+	int32 GetNumChunks(const int32 Num, const FUDSimulationConfig& Config);
+	void ParallelForChunks(const int32 Num, const FUDSimulationConfig& Config, TFunctionRef<void(int32 ChunkIndex, int32 Begin, int32 End)> ChunkFunction); // The chunks run with the frame arena and heap counter of the caller
+	void MergeChunkIndices(const TArray<TArray<int32>>& ChunkIndices, TArray<int32>& OutIndices); // Keeps the chunk order so the result stays sorted
+
+	void AddBuiltinSystems(FUDScheduler& Scheduler); // UD.LOD, UD.Locations, UD.Rotations and UD.Corrections
+
+	// Deterministic mode
+	FRandomStream MakeEntityRandom(const FUDSimulationConfig& Config, const uint32& Ordinal); // Same stream on every peer that registers entities in the same order
+	int32 FindDivergentChunk(const TArray<uint64>& LocalChunkHashes, const TArray<uint64>& RemoteChunkHashes); // First differing chunk, INDEX_NONE when identical
 
-	void EnqueueCommandToGameThread(FUDSimulationQueue& Queue, const int64 FrameDelay, TFunction<void(void)> LambdaToAdd);
-	void EnqueueGeneralCommandToGameThread(TFunction<void(void)> LambdaToAdd);
+	// Compares ClientState against the authoritative snapshot in chunks, entities at the same dense index with the same handle take the vector path
+	void FindDifferences(const FUDSimulationSnapshot& Authority, const FUDSimulationState& ClientState, const float& LocationTolerance, const float& RotationTolerance, const FUDSimulationConfig& Config, FUDCorrectionList& OutCorrections);
 }
\ No newline at end of file
@@ -0,0 +1,176 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UDSimulationConfig.generated.h"
+
+class UUDGroundField;
+
+UENUM(BlueprintType)
+enum class EUDStorageMode : uint8
+{
+	ArrayOfStructs,
+	StructOfArrays,	// Integrates from split float streams, see FUDMovementStreams
+};
+
+USTRUCT(BlueprintType)
+struct UNREALDOD_API FUDSimulationConfig
+{
+	GENERATED_BODY()
+
+	FORCEINLINE double GetStepSeconds() const { return 1. / FMath::Max(StepRate, 1.f); };
+
+	// Fixed simulation steps per second, every step integrates exactly 1 / StepRate seconds
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Stepping", meta = (ClampMin = "1"))
+	float StepRate = 30.f;
+
+	// Steps run back to back after a hitch before the remaining time is dropped, in deterministic mode it is caught up over the next wakes instead
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Stepping", meta = (ClampMin = "1"))
+	int32 MaxSubSteps = 4;
+
+	// Below this much time before the next step the thread stops sleeping and yields
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Stepping", meta = (ClampMin = "0", Units = "s"))
+	float YieldMargin = 0.002f;
+
+	// Below this much time before the next step the thread spins
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Stepping", meta = (ClampMin = "0", Units = "s"))
+	float SpinMargin = 0.0002f;
+
+	// Number of entities integrated by a single parallel task
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Threading", meta = (ClampMin = "1"))
+	int32 ChunkSize = 1024;
+
+	// Max number of worker tasks used by the integration, 0 uses every available worker
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Threading", meta = (ClampMin = "0"))
+	int32 WorkerCount = 0;
+
+	// Runs the systems that do not share a written component at the same time, off runs them one after the other in registration order
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Threading")
+	bool bParallelSystems = true;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Layout")
+	EUDStorageMode StorageMode = EUDStorageMode::ArrayOfStructs;
+
+	// Uses the vectorized stream kernel, the scalar kernel is kept as a fallback and for comparison.
+	// The kernel is built on the engine vector registers, SSE on x64 and NEON on arm64, which every CPU the engine runs on has.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Layout", meta = (EditCondition = "StorageMode == EUDStorageMode::StructOfArrays"))
+	bool bUseSIMD = true;
+
+	// The game thread presents a blend of the last two snapshots instead of snapping to the latest one
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Presentation")
+	bool bInterpolate = false;
+
+	// Keeps entities moving along their velocity when the next snapshot is late
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Presentation", meta = (EditCondition = "bInterpolate"))
+	bool bExtrapolate = true;
+
+	// How far past the latest snapshot an entity can be extrapolated, in simulation steps
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Presentation", meta = (EditCondition = "bInterpolate && bExtrapolate", ClampMin = "0"))
+	float MaxExtrapolation = 0.5f;
+
+	// Pushes overlapping entities apart using FUDCollision::Size, without touching the physics scene
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Separation")
+	bool bSeparation = false;
+
+	// Cell size of the spatial hash, 0 uses the largest entity diameter
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Separation", meta = (EditCondition = "bSeparation", ClampMin = "0"))
+	float SeparationCellSize = 0.f;
+
+	// Share of the overlap resolved per simulation step, 1 pushes overlapping pairs fully apart in one step
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Separation", meta = (EditCondition = "bSeparation", ClampMin = "0", ClampMax = "1"))
+	float SeparationStiffness = 0.5f;
+
+	// Baked ground sampled for gravity, ground snapping and slopes, entities fall forever without one
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Ground")
+	TObjectPtr<UUDGroundField> GroundField = nullptr;
+
+	// Traces the ground for entities over complex or uncovered cells of the field
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Ground", meta = (EditCondition = "GroundField != nullptr"))
+	bool bGroundTraceFallback = true;
+
+	// Seeded entity randomness, scalar kernels, no world queries and no dropped steps, peers feeding the same inputs stamped with the same steps
+	// stay bit identical and hash their state every step
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Determinism")
+	bool bDeterministic = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Determinism", meta = (EditCondition = "bDeterministic"))
+	int32 Seed = 0;
+
+	// Size of one position step on the replication grid
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replication", meta = (ClampMin = "0.01", Units = "cm"))
+	float ReplicationPositionPrecision = 1.f;
+
+	// Bits per axis of a full position, 22 bits at 1cm covers +-20km
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replication", meta = (ClampMin = "2", ClampMax = "31"))
+	int32 ReplicationPositionBits = 22;
+
+	// Bits per axis of a position delta against the acked state, bigger moves are sent in full
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replication", meta = (ClampMin = "2", ClampMax = "31"))
+	int32 ReplicationDeltaBits = 10;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replication", meta = (ClampMin = "0.01", Units = "cm/s"))
+	float ReplicationVelocityPrecision = 1.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replication", meta = (ClampMin = "2", ClampMax = "31"))
+	int32 ReplicationVelocityBits = 12;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replication", meta = (ClampMin = "2", ClampMax = "16"))
+	int32 ReplicationYawBits = 10;
+
+	// Entities closer than this to the state their client acked are not sent
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replication", meta = (ClampMin = "0", Units = "cm"))
+	float ReplicationErrorTolerance = 2.f;
+
+	// Size limit of one packet, the most relevant entities are sent first and the others wait with a growing priority
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replication", meta = (ClampMin = "64", Units = "Bytes"))
+	int32 ReplicationBytesPerPacket = 8192;
+
+	// Entities this far from the viewer get half the priority of the ones next to it
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Replication", meta = (ClampMin = "1", Units = "cm"))
+	float ReplicationRelevanceDistance = 10000.f;
+
+	// Rotation drift that makes GetDifferences correct an entity, next to the location tolerance given by the caller
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Correction", meta = (ClampMin = "0", Units = "Degrees"))
+	float CorrectionRotationTolerance = 1.f;
+
+	// Steps a received correction is spread over, 0 or 1 snaps the entity on the next step
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Correction", meta = (ClampMin = "0", ClampMax = "255"))
+	int32 CorrectionSmoothingSteps = 0;
+
+	// Entities near a viewer get the full step with sweeps, farther ones are stepped every few steps without sweeps, the farthest only follow their velocity.
+	// Ignored in deterministic mode since the viewers are local to every peer.
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LOD")
+	bool bLOD = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LOD", meta = (EditCondition = "bLOD", ClampMin = "0", Units = "cm"))
+	float LODReducedDistance = 5000.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LOD", meta = (EditCondition = "bLOD", ClampMin = "0", Units = "cm"))
+	float LODDormantDistance = 20000.f;
+
+	// Steps between two updates of a reduced entity, which then integrates the whole interval at once
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LOD", meta = (EditCondition = "bLOD", ClampMin = "1"))
+	int32 LODReducedInterval = 2;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LOD", meta = (EditCondition = "bLOD", ClampMin = "1"))
+	int32 LODDormantInterval = 8;
+
+	// Share of a tier distance an entity has to move past before dropping to the next tier, avoids flickering on the boundary
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LOD", meta = (EditCondition = "bLOD", ClampMin = "0", ClampMax = "1"))
+	float LODHysteresis = 0.1f;
+
+	// Steps to re-bucket every entity once, each step only measures its share of the entities
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "LOD", meta = (EditCondition = "bLOD", ClampMin = "1"))
+	int32 LODRebucketSteps = 8;
+
+	// Entities without input that stayed still for SleepSteps steps leave the integration until an input, a correction, an impulse or a push wakes them
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sleep")
+	bool bSleep = false;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sleep", meta = (EditCondition = "bSleep", ClampMin = "0", Units = "cm/s"))
+	float SleepVelocity = 1.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Sleep", meta = (EditCondition = "bSleep", ClampMin = "1", ClampMax = "255"))
+	int32 SleepSteps = 8;
+};
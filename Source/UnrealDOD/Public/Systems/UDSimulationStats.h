@@ -0,0 +1,74 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats.h"
+
+// Per entity profiler scopes, only for short captures of a few entities, at scale the scopes cost more than the work they measure
+#ifndef UD_ENTITY_TRACE
+	#define UD_ENTITY_TRACE 0
+#endif
+
+#if UD_ENTITY_TRACE
+	#include "ProfilingDebugging/CpuProfilerTrace.h"
+	#define UD_ENTITY_SCOPE(Name) TRACE_CPUPROFILER_EVENT_SCOPE_STR(Name)
+#else
+	#define UD_ENTITY_SCOPE(Name)
+#endif
+
+#define UD_STATS_HISTORY 256 // Steps the step time percentiles are taken over
+
+DECLARE_STATS_GROUP(TEXT("UnrealDOD"), STATGROUP_UnrealDOD, STATCAT_Advanced);
+
+// Filled by the systems of one step, reset by BeginStep
+struct UNREALDOD_API FUDStepCounters
+{
+	uint32 NumIntegrated	= 0;	// Entities stepped, sleeping ones and the ones off their stagger excluded
+	uint32 NumSweeps		= 0;	// World sweeps issued
+};
+
+// Scheduler counters, written by the simulation thread and handed to the game thread with every snapshot
+struct UNREALDOD_API FUDSimulationStats
+{
+	uint64 NumSteps			= 0;
+	uint64 NumWakes			= 0;
+	uint64 NumOverruns		= 0;	// Steps that took longer than the step itself
+	uint64 NumDroppedSteps	= 0;	// Steps skipped by the MaxSubSteps catch-up limit, never in deterministic mode
+	uint64 NumLateInputs	= 0;	// Stamped for a step already run and applied at the next one, peers in lockstep diverge
+	double LastStepSeconds	= 0.;
+	double MaxStepSeconds	= 0.;
+	double AverageStepSeconds = 0.;	// Exponential moving average
+	double StepSecondsP50	= 0.;	// Over the last UD_STATS_HISTORY steps
+	double StepSecondsP95	= 0.;
+	double StepSecondsP99	= 0.;
+	double WaitErrorSeconds	= 0.;	// Last wake up delay past the deadline
+	double SleepSeconds		= 0.;	// Waited since the previous snapshot
+	double OverrunSeconds	= 0.;	// Total time the steps ran past their budget
+	uint64 NumStepHeapAllocations = 0;	// Made by the steps and their workers, the task system excluded. Flat once the simulation is steady, 0 until FUDHeapCounter::Install
+	uint64 ScratchPeakBytes	= 0;	// Largest step scratch
+	FUDStepCounters StepCounters = {}; // Last step
+	uint32 NumDirty			= 0;	// Entities published by the snapshot
+	uint64 NumSkippedSnapshots = 0;	// Snapshots replaced before the game thread read them, their dirty entities are carried over
+	uint64 NumCommandsEnqueued = 0;	// General queue, any thread to the game thread
+	uint64 NumCommandsDropped = 0;	// General queue was full
+};
+
+// Durations of the last UD_STATS_HISTORY steps, simulation thread
+struct UNREALDOD_API FUDStepTimeHistory
+{
+	void Add(const double& Seconds);
+	void GetPercentiles(double& OutP50, double& OutP95, double& OutP99); // Sorts a copy, meant for once per snapshot
+
+private:
+
+	double Samples[UD_STATS_HISTORY] = {};
+	TArray<double, TInlineAllocator<UD_STATS_HISTORY>> Sorted = {};
+	int32 NumSamples = 0;
+	int32 NextSample = 0;
+};
+
+namespace UD
+{
+	void ReportStats(const FUDSimulationStats& Stats); // Game thread, every frame, feeds stat UnrealDOD and the UnrealDOD category of csvprofile
+}
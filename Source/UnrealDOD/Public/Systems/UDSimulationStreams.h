@@ -0,0 +1,72 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Core/UDCoreStreams.h"
+
+#define UD_STREAM_WIDTH 4		// Entities processed per vector instruction
+#define UD_STREAM_ALIGNMENT 32
+#define UD_STREAM_REBASE_DISTANCE 100000. // 1km, the state moves the stream origin once the crowd center drifts this far from it
+
+static_assert(UD_STREAM_WIDTH == UD::Core::StreamWidth, "The engine streams and the core kernels must use the same padding");
+
+struct FUDLocation;
+struct FUDMovement;
+struct FUDMovementInput;
+
+using FUDStream = TArray<float, TAlignedHeapAllocator<UD_STREAM_ALIGNMENT>>;
+
+// Split component storage used by EUDStorageMode::StructOfArrays, one float per entity per stream.
+// Streams are padded with zeroed lanes up to a multiple of UD_STREAM_WIDTH so kernels never need a scalar tail.
+// Positions are stored relative to Origin, a float keeps them to 1/16cm within 10km of it and to 1cm within 100km.
+struct UNREALDOD_API FUDMovementStreams
+{
+	FVector Origin			= FVector::ZeroVector;
+	FUDStream PositionX		= {};
+	FUDStream PositionY		= {};
+	FUDStream PositionZ		= {};
+	FUDStream VelocityX		= {};
+	FUDStream VelocityY		= {};
+	FUDStream VelocityZ		= {};
+	FUDStream InputX		= {};
+	FUDStream InputY		= {};
+	FUDStream InputZ		= {};
+	FUDStream Acceleration	= {};
+	FUDStream Deceleration	= {};
+	FUDStream MaxSpeed		= {};
+	FUDStream Gravity		= {};
+
+	int32 Add(const FUDLocation& Location, const FUDMovement& Movement, const FUDMovementInput& Input);
+	int32 AddZeroed(const int32& Count); // Grows every stream once, returns the first new index
+	void Set(const int32& Index, const FUDLocation& Location, const FUDMovement& Movement, const FUDMovementInput& Input);
+	void SetInput(const int32& Index, const FUDMovementInput& Input);
+	void RemoveAtSwap(const int32& Index);
+	void Move(const int32& From, const int32& To);
+	void Rebase(const FVector& NewOrigin); // Keeps the absolute positions
+	void Reset();
+
+	FORCEINLINE int32 Num() const { return NumEntities; };
+	SIZE_T GetAllocatedSize() const;
+	UD::Core::FMovementStreamsView GetView();
+	FORCEINLINE FVector GetPosition(const int32& Index) const { return Origin + FVector(PositionX[Index], PositionY[Index], PositionZ[Index]); };
+	FORCEINLINE FVector GetVelocity(const int32& Index) const { return FVector(VelocityX[Index], VelocityY[Index], VelocityZ[Index]); };
+	FORCEINLINE void SetPosition(const int32& Index, const FVector& Value) { PositionX[Index] = (float)(Value.X - Origin.X); PositionY[Index] = (float)(Value.Y - Origin.Y); PositionZ[Index] = (float)(Value.Z - Origin.Z); };
+	FORCEINLINE void SetVelocity(const int32& Index, const FVector& Value) { VelocityX[Index] = (float)Value.X; VelocityY[Index] = (float)Value.Y; VelocityZ[Index] = (float)Value.Z; };
+
+private:
+
+	template<typename FunctionType>
+	void ForEachStream(FunctionType Function);
+
+	int32 NumEntities = 0;
+};
+
+namespace UD
+{
+	// Gravity + input acceleration + deceleration + max speed clamp, then moves the position by the new velocity.
+	// Begin must be a multiple of UD_STREAM_WIDTH, End is rounded up into the padding.
+	void IntegrateStreams_Scalar(FUDMovementStreams& Streams, const int32& Begin, const int32& End, const float& Delta);
+	void IntegrateStreams_Vector(FUDMovementStreams& Streams, const int32& Begin, const int32& End, const float& Delta);
+	void IntegrateStreams(FUDMovementStreams& Streams, const int32& Begin, const int32& End, const float& Delta, const bool& bUseSIMD);
+}
@@ -0,0 +1,15 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Core/UDCoreSpatialHash.h"
+
+struct FUDSimulationConfig;
+
+// Engine side of UD::Core::FSpatialHash, hashes and gathers on the simulation workers
+struct UNREALDOD_API FUDSpatialHash : public UD::Core::FSpatialHash
+{
+	// X and Y are indexed by dense index, CellSize should be at least the largest query distance
+	void Build(const TConstArrayView<float>& X, const TConstArrayView<float>& Y, const float& InCellSize, const FUDSimulationConfig& Config);
+};
@@ -0,0 +1,10 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Core/UDCoreSpscRing.h"
+
+// Bounded lock free ring for exactly one producer thread and one consumer thread, see UD::Core::TSpscRing
+template<typename ElementType>
+using TUDSpscRing = UD::Core::TSpscRing<ElementType>;
@@ -0,0 +1,56 @@
+// Copyright - Jed
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+// Lock free triple buffer for one writer thread and one reader thread.
+// The writer always has a buffer to fill and the reader always keeps the last complete one, neither side ever waits.
+template<typename ElementType>
+class TUDTripleBuffer
+{
+public:
+
+	TUDTripleBuffer() = default;
+	TUDTripleBuffer(const TUDTripleBuffer&) = delete;
+	TUDTripleBuffer& operator=(const TUDTripleBuffer&) = delete;
+
+	// Writer
+	FORCEINLINE ElementType& GetWriteBuffer() { return Buffers[WriteIndex]; };
+
+	// Writer, returns true when the previously published buffer was never read.
+	// The write buffer is then that same buffer, so the writer can carry over what the reader missed.
+	bool Publish()
+	{
+		const uint8 Previous = SharedIndex.exchange(WriteIndex | FreshBit, std::memory_order_acq_rel);
+		WriteIndex = Previous & IndexMask;
+		return (Previous & FreshBit) != 0;
+	}
+
+	// Reader, returns false when nothing was published since the last call
+	bool Consume()
+	{
+		if ((SharedIndex.load(std::memory_order_relaxed) & FreshBit) == 0)
+		{
+			return false;
+		}
+		const uint8 Previous = SharedIndex.exchange(ReadIndex, std::memory_order_acq_rel);
+		ReadIndex = Previous & IndexMask;
+		return true;
+	}
+
+	// Reader
+	FORCEINLINE const ElementType& GetReadBuffer() const { return Buffers[ReadIndex]; };
+
+private:
+
+	static constexpr uint8 IndexMask = 0x3;
+	static constexpr uint8 FreshBit = 0x4;
+
+	ElementType Buffers[3] = {};
+
+	alignas(PLATFORM_CACHE_LINE_SIZE) std::atomic<uint8> SharedIndex{ 1 };	// Last published buffer, with FreshBit until read
+	alignas(PLATFORM_CACHE_LINE_SIZE) uint8 WriteIndex = 0;					// Writer owned
+	alignas(PLATFORM_CACHE_LINE_SIZE) uint8 ReadIndex = 2;					// Reader owned
+};
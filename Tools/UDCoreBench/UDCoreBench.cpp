@@ -0,0 +1,275 @@
+// Copyright - Jed
+
+// Spawns synthetic entities in the engine independent core and reports ns/entity/frame, frame time percentiles and memory per entity.
+// Usage: UDCoreBench [--entities N] [--frames N] [--density EntitiesPerCell]
+
+#include "Core/UDCoreHash.h"
+#include "Core/UDCoreSpatialHash.h"
+#include "Core/UDCoreSpscRing.h"
+#include "Core/UDCoreStreams.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace UD::CoreBench
+{
+	using FClock = std::chrono::steady_clock;
+
+	struct FOptions
+	{
+		int32_t NumEntities = 100000;
+		int32_t NumFrames = 300;
+		float Density = 1.f; // Average entities per spatial hash cell
+	};
+
+	// Same layout as FUDMovementStreams, padded up to a multiple of the stream width
+	struct FStreams
+	{
+		std::vector<float> PositionX, PositionY, PositionZ, VelocityX, VelocityY, VelocityZ, InputX, InputY, InputZ, Acceleration, Deceleration, MaxSpeed, Gravity;
+		std::vector<float> Radius;
+
+		std::vector<float>* GetStreams[14] = { &PositionX, &PositionY, &PositionZ, &VelocityX, &VelocityY, &VelocityZ, &InputX, &InputY, &InputZ, &Acceleration, &Deceleration, &MaxSpeed, &Gravity, &Radius };
+
+		Core::FMovementStreamsView GetView()
+		{
+			return { PositionX.data(), PositionY.data(), PositionZ.data(), VelocityX.data(), VelocityY.data(), VelocityZ.data(),
+				InputX.data(), InputY.data(), InputZ.data(), Acceleration.data(), Deceleration.data(), MaxSpeed.data(), Gravity.data() };
+		}
+
+		size_t GetAllocatedSize() const
+		{
+			size_t Size = 0;
+			for (const std::vector<float>* Stream : GetStreams)
+			{
+				Size += Stream->capacity() * sizeof(float);
+			}
+			return Size;
+		}
+	};
+
+	// Flat square where every 100 unit cell, one entity diameter, holds Density entities on average, same defaults as FUDMovement and FUDCollision
+	static void Populate(FStreams& Streams, const FOptions& Options)
+	{
+		const int32_t Padded = Core::AlignUp(Options.NumEntities, Core::StreamWidth);
+		for (std::vector<float>* Stream : Streams.GetStreams)
+		{
+			Stream->assign(Padded, 0.f);
+		}
+
+		std::mt19937 Random(Options.NumEntities);
+		const float Side = std::sqrt(Options.NumEntities / Options.Density) * 100.f;
+		std::uniform_real_distribution<float> Position(0.f, Side);
+		std::uniform_real_distribution<float> Unit(-1.f, 1.f);
+		std::uniform_real_distribution<float> AccelerationRange(1024.f, 1612.f);
+		for (int32_t i = 0; i < Options.NumEntities; i++)
+		{
+			Streams.PositionX[i] = Position(Random);
+			Streams.PositionY[i] = Position(Random);
+			const float InputX = Unit(Random);
+			const float InputY = Unit(Random);
+			const float InputSize = std::max(std::sqrt(InputX * InputX + InputY * InputY), Core::KindaSmallNumber);
+			Streams.InputX[i] = InputX / InputSize;
+			Streams.InputY[i] = InputY / InputSize;
+			Streams.Acceleration[i] = AccelerationRange(Random);
+			Streams.Deceleration[i] = 0.1f;
+			Streams.MaxSpeed[i] = 1000.f;
+			Streams.Radius[i] = 50.f;
+		}
+	}
+
+	struct FFrameStats
+	{
+		double Mean = 0.;
+		double P50 = 0.;
+		double P90 = 0.;
+		double P99 = 0.;
+		double Max = 0.;
+	};
+
+	static FFrameStats MeasureFrames(const int32_t& NumFrames, const std::function<void()>& Frame)
+	{
+		Frame(); // Warm up the caches and the allocations
+
+		std::vector<double> FrameTimes(NumFrames);
+		for (int32_t i = 0; i < NumFrames; i++)
+		{
+			const FClock::time_point Start = FClock::now();
+			Frame();
+			FrameTimes[i] = std::chrono::duration<double, std::nano>(FClock::now() - Start).count();
+		}
+
+		FFrameStats Stats = {};
+		for (const double& FrameTime : FrameTimes)
+		{
+			Stats.Mean += FrameTime / NumFrames;
+		}
+		std::sort(FrameTimes.begin(), FrameTimes.end());
+		auto Percentile = [&FrameTimes](const double& Ratio) { return FrameTimes[std::min((size_t)(Ratio * FrameTimes.size()), FrameTimes.size() - 1)]; };
+		Stats.P50 = Percentile(0.5);
+		Stats.P90 = Percentile(0.9);
+		Stats.P99 = Percentile(0.99);
+		Stats.Max = FrameTimes.back();
+		return Stats;
+	}
+
+	static void Report(const char* Name, const FFrameStats& Stats, const int32_t& NumEntities)
+	{
+		std::printf("%-18s %9.3f ns/entity/frame   p50 %8.3f ms   p90 %8.3f ms   p99 %8.3f ms   max %8.3f ms\n",
+			Name, Stats.Mean / NumEntities, Stats.P50 * 1e-6, Stats.P90 * 1e-6, Stats.P99 * 1e-6, Stats.Max * 1e-6);
+	}
+
+	static void RunRing(const int32_t& NumCommands)
+	{
+		Core::TSpscRing<uint64_t> Ring(1024);
+		uint64_t Sum = 0;
+		const FClock::time_point Start = FClock::now();
+		std::thread Consumer([&]()
+		{
+			for (int32_t Received = 0; Received < NumCommands;)
+			{
+				uint64_t Value = 0;
+				if (Ring.Pop(Value))
+				{
+					Sum += Value;
+					Received++;
+				}
+				else
+				{
+					std::this_thread::yield(); // Keeps the bench usable on single core runners
+				}
+			}
+		});
+		for (int32_t i = 0; i < NumCommands; i++)
+		{
+			uint64_t Value = (uint64_t)i;
+			while (!Ring.Push(std::move(Value)))
+			{
+				std::this_thread::yield();
+			}
+		}
+		Consumer.join();
+		const double Nanoseconds = std::chrono::duration<double, std::nano>(FClock::now() - Start).count();
+		const bool bValid = Sum == (uint64_t)NumCommands * (NumCommands - 1) / 2;
+		std::printf("%-18s %9.3f ns/command, %d commands through a %u slot ring%s\n", "spsc_ring", Nanoseconds / NumCommands, NumCommands, Ring.Capacity(), bValid ? "" : " (CORRUPTED)");
+	}
+
+	static int Run(const FOptions& Options)
+	{
+		constexpr float Delta = 1.f / 30.f;
+		const int32_t NumEntities = Options.NumEntities;
+		std::printf("UDCoreBench - %d entities, %d frames, %.2f entities per cell\n", NumEntities, Options.NumFrames, Options.Density);
+
+		FStreams Streams = {};
+		Populate(Streams, Options);
+		const Core::FMovementStreamsView View = Streams.GetView();
+		Report("integrate_scalar", MeasureFrames(Options.NumFrames, [&]() { Core::IntegrateScalar(View, 0, NumEntities, Delta); }), NumEntities);
+
+		uint64_t StateHash = 0;
+		Report("state_hash", MeasureFrames(Options.NumFrames, [&]()
+		{
+			Core::FStateHasher Hasher(0);
+			for (int32_t i = 0; i < NumEntities; i++)
+			{
+				for (const std::vector<float>* Stream : Streams.GetStreams)
+				{
+					Hasher.AddFloat((*Stream)[i]);
+				}
+			}
+			StateHash = Hasher.Finish();
+		}), NumEntities);
+		std::printf("%-18s %016llx\n", "", (unsigned long long)StateHash);
+
+		// The crowd is spread again so the hash sees the requested density instead of wherever the integration moved it
+		Populate(Streams, Options);
+		Core::FSpatialHash Hash = {};
+		const float CellSize = 100.f;
+		Report("hash_build", MeasureFrames(Options.NumFrames, [&]() { Hash.Build(Streams.PositionX.data(), Streams.PositionY.data(), NumEntities, CellSize); }), NumEntities);
+
+		// The chunked passes the simulation runs on its workers have to list every bucket exactly like the serial sort
+		Core::FSpatialHash ChunkedHash = {};
+		const int32_t NumChunks = 7;
+		ChunkedHash.BeginBuild(NumEntities, CellSize);
+		ChunkedHash.BeginSort(NumChunks);
+		for (int32_t Chunk = 0; Chunk < NumChunks; Chunk++)
+		{
+			const int32_t Begin = (int32_t)((int64_t)NumEntities * Chunk / NumChunks);
+			const int32_t End = (int32_t)((int64_t)NumEntities * (Chunk + 1) / NumChunks);
+			ChunkedHash.HashRange(Streams.PositionX.data(), Streams.PositionY.data(), Begin, End);
+			ChunkedHash.CountRange(Chunk, Begin, End);
+		}
+		ChunkedHash.PrefixPartitions();
+		for (int32_t Chunk = NumChunks - 1; Chunk >= 0; Chunk--)
+		{
+			ChunkedHash.ScatterRange(Chunk, (int32_t)((int64_t)NumEntities * Chunk / NumChunks), (int32_t)((int64_t)NumEntities * (Chunk + 1) / NumChunks));
+		}
+		for (int32_t Partition = Core::FSpatialHash::NumPartitions - 1; Partition >= 0; Partition--)
+		{
+			ChunkedHash.SortPartition(Partition);
+		}
+		if (std::memcmp(ChunkedHash.GetSortedIndices(), Hash.GetSortedIndices(), NumEntities * sizeof(int32_t)) != 0)
+		{
+			std::printf("%-18s chunked sort differs from the serial sort\n", "hash_build");
+			return 1;
+		}
+
+		int64_t NumPushed = 0;
+		auto GetRadius = [&Streams](const int32_t Index) { return Streams.Radius[Index]; };
+		const FFrameStats SeparationStats = MeasureFrames(Options.NumFrames, [&]()
+		{
+			Hash.Build(Streams.PositionX.data(), Streams.PositionY.data(), NumEntities, CellSize);
+			NumPushed = 0;
+			for (int32_t i = 0; i < NumEntities; i++)
+			{
+				float PushX = 0.f;
+				float PushY = 0.f;
+				if (Core::ComputeSeparation(Hash, i, Streams.PositionX[i], Streams.PositionY[i], GetRadius, 0.5f, CellSize * 0.5f, PushX, PushY))
+				{
+					Streams.PositionX[i] += PushX;
+					Streams.PositionY[i] += PushY;
+					NumPushed++;
+				}
+			}
+		});
+		Report("hash_separation", SeparationStats, NumEntities);
+		std::printf("%-18s %9.2f %% of the entities pushed on the last frame\n", "", NumPushed * 100. / NumEntities);
+
+		RunRing(1 << 20);
+
+		const size_t Bytes = Streams.GetAllocatedSize() + Hash.GetAllocatedSize();
+		std::printf("%-18s %9.2f bytes/entity (streams %zu KB, spatial hash %zu KB)\n", "memory", (double)Bytes / NumEntities, Streams.GetAllocatedSize() / 1024, Hash.GetAllocatedSize() / 1024);
+		return 0;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	UD::CoreBench::FOptions Options = {};
+	for (int i = 1; i + 1 < argc; i += 2)
+	{
+		if (std::strcmp(argv[i], "--entities") == 0)
+		{
+			Options.NumEntities = std::max(std::atoi(argv[i + 1]), 1);
+		}
+		else if (std::strcmp(argv[i], "--frames") == 0)
+		{
+			Options.NumFrames = std::max(std::atoi(argv[i + 1]), 1);
+		}
+		else if (std::strcmp(argv[i], "--density") == 0)
+		{
+			Options.Density = std::max((float)std::atof(argv[i + 1]), 0.01f);
+		}
+		else
+		{
+			std::fprintf(stderr, "Unknown option %s\nUsage: UDCoreBench [--entities N] [--frames N] [--density EntitiesPerCell]\n", argv[i]);
+			return 1;
+		}
+	}
+	return UD::CoreBench::Run(Options);
+}